@@ -42,6 +42,38 @@ char Sump_usage[] =
     "http://www.ordinal.com/sump.html\n"
     "\n"
     "Directives (keywords are case insensitive, '_' is optional):\n"
+    "  -ALIGN_IN_BUFS or   Make each full input buffer end on a record\n"
+    "    -ALIGN            boundary by moving its trailing partial record\n"
+    "                      to the beginning of the next input buffer.  A\n"
+    "                      program invocation then only reads from two\n"
+    "                      input buffers if a record is larger than an\n"
+    "                      input buffer.  Input files are read with\n"
+    "                      buffered reads.\n"
+    "\n"
+    "  -BUF_POOL[=%s]      Borrow output and input buffers from a pool\n"
+    "                      shared with the other sump pumps in the process\n"
+    "                      that name the same pool, rather than holding\n"
+    "                      them for the life of the sump pump.\n"
+    "\n"
+    "  -CPUS=%s            Bind the threads to the listed cpus, e.g.\n"
+    "                      -CPUS=0-3,8, one cpu per program invocation\n"
+    "                      thread in turn, and the file reader and writer\n"
+    "                      threads to all of them.\n"
+    "\n"
+    "  -ELASTIC[=%d{k,m,g}] Allow more program invocations and input\n"
+    "                      buffers to be in progress when threads are idle\n"
+    "                      because the oldest invocation's output has not\n"
+    "                      been written.  The optional size is the memory\n"
+    "                      ceiling for the additional buffers (by default\n"
+    "                      3x the memory of the initial buffers).\n"
+    "\n"
+    "  -EXECUTOR[=%d]      Run the program invocations on the worker\n"
+    "                      threads of a process-wide executor rather than\n"
+    "                      on threads of their own, with -THREADS capping\n"
+    "                      the invocations in progress at once.  The\n"
+    "                      optional number of workers defaults to the\n"
+    "                      number of cpus.\n"
+    "\n"
     "  -GROUP_BY or -GROUP Group input records for the purpose of reducing\n"
     "                      them. The input should be coming from an nsort\n"
     "                      instance where the \"-match\" directive has\n"
@@ -51,6 +83,10 @@ char Sump_usage[] =
     "                      each program invocation may need to process\n"
     "                      records with more than one key value.\n"
     "\n"
+    "  -HUGE_PAGES or      Back the output and input buffers with huge\n"
+    "    -HUGE             pages where available, otherwise with\n"
+    "                      transparent huge pages.\n"
+    "\n"
     "  -IN=%s or           Input file name. If not specified, the input\n"
     "    -IN_FILE=%s       is read from standard input.\n"
     "                      The input file name can be followed by one or\n"
@@ -60,13 +96,38 @@ char Sump_usage[] =
     "                                normal buffered (not direct) reads.\n"
     "                      ,{DIRECT,DIR} The file will be read with\n"
     "                                direct and asynchronous reads.\n"
+    "                      ,MMAP     The file will be memory mapped and\n"
+    "                                its pages given to the program\n"
+    "                                invocations without copying.  The\n"
+    "                                file must not be truncated while\n"
+    "                                it is read (that raises SIGBUS).\n"
+    "                      ,URING    The file will be read (or written)\n"
+    "                                with direct requests through\n"
+    "                                io_uring where available.\n"
+    "                      ,READERS=%d The file will be read by this\n"
+    "                                many threads in parallel, each\n"
+    "                                filling a whole input buffer.\n"
+    "                      ,WRITERS=%d The output file will be written\n"
+    "                                by this many threads in parallel,\n"
+    "                                each writing the output of a task\n"
+    "                                at its offset in the file.\n"
+    "                      ,SYNC[=%d{k,m,g}] Flush the output file\n"
+    "                                with fdatasync() after each this\n"
+    "                                many bytes and after the last write.\n"
+    "                      ,CACHE={KEEP,SEQUENTIAL,DROP} The page cache\n"
+    "                                policy of normal reads (or writes):\n"
+    "                                none, advise sequential access, or\n"
+    "                                also drop the pages once read (or\n"
+    "                                written back).\n"
     "                      ,{TRANSFER,TRANS,TR}=%d{k,m,g}\n"
     "                                The transfer size (read request size)\n"
     "                                is specified in kilo, mega or giga\n"
-    "                                bytes.\n"
+    "                                bytes, or AUTO to pick it from the\n"
+    "                                file's block size and device.\n"
     "                      ,{COUNT,CO}=%d The count of the maximum number\n"
     "                                of outstanding asynchronous read \n"
-    "                                requests is given.\n"
+    "                                requests is given, or AUTO to tune it\n"
+    "                                during the run.\n"
     "                      Example:\n"
     "                        -in=myfilename,dir,trans=4m,co=4\n"
     "                                The above example specifies an input\n"
@@ -81,6 +142,27 @@ char Sump_usage[] =
     "                      specified size is multiplied by 2^10, 2^20 or\n"
     "                      2^30 respectively.\n"
     "\n"
+    "  -IN_BUF_SIZE=AUTO   Adapt the number of bytes given to each program\n"
+    "                      invocation to the measured time per input byte,\n"
+    "                      so that each invocation takes about -TASK_TIME.\n"
+    "                      The size ranges from 1/64th of the input buffer\n"
+    "                      size up to the input buffer size.\n"
+    "\n"
+    "  -MEMORY=%d[k,m,g]   The most memory to use for output and input\n"
+    "                      buffers.  The input buffer size and then the\n"
+    "                      number of program invocations in progress are\n"
+    "                      reduced as needed to fit.  The memory of idle\n"
+    "                      buffers is released while the output is not\n"
+    "                      being written.\n"
+    "\n"
+    "  -MLOCK              Lock the output and input buffers in memory, as\n"
+    "                      far as the locked memory limit allows.\n"
+    "\n"
+    "  -NUMA               Bind the threads to the NUMA nodes in turn, and\n"
+    "                      place the input buffers on the nodes in turn.\n"
+    "                      A program invocation is preferably run by a\n"
+    "                      thread on the node of its input buffer.\n"
+    "\n"
     "  -OUT=%s or          The output file name.  If not defined, the\n"
     "    -OUT_FILE=%s      output is written to standard output.\n"
     "                      The output file name can be followed by one or\n"
@@ -95,17 +177,46 @@ char Sump_usage[] =
     "                      2^30 respectively. It is not an error if the\n"
     "                      output of a program invocation exceeds the output\n"
     "                      buffer size, but it can potentially result in\n"
-    "                      loss of parallelism.\n"
+    "                      loss of parallelism unless the -OVERFLOW_POOL\n"
+    "                      is large enough.\n"
+    "\n"
+    "  -OVERFLOW_POOL=%d[k,m,g] The most bytes of overflow output segments\n"
+    "                      shared by the program invocations (0 by\n"
+    "                      default).  An invocation whose output buffer is\n"
+    "                      full and whose output is not yet being written\n"
+    "                      continues into a segment from the pool, and only\n"
+    "                      waits if the pool is exhausted.\n"
+    "\n"
+    "  -PREFAULT           Touch the pages of the initial output and input\n"
+    "                      buffers in parallel before starting.\n"
     "\n"
     "  -REC_SIZE=%d        Defines the input record size in bytes. If not\n"
     "                      specified, records must consist of ascii or\n"
     "                      utf-8 characters and be terminated by a newline\n"
     "                      character.\n"
     "\n"
+    "  -SAME_SIZE          Assert that each task's output is the size of\n"
+    "                      its input (-REC_SIZE only), so that ,WRITERS\n"
+    "                      write each output at its input's offset.\n"
+    "\n"
+    "  -SPECULATIVE or     Release each input buffer to a task without\n"
+    "    -SPEC             first finding the record boundaries in it.  Each\n"
+    "                      task finds its own first record, so that the\n"
+    "                      input is not scanned by a single thread.\n"
+    "\n"
+    "  -TASK_TIME=%d       The target time in milliseconds of each program\n"
+    "                      invocation for -IN_BUF_SIZE=AUTO (10).\n"
+    "\n"
     "  -THREADS=%d         Defines the maximum number of simultaneous\n"
     "                      invocations of the external program.  The\n"
-    "                      default maximum is the number of logical\n"
-    "                      processors in the system.\n"
+    "                      default maximum, -THREADS=AUTO, is the number of\n"
+    "                      -CPUS, or else the number of logical processors\n"
+    "                      the process can use, as limited by its affinity\n"
+    "                      mask and cgroup cpu.max quota.\n"
+    "\n"
+    "  -UNORDERED          Write the output of each program invocation as\n"
+    "                      soon as it completes rather than in input order.\n"
+    "                      The output of each invocation is still contiguous.\n"
     "\n"
     "  -WHOLE or           Overrides the default input record type of ascii\n"
     "    -WHOLE_BUF        or utf-8 records delimited by newline character.\n"
@@ -119,6 +230,10 @@ char Sump_usage[] =
     "                      access input and output files for which a\n"
     "                      BUFFERED file modifier is not specified.\n"
     "\n"
+    "  -DELIMITER=%s or    Use the specified delimiter rather than a newline\n"
+    "    -DELIM=%s         to end input records, e.g. -DELIM=\\r\\n.  The\n"
+    "                      escapes \\n, \\r, \\t, \\\\ and \\xHH may be used.\n"
+    "\n"
     "In addition to being used on the sump program command line, these\n"
     "directives may also be specified in a 'SUMP_PUMP' environment variable.\n"
     "\n"
@@ -0,0 +1,131 @@
+/* noop.c - SUMP Pump(TM) task dispatch performance test.
+ *          SUMP Pump is a trademark of Ordinal Technology Corp
+ *
+ * $Revision$
+ *
+ * Copyright (C) 2010, Ordinal Technology Corp, http://www.ordinal.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of Version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *
+ * Usage: noop [task_count] [sump pump directives]
+ *
+ *        This performance test measures the sump pump infrastructure
+ *        overhead of issuing and retiring tasks.  The pump function
+ *        does nothing, so all the elapsed time is spent passing tiny
+ *        whole input buffers to pump threads and draining their empty
+ *        outputs.  The test is run with 1, 2, 4, ... 128 pump threads
+ *        and the number of tasks per second is printed for each thread
+ *        count.  The default task count is 1000000.
+ */
+#include "sump.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#define NOOP_IN_BUF_SIZE        64
+#define NOOP_MAX_THREADS        128
+
+
+/* noop_pump - pump function that ignores its input and writes no output.
+ */
+int noop_pump(sp_task_t t, void *unused)
+{
+    return (SP_OK);
+}
+
+
+/* get_time_us - get the current time in microseconds.
+ */
+static double get_time_us()
+{
+#if defined(_WIN32)
+    return ((double)GetTickCount() * 1000.0);
+#else
+    struct timeval      tv;
+
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec);
+#endif
+}
+
+
+int main(int argc, char *argv[])
+{
+    sp_t                sp;
+    char                in_buf[NOOP_IN_BUF_SIZE];
+    long                task_count = 1000000;
+    long                i;
+    int                 threads;
+    int                 ret;
+    double              begin_time;
+    double              elapsed;
+    char                *directives;
+
+    if (argc > 1 && argv[1][0] != '-')
+    {
+        task_count = atol(argv[1]);
+        argv++;
+        argc--;
+    }
+    directives = sp_argv_to_str(argv + 1, argc - 1);
+    memset(in_buf, 'a', sizeof(in_buf));
+
+    printf("%d byte tasks, %ld tasks per run\n", NOOP_IN_BUF_SIZE, task_count);
+    printf("Threads    Elapsed    Tasks/sec\n");
+    for (threads = 1; threads <= NOOP_MAX_THREADS; threads *= 2)
+    {
+        begin_time = get_time_us();
+        ret = sp_start(&sp, noop_pump,
+                       "-WHOLE_BUF -THREADS=%d "
+                       "-IN_BUF_SIZE=%d -OUT_BUF_SIZE[0]=%d "
+                       "-OUT_FILE[0]=/dev/null,BUFFERED %s",
+                       threads, NOOP_IN_BUF_SIZE, NOOP_IN_BUF_SIZE,
+                       directives);
+        if (ret != SP_OK)
+        {
+            fprintf(stderr, "noop: sp_start failed: %s\n",
+                    sp_get_error_string(sp, ret));
+            return (1);
+        }
+        /* each full input buffer becomes a separate task */
+        for (i = 0; i < task_count; i++)
+        {
+            if (sp_write_input(sp, in_buf, sizeof(in_buf)) != sizeof(in_buf))
+            {
+                fprintf(stderr, "noop: sp_write_input: %s\n",
+                        sp_get_error_string(sp, sp_get_error(sp)));
+                return (1);
+            }
+        }
+        sp_write_input(sp, NULL, 0);   /* indicate input EOF */
+        if ((ret = sp_wait(sp)) != SP_OK)
+        {
+            fprintf(stderr, "noop: sp_wait: %s\n",
+                    sp_get_error_string(sp, ret));
+            return (1);
+        }
+        elapsed = (get_time_us() - begin_time) / 1000000.0;
+        printf("%7d %10.3f %12.0f\n",
+               threads, elapsed, (double)task_count / elapsed);
+        fflush(stdout);
+        sp_free(&sp);
+    }
+    return (0);
+}
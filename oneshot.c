@@ -22,6 +22,10 @@
  * Usage: oneshot
  */
 
+#if defined(__linux__)
+# define _GNU_SOURCE
+# include <sched.h>
+#endif
 #include "sump.h"
 #include <stdio.h>
 #include <string.h>
@@ -38,6 +42,68 @@ int error_pump(sp_task_t t, void *unused)
 }
 
 
+#if defined(__linux__)
+cpu_set_t       Process_cpus;   /* the cpus the process can use */
+
+/* copy_pump - pump function that copies its input records to its output
+ *             after checking that the thread running it is not bound to
+ *             fewer cpus than the process can use.
+ */
+int copy_pump(sp_task_t t, void *unused)
+{
+    cpu_set_t           cpus;
+    char                *rec;
+    size_t              len;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0 ||
+        !CPU_EQUAL(&cpus, &Process_cpus))
+    {
+        return (pfunc_error(t, "an executor worker is bound to the cpus "
+                            "of another sump pump\n"));
+    }
+    while ((len = pfunc_get_rec(t, &rec)) > 0)
+        pfunc_write(t, 0, rec, len);
+    return (SP_OK);
+}
+
+
+/* copy_through - write the input to a sump pump and read back its output.
+ *
+ * Returns: 0 if the output is the input, otherwise 1.
+ */
+int copy_through(sp_t sp, const char *input)
+{
+    char                buf[1000];
+    size_t              len = strlen(input);
+    ssize_t             ret;
+    size_t              size = 0;
+
+    if (sp_write_input(sp, (void *)input, len) != (ssize_t)len ||
+        sp_write_input(sp, NULL, 0) != 0)
+    {
+        fprintf(stderr, "sp_write_input: %s\n",
+                sp_get_error_string(sp, sp_get_error(sp)));
+        return (1);
+    }
+    while ((ret = sp_read_output(sp, 0, buf + size, sizeof(buf) - size)) > 0)
+        size += ret;
+    if (ret < 0 || sp_wait(sp) != SP_OK)
+    {
+        fprintf(stderr, "sump pump with the executor failed: %s\n",
+                sp_get_error_string(sp, sp_get_error(sp)));
+        return (1);
+    }
+    if (size != len || memcmp(buf, input, len) != 0)
+    {
+        fprintf(stderr, "sump pump with the executor output is not its "
+                "input\n");
+        return (1);
+    }
+    return (0);
+}
+#endif
+
+
 int main(int argc, char *argv[])
 {
     sp_t                sp;
@@ -88,6 +154,38 @@ int main(int argc, char *argv[])
         }
     }
     sp_free(&sp);
+
+#if defined(__linux__)
+    /* have two sump pumps share the executor, the first bound to a single
+     * cpu with -CPUS.  the executor workers must not inherit that binding
+     * and run the tasks of the second pump on just that cpu.
+     */
+    if (sched_getaffinity(0, sizeof(Process_cpus), &Process_cpus) == 0)
+    {
+        sp_t            sp2;
+        char            def2[100];
+        const char      *input = "one\ntwo\nthree\nfour\nfive\n";
+
+        for (i = 0; !CPU_ISSET(i, &Process_cpus); i++)
+            continue;
+        sprintf(def2, "-ASCII -THREADS=1 -EXECUTOR=2 -CPUS=%d", i);
+        if ((ret = sp_start(&sp2, copy_pump, def2)) != SP_OK)
+        {
+            fprintf(stderr, "sp_start: %s\n", sp_get_error_string(sp2, ret));
+            return (1);
+        }
+        ret = sp_start(&sp, copy_pump, "-ASCII -THREADS=2 -EXECUTOR");
+        if (ret != SP_OK)
+        {
+            fprintf(stderr, "sp_start: %s\n", sp_get_error_string(sp, ret));
+            return (1);
+        }
+        if (copy_through(sp, input) != 0 || copy_through(sp2, input) != 0)
+            return (1);
+        sp_free(&sp);
+        sp_free(&sp2);
+    }
+#endif
                    
     /* have pump function raise an error that causes a sp_read_output() call
      * to fail.
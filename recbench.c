@@ -0,0 +1,214 @@
+/* recbench.c - SUMP Pump(TM) per-record overhead performance test.
+ *              SUMP Pump is a trademark of Ordinal Technology Corp
+ *
+ * $Revision$
+ *
+ * Copyright (C) 2010, Ordinal Technology Corp, http://www.ordinal.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of Version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *
+ * Usage: recbench [record_count] [sump pump directives]
+ *
+ *        This performance test measures the per-record overhead of the
+ *        sump pump record access functions.  An in-memory input of short
+ *        comma-separated text records, like those read by lookup.c, is
+ *        written to a sump pump whose pump function accesses each record
+ *        with pfunc_get_rec(), pfunc_get_rec_view() or pfunc_get_recs().
+ *        Two pump functions are measured: "upper", which uppercases each
+ *        record as in upper.c, and "lookup", which compares the key field
+ *        of each record to a key value and writes the matching records
+ *        as in lookup.c.  The nanoseconds per record are printed for
+ *        each combination.  The default record count is 10000000.
+ */
+#include "sump.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#define RECBENCH_BATCH          64
+#define RECBENCH_REC_SIZE       18      /* e.g. "mango,987,654,321\n" */
+
+static const char *Keys[] = { "lemon", "mango", "apple", "berry" };
+
+enum access { GET_REC, GET_REC_VIEW, GET_RECS };
+static const char *Access_name[] =
+    { "pfunc_get_rec", "pfunc_get_rec_view", "pfunc_get_recs" };
+
+struct bench
+{
+    enum access access;
+    int         lookup;         /* lookup instead of uppercasing */
+};
+static struct bench     B;      /* the current benchmark */
+
+
+/* upper_rec - uppercase a record and write it to the output.
+ */
+static void upper_rec(sp_task_t t, const char *rec, size_t len)
+{
+    char        buf[RECBENCH_REC_SIZE * 4];
+    size_t      i;
+
+    if (len > sizeof(buf))
+        len = sizeof(buf);
+    for (i = 0; i < len; i++)
+        buf[i] = toupper(((unsigned char *)rec)[i]);
+    pfunc_write(t, 0, buf, len);
+}
+
+
+/* lookup_rec - write a record to the output if its key is "apple".
+ */
+static void lookup_rec(sp_task_t t, const char *rec, size_t len)
+{
+    if (len > 6 && rec[5] == ',' && memcmp(rec, "apple", 5) == 0)
+        pfunc_write(t, 0, (char *)rec, len);
+}
+
+
+/* bench_pump - pump function that applies the selected record function
+ *              using the selected record access function.
+ */
+int bench_pump(sp_task_t t, void *unused)
+{
+    struct bench        *b = &B;
+    void                (*rec_func)(sp_task_t, const char *, size_t);
+    char                *rec;
+    void                *recs[RECBENCH_BATCH];
+    size_t              lens[RECBENCH_BATCH];
+    size_t              len;
+    size_t              n;
+    size_t              i;
+
+    rec_func = b->lookup ? lookup_rec : upper_rec;
+    switch (b->access)
+    {
+      case GET_REC:
+        /* the record is copied and null-terminated */
+        while ((len = pfunc_get_rec(t, &rec)) > 0)
+            (*rec_func)(t, rec, len);
+        break;
+
+      case GET_REC_VIEW:
+        while ((len = pfunc_get_rec_view(t, &rec)) > 0)
+            (*rec_func)(t, rec, len);
+        break;
+
+      case GET_RECS:
+        while ((n = pfunc_get_recs(t, recs, lens, RECBENCH_BATCH)) > 0)
+        {
+            for (i = 0; i < n; i++)
+                (*rec_func)(t, (char *)recs[i], lens[i]);
+        }
+        break;
+    }
+    return (SP_OK);
+}
+
+
+/* get_time_us - get the current time in microseconds.
+ */
+static double get_time_us()
+{
+#if defined(_WIN32)
+    return ((double)GetTickCount() * 1000.0);
+#else
+    struct timeval      tv;
+
+    gettimeofday(&tv, NULL);
+    return ((double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec);
+#endif
+}
+
+
+int main(int argc, char *argv[])
+{
+    sp_t                sp;
+    char                *input;
+    char                *p;
+    long                rec_count = 10000000;
+    long                i;
+    size_t              input_size;
+    int                 ret;
+    double              begin_time;
+    double              elapsed;
+    char                *directives;
+
+    if (argc > 1 && argv[1][0] != '-')
+    {
+        rec_count = atol(argv[1]);
+        argv++;
+        argc--;
+    }
+    directives = sp_argv_to_str(argv + 1, argc - 1);
+
+    input_size = (size_t)rec_count * RECBENCH_REC_SIZE;
+    if ((input = (char *)malloc(input_size + 1)) == NULL)
+    {
+        fprintf(stderr, "recbench: can't allocate %ld records\n", rec_count);
+        return (1);
+    }
+    for (i = 0, p = input; i < rec_count; i++, p += RECBENCH_REC_SIZE)
+    {
+        sprintf(p, "%s,%03ld,%03ld,%03ld\n",
+                Keys[i % 4], i % 1000, (i / 1000) % 1000, (i / 7) % 1000);
+    }
+
+    printf("%ld records of %d bytes\n", rec_count, RECBENCH_REC_SIZE);
+    printf("Function  Access                  Elapsed   ns/record\n");
+    for (B.lookup = 0; B.lookup <= 1; B.lookup++)
+    {
+        for (B.access = GET_REC; B.access <= GET_RECS; B.access++)
+        {
+            begin_time = get_time_us();
+            ret = sp_start(&sp, bench_pump,
+                           "-UTF_8 -OUT_FILE[0]=/dev/null,BUFFERED %s",
+                           directives);
+            if (ret != SP_OK)
+            {
+                fprintf(stderr, "recbench: sp_start failed: %s\n",
+                        sp_get_error_string(sp, ret));
+                return (1);
+            }
+            if (sp_write_input(sp, input, input_size) != input_size)
+            {
+                fprintf(stderr, "recbench: sp_write_input: %s\n",
+                        sp_get_error_string(sp, sp_get_error(sp)));
+                return (1);
+            }
+            sp_write_input(sp, NULL, 0);   /* indicate input EOF */
+            if ((ret = sp_wait(sp)) != SP_OK)
+            {
+                fprintf(stderr, "recbench: sp_wait: %s\n",
+                        sp_get_error_string(sp, ret));
+                return (1);
+            }
+            elapsed = get_time_us() - begin_time;
+            printf("%-8s  %-20s %10.3f %11.1f\n",
+                   B.lookup ? "lookup" : "upper", Access_name[B.access],
+                   elapsed / 1000000.0, elapsed * 1000.0 / (double)rec_count);
+            fflush(stdout);
+            sp_free(&sp);
+        }
+    }
+    free(input);
+    return (0);
+}
@@ -78,6 +78,16 @@
 #               block at a time (in parallel), and writes the 
 #               compressed output to spgzipinput.gz
 #
+#   noop        Measures the sump pump task dispatch overhead with a
+#               pump function that does nothing.  Unlike the above
+#               tests, noop runs itself with 1, 2, 4, ... 128 threads
+#               and prints the tasks per second for each thread count.
+#
+#   recbench    Measures the per-record overhead of pfunc_get_rec(),
+#               pfunc_get_rec_view() and pfunc_get_recs() for pump
+#               functions like those of upper.c and lookup.c, using
+#               an in-memory input.  Prints nanoseconds per record.
+#
 import os
 import sys
 import time
@@ -173,3 +183,9 @@ run_program_set('wordcount.sh', '', 105311535 + 3101779)
 run_program_set('gensort 10000000 sortinput.txt', '', 0 + 1000000000)
 run_program_set('valsort sortoutput.txt', ' > /dev/null', 1000000000 + 0)
 run_program_set('spgzip', ' < spgzipinput > spgzipinput.gz', 274747890 + 139887849)
+print  # print empty line
+print 'testing: noop'
+os.system('noop')
+print  # print empty line
+print 'testing: recbench'
+os.system('recbench')
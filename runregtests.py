@@ -66,6 +66,7 @@ for i in range(iteration_count):
     threads = randint(1,20)
     rec_size = ''
     reduce_input_file = ''
+    testindex = 0
     if randint(0, 3) != 0:
         # perform a not-word-count test
         if randint(0, 1) == 0:
@@ -81,8 +82,13 @@ for i in range(iteration_count):
             if testindex == 1:
                 testprog = 'upper' 
                 correctoutput = 'upper_correct.txt'
-                if randint(0,1) == 0:
+                mode = randint(0,3)
+                if mode == 0:
                     testprog = testprog + ' onebyone'
+                elif mode == 1:
+                    testprog = testprog + ' view'
+                elif mode == 2:
+                    testprog = testprog + ' batch'
             elif testindex == 2:
                 testprog = 'upperfixed' 
                 correctoutput = 'upper_correct.txt'
@@ -99,6 +105,82 @@ for i in range(iteration_count):
               ' -IN_BUFS=' + str(inbufs) + \
               ' -TASKS=' + str(tasks) + \
               ' -THREADS=' + str(threads) 
+        # the output of newline-delimited records can be compared in
+        # sorted order when the task outputs are read unordered
+        if testindex != 2 and testindex != 3 and randint(0, 3) == 0:
+            cmd = cmd + ' -UNORDERED'
+        # let the tasks find their own input boundaries
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -SPECULATIVE'
+        # carry partial records to the next input buffer
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -ALIGN_IN_BUFS'
+        # adapt the input buffer fill size, down to a single byte
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -IN_BUF_SIZE=AUTO -TASK_TIME=' + str(randint(0, 1))
+        # let the task and input buffer rings grow and shrink
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -ELASTIC=' + str(randint(0, 500))
+        # let tasks continue writing into overflow output segments
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -OVERFLOW_POOL=' + str(randint(0, 500))
+        # give the tasks windows of the memory-mapped input file, read it
+        # with parallel range readers or through io_uring, or let its i/o
+        # parameters be tuned
+        if randint(0, 3) == 0:
+            r = randint(0, 3)
+            if r == 0:
+                mods = ',MMAP'
+            elif r == 1:
+                mods = ',READERS=' + str(randint(2, 4)) + ',CACHE=DROP'
+            elif r == 2 and cmd.find('-ALIGN_IN_BUFS') < 0 and \
+                 cmd.find('-IN_BUF_SIZE=AUTO') < 0:
+                # direct reads need page-multiple input buffers
+                mods = ',URING,COUNT=' + str(randint(1, 8))
+                cmd = cmd + ' -IN_BUF_SIZE=' + str(randint(1, 4) * 4096)
+            else:
+                mods = ',TRANSFER=AUTO,COUNT=AUTO'
+            if reduce_input_file == '':
+                cmd = cmd + ' -IN_FILE=rin1.txt' + mods
+            else:
+                cmd = cmd + reduce_input_file + mods
+        # write the output file with parallel positional writers, or
+        # through io_uring
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -OUT_FILE[0]=rout.txt,WRITERS=' + str(randint(2, 4))
+            if randint(0, 1) == 0:
+                cmd = cmd + ',CACHE=DROP'
+            if randint(0, 1) == 0:
+                cmd = cmd + ',SYNC=' + str(randint(1, 64)) + 'k'
+            # fixed-size upper records are written at their input offsets
+            if testindex == 2 and randint(0, 1) == 0:
+                cmd = cmd + ' -SAME_SIZE'
+        elif randint(0, 3) == 0:
+            cmd = cmd + ' -OUT_FILE[0]=rout.txt,URING'
+        # fit the buffers to a memory budget
+        if randint(0, 3) == 0:
+            need = tasks * outsize + inbufs * ((insize + 4095) / 4096 * 4096)
+            cmd = cmd + ' -MEMORY=' + \
+                  str(randint(need / 2, need * 2) + 3 * (outsize + 20000))
+        # back the buffers with huge or prefaulted pages
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -HUGE_PAGES'
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -PREFAULT'
+        # let the thread count follow the cpus the process can use
+        if randint(0, 7) == 0:
+            cmd = cmd + ' -THREADS=AUTO'
+        # place threads and input buffers on the NUMA nodes
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -NUMA'
+        # run the tasks on the process-wide executor's workers
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -EXECUTOR'
+            if randint(0, 1) == 0:
+                cmd = cmd + '=' + str(randint(1, 8))
+        # borrow buffers from the process-wide buffer pool
+        if randint(0, 3) == 0:
+            cmd = cmd + ' -BUF_POOL'
     else:
         cmd = './sump -in_buf_size=' + str(randint(100,10000)) + \
               ' ./map < hounds.txt | ' \
@@ -113,7 +195,12 @@ for i in range(iteration_count):
     if ret != 0:
         print 'error: ', cmd, ' returned: ', ret
         sys.exit()
-    ret = os.system('diff -b rout.txt ' + correctoutput)
+    if cmd.find('-UNORDERED') >= 0:
+        ret = os.system('sort rout.txt > rout_sorted.txt; ' +
+                        'sort ' + correctoutput + ' | ' +
+                        'diff -b rout_sorted.txt -')
+    else:
+        ret = os.system('diff -b rout.txt ' + correctoutput)
     if ret != 0:
         print 'error: cmp returned: ', ret
         sys.exit()
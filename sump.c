@@ -67,6 +67,25 @@
 #  include <sys/types.h>
 #  include <sys/stat.h>
 # endif
+# if defined(__linux__)
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <limits.h>
+#  include <sys/sysmacros.h>
+#  define SP_FUTEX
+#  define SP_NUMA
+#  if defined(__NR_io_uring_setup) && defined(AIO_CAPABLE)
+#   include <linux/io_uring.h>
+#   include <sys/uio.h>
+    /* ,URING registers its read buffers sparsely and then one at a time,
+     * which needs the buffer registration of newer kernel headers.  with
+     * older headers, ,URING files use the aio direct readers and writers.
+     */
+#   if defined(IORING_RSRC_REGISTER_SPARSE)
+#    define SP_URING
+#   endif
+#  endif
+# endif
 
 # define PTFlld	"lld"
 # define PTFllu	"llu"
@@ -96,6 +115,12 @@
 #include <string.h>
 #include <errno.h>
 
+/* SSE2 is always present on x86-64, AVX2 is selected at run time */
+#if defined(__GNUC__) && defined(__x86_64__)
+# define SP_SIMD_SCAN
+# include <immintrin.h>
+#endif
+
 #if defined(SUMP_PUMP_NO_SORT)
 /* define some nsort typedefs to minimize the number of #if's in this file */
 typedef unsigned nsort_t;       /* nsort context identifier */
@@ -129,6 +154,18 @@ typedef int nsort_msg_t;        /* return status & error message numbers */
 #define TRUE 1
 #define FALSE 0
 
+/* task spec_state values for -SPECULATIVE */
+#define SPEC_NONE       0       /* the writer found the task's first record */
+#define SPEC_PENDING    1       /* the task must find its first record */
+#define SPEC_RESOLVING  2       /* the task is finding its first record */
+#define SPEC_EMPTY      3       /* a task spanning the buffer found it empty */
+
+/* in_buf own_state values for -SPECULATIVE */
+#define OWN_WAITING     0       /* own task has not begun reading */
+#define OWN_STARTED     1       /* own task is reading the buffer */
+#define OWN_SKIPPED     2       /* the task that read past this entire
+                                 * buffer did so for the own task */
+
 /* sort_state values */
 #define SORT_INPUT      1
 #define SORT_OUTPUT     2
@@ -136,8 +173,89 @@ typedef int nsort_msg_t;        /* return status & error message numbers */
 
 #define ERROR_BUF_SIZE  500   /* size of error buffer */
 
+#define SP_MAX_DELIM_SIZE       8     /* max bytes in a text record delimiter */
+
 #define DEFAULT_BUFFERED_TRANSFER_SIZE  (1024 * 1024)
+#define DEFAULT_TASK_TIME_MS    10    /* -IN_BUF_SIZE=AUTO target task time */
+#define AUTO_FILL_RANGE         64    /* smallest -IN_BUF_SIZE=AUTO buffer fill
+                                       * is this fraction of the buffer size */
+#define STATS_BUF_SIZE          768   /* size of sp_get_stats() report */
+#define BUF_POOL_MIN_SHIFT      12    /* smallest -BUF_POOL size class, 4k */
+#define BUF_POOL_CLASSES        40    /* number of size classes */
+#define MIN_BUDGET_IN_BUF_SIZE  (1 << 14) /* smallest input buffer size that
+                                       * -MEMORY will choose */
+#define HUGE_PAGE_SIZE          (1 << 21) /* -HUGE_PAGES page size */
+#define SP_MAX_NUMA_NODES       64    /* most NUMA nodes used by -NUMA */
+#define SP_MAX_CPUS             1024  /* cpu numbers in -CPUS are less */
+#define SP_MPOL_PREFERRED       1     /* mbind() mode from <numaif.h> */
+#define NUMA_DEFER_SPINS        256   /* spins a thread leaves a task from
+                                       * another node to an idle thread on
+                                       * the task's node */
 #define DEFAULT_PIPE_TRANSFER_SIZE      8192
+#define WRITERS_PREALLOC_SIZE   (64 * 1024 * 1024) /* ,WRITERS=%d output files
+                                       * are preallocated this far ahead */
+#define CACHE_BEHIND_SIZE       (8 * 1024 * 1024) /* ,CACHE=DROP pages are
+                                       * dropped in ranges of this size */
+#define AUTO_TRANSFER_MAX       (8 * 1024 * 1024) /* max ,TRANSFER=AUTO size */
+#define AUTO_COUNT_MAX          16    /* max ,COUNT=AUTO requests */
+#define AUTO_COUNT_START        2     /* initial ,COUNT=AUTO requests */
+#define AUTO_COUNT_WINDOW       4     /* ,COUNT=AUTO rate is measured over
+                                       * this many completions per request
+                                       * outstanding */
+
+
+/* atomic operations for the counters that are shared without holding
+ * the sump_mtx.  All of them imply a full memory barrier.
+ */
+#if defined(win_nt)
+# define SP_ATOMIC_ADD64(p, v) \
+    InterlockedExchangeAdd64((LONGLONG volatile *)(p), (LONGLONG)(v))
+# define SP_ATOMIC_ADD32(p, v) \
+    InterlockedExchangeAdd((LONG volatile *)(p), (LONG)(v))
+# define SP_CAS64(p, old_val, new_val) \
+    (InterlockedCompareExchange64((LONGLONG volatile *)(p), \
+                                  (LONGLONG)(new_val), (LONGLONG)(old_val)) \
+     == (LONGLONG)(old_val))
+# define SP_MEMORY_BARRIER()    MemoryBarrier()
+# define SP_CPU_RELAX()         YieldProcessor()
+#else
+# define SP_ATOMIC_ADD64(p, v)  __sync_fetch_and_add((p), (v))
+# define SP_ATOMIC_ADD32(p, v)  __sync_fetch_and_add((p), (v))
+# define SP_CAS64(p, old_val, new_val) \
+    __sync_bool_compare_and_swap((p), (old_val), (new_val))
+# define SP_MEMORY_BARRIER()    __sync_synchronize()
+# if defined(__i386__) || defined(__x86_64__)
+#  define SP_CPU_RELAX()        __builtin_ia32_pause()
+# else
+#  define SP_CPU_RELAX()        SP_MEMORY_BARRIER()
+# endif
+#endif
+
+/* limits for the adaptive spinning of a waiter on a parking spot */
+#define PARK_SPIN_MIN   16
+#define PARK_SPIN_MAX   8192
+
+/* struct for a parking spot where threads wait for a state change that is
+ * made without holding the sump_mtx.  A waiter reads the sequence number
+ * with park_prepare(), rechecks its wake-up condition, then calls
+ * park_wait() which sleeps only if the sequence number is unchanged.
+ * A waker changes the state, then calls park_wake() to bump the sequence
+ * number.  On Linux the sleep is a futex wait on the sequence number.
+ * Before sleeping, a waiter briefly spins on the sequence number since
+ * many hand-offs between the sump pump threads and the output readers
+ * take well under the cost of a sleep and wakeup.
+ */
+typedef struct sp_park
+{
+    volatile int        seq;        /* bumped by every park_wake() */
+    volatile int        waiters;    /* threads sleeping or about to sleep */
+    int                 spin_limit; /* adaptive number of spin iterations
+                                     * before sleeping */
+#if !defined(SP_FUTEX)
+    pthread_mutex_t     mtx;
+    pthread_cond_t      cond;
+#endif
+} sp_park_t;
 
 
 /* state structure for a sump pump instance */
@@ -149,38 +267,109 @@ struct sump
                                         * is executed in parallel by the
                                         * sump pump */
     void                *pump_arg;     /* caller-defined arg to pump func */
-    unsigned            num_tasks;     /* number of pump tasks */
+    unsigned            num_tasks;     /* size of the task ring, the most
+                                        * pump tasks that can be in use */
     unsigned            num_threads;   /* number of threads executing the
                                         * pump func */
-    unsigned            num_in_bufs;   /* number of input buffers */
+    unsigned            num_in_bufs;   /* size of the input buffer ring,
+                                        * the most input buffers that can
+                                        * be in use */
+    unsigned            num_tasks_active;   /* number of tasks that can be
+                                             * in use now */
+    unsigned            num_in_bufs_active; /* number of input buffers
+                                             * that can be in use now */
+    unsigned            base_tasks;     /* -TASKS count, the fewest tasks
+                                         * that can be in use */
+    unsigned            base_in_bufs;   /* -IN_BUFS count, the fewest input
+                                         * buffers that can be in use */
+    char                elastic;        /* -ELASTIC: grow the task and input
+                                         * buffer rings when threads are
+                                         * idle because the oldest task has
+                                         * not been drained */
+    size_t              elastic_mem;    /* -ELASTIC memory ceiling */
+    size_t              overflow_pool;  /* -OVERFLOW_POOL: the most bytes of
+                                         * overflow output segments */
+    size_t              overflow_used;  /* bytes of allocated segments */
+    uint64_t            stat_overflow_segs; /* number of segments chained */
+    char                *buf_pool_name; /* -BUF_POOL name, or NULL if none */
+    struct buf_pool     *buf_pool;      /* shared pool of task output and
+                                         * input buffers, or NULL */
+    size_t              memory;         /* -MEMORY budget, or 0 if none */
+    char                huge_pages;     /* -HUGE_PAGES: back buffers with
+                                         * huge pages */
+    char                mlock_bufs;     /* -MLOCK: lock buffers in memory */
+    char                prefault;       /* -PREFAULT: the pump threads touch
+                                         * the pages of the initial buffers
+                                         * before sp_start() returns */
+    volatile int        prefault_next;  /* next buffer to be prefaulted */
+    volatile int        prefault_pending; /* threads still prefaulting */
+    sp_park_t           prefault_park;  /* prefaulting is done */
+    int                 *cpus;          /* -CPUS list of cpu numbers */
+    int                 num_cpus;       /* number of cpus in the list */
+    char                numa;           /* -NUMA */
+    int                 numa_nodes;     /* number of NUMA nodes that pump
+                                         * threads are bound to, or 0 */
+#if defined(SP_NUMA)
+    cpu_set_t           *numa_cpus;     /* cpus of each node that this
+                                         * process may run on */
+#endif
+    int                 *numa_ids;      /* system node id of each node */
+    volatile int        *numa_idle;     /* number of idle pump threads on
+                                         * each node */
+    unsigned            numa_next_node; /* node for the next input buffer
+                                         * memory allocation */
+    int                 *in_buf_pool_node; /* node of each in_buf_pool
+                                            * entry */
+    uint64_t            stat_numa_remote_tasks; /* tasks run on a node
+                                                 * other than that of their
+                                                 * input buffer */
+    uint64_t            stat_numa_remote_bytes; /* their input bytes */
     unsigned            num_outputs;   /* number of sump pump output channels*/
     ssize_t             in_buf_size;   /* input buffer size in bytes */
     struct sump_out     *out;          /* array of output structures, one for
                                         * each output */
     void                *delimiter;    /* record delimiter, for text input */
+    size_t              delim_size;    /* number of bytes in delimiter */
+    char                delim_buf[SP_MAX_DELIM_SIZE + 1]; /* -DELIMITER= */
     size_t              rec_size;      /* record size */
     pthread_mutex_t     sump_mtx;      /* mutex for sump pump infrastructure */
     pthread_mutex_t     sp_mtx;        /* mutex for pump funcs to use
                                         * via sp_mutex_lock() and
                                         * sp_mutex_unlock() calls */
-    pthread_cond_t      in_buf_readable_cond; /* input buffer available for
-                                               * reading by pump funcs */
-    pthread_cond_t      in_buf_done_cond;  /* an input buffer has been
+    sp_park_t           in_buf_done_park;  /* an input buffer has been
                                             * completely read by all potential
                                             * pump threads and can be reused */
-    pthread_cond_t      task_avail_cond;   /* a task is available for the
+    sp_park_t           task_avail_park;   /* a task is available for the
                                             * taking by a sump pump thread */
-    pthread_cond_t      task_drained_cond; /* a task has been completely 
+    sp_park_t           *task_avail;       /* task_avail_park, or the
+                                            * -EXECUTOR's work_park */
+    struct executor     *executor;     /* -EXECUTOR shared workers, or NULL */
+    unsigned            ex_workers;    /* -EXECUTOR=%d, or 0 */
+    sp_t                ex_next;       /* next pump using the executor */
+    unsigned            ex_running;    /* tasks run by executor workers */
+    unsigned            *ex_free_slots;    /* free thread indexes for them */
+    unsigned            num_ex_free_slots;
+    char                use_executor;  /* -EXECUTOR was specified */
+    char                ex_done;       /* no more tasks for the executor */
+    sp_park_t           ex_done_park;  /* an executor worker finished a task
+                                        * or found ex_done */
+    sp_park_t           task_drained_park; /* a task has been completely 
                                             * executed and its output has
                                             * been drained (read) for its
                                             * output buffer(s) */
-    pthread_cond_t      task_output_ready_cond; /* a task's output ready to
-                                                 * be read */
-    pthread_cond_t      task_output_empty_cond; /* a task's output buffer has
-                                                 * been read and is empty */
+    pthread_cond_t      task_output_ready_cond; /* sort state change, only
+                                                 * used for sorting. each
+                                                 * output has its own
+                                                 * parking spot for task
+                                                 * output ready to be read */
     size_t              in_buf_current_bytes; /* bytes in current input buf */
     /* number of bytes at end of prev input buffer containing a partial rec */
     size_t              prev_in_buf_ending_rec_partial_bytes;
+    /* the last bytes of the input, up to one less than the delimiter size,
+     * before the current input buffer.  used to find delimiters that span
+     * input buffers. */
+    char                prev_in_buf_tail[2 * SP_MAX_DELIM_SIZE];
+    size_t              prev_in_buf_tail_bytes;
     pthread_t           *thread;        /* array of sump pump threads */
     uint64_t            cnt_in_buf_readable; /* number of input buffers that
                                               * have been filled with input
@@ -190,20 +379,49 @@ struct sump
     uint64_t            cnt_in_buf_done; /* number of input buffers
                                           * that have been read by all
                                           * their readers */
-    uint64_t            cnt_task_init;  /* number of tasks initialized and
+    /* the following 3 task counters form the task ring and are updated
+     * without holding the sump_mtx.  cnt_task_init is only incremented
+     * by the thread calling sp_write_input(), cnt_task_begun is claimed
+     * with a compare-and-swap by sump pump threads, and cnt_task_drained
+     * is atomically incremented by output readers.
+     */
+    volatile uint64_t   cnt_task_init;  /* number of tasks initialized and
                                          * available for the taking by any
                                          * sump pump thread */
-    uint64_t            cnt_task_begun; /* number of tasks allocated/taken
+    volatile uint64_t   cnt_task_begun; /* number of tasks allocated/taken
                                          * and begun by sump pump threads */
-    uint64_t            cnt_task_drained; /* number of tasks that have
+    volatile uint64_t   cnt_task_drained; /* number of tasks that have
                                            * been completed and had all
                                            * their output buffer(s)
                                            * completely read/drained. */
-    uint64_t            cnt_task_done; /* number of done tasks whose
-                                        * actual ending position has been
-                                        * verified to be the same as their
-                                        * expected ending */
+    uint64_t            cnt_task_pumped;  /* number of tasks whose pump
+                                           * funcs have returned, updated
+                                           * with the sump_mtx locked */
     struct sp_task      *task;          /* array of sump pump tasks */
+    unsigned            *task_order;    /* task array index of each task,
+                                         * indexed by task number modulo
+                                         * num_tasks */
+    unsigned            *free_task;     /* stack of the array indexes of
+                                         * the task structs not in use.  a
+                                         * drained task's array index is
+                                         * pushed here, to be used by the
+                                         * next task that is initialized */
+    unsigned            num_free_tasks; /* number of indexes in free_task */
+    unsigned            next_task;      /* task array index taken from
+                                         * free_task for the next task */
+    unsigned            num_task_bufs;  /* number of task structs with
+                                         * output buffers allocated */
+    char                **in_buf_pool;  /* stack of allocated input buffer
+                                         * memory not in use by an input
+                                         * buffer of the ring */
+    unsigned            num_pool_bufs;  /* number of buffers in in_buf_pool */
+    unsigned            num_pool_bufs_idle; /* number of buffers at the
+                                             * bottom of in_buf_pool whose
+                                             * pages have been released */
+    unsigned            num_in_buf_mems;/* number of input buffer memory
+                                         * allocations, in use or pooled */
+    size_t              in_buf_alloc_size; /* allocation size of each input
+                                            * buffer memory */
     struct in_buf       *in_buf;        /* array of sump pump input buffers */
     nsort_t             nsort_ctx;      /* used only if this is a sort */
     char                *error_buf;     /* buf to hold error msg */
@@ -213,7 +431,7 @@ struct sump
     char                *sort_temp_buf; /* sort temporary buf */
     size_t              sort_temp_buf_size; /* size of sort temporary buf */
     size_t              sort_temp_buf_bytes; /* bytes of data in temp buf */
-    char                input_eof;      /* sp_write_input() called with
+    volatile char       input_eof;      /* sp_write_input() called with
                                          * size <= 0 */
     char                broken_input;   /* sp_write_input() called with
                                          * a negative size */
@@ -221,6 +439,37 @@ struct sump
     char                match_keys;     /* only used for sorting - indicates
                                          * -match has been specified */
     char                wait_done;      /* sp_wait already called for this sp*/
+    char                unordered;      /* -UNORDERED for all outputs */
+    char                speculative;    /* -SPECULATIVE: tasks find their
+                                         * own input boundaries */
+    char                align_in_bufs;  /* -ALIGN_IN_BUFS: input buffers
+                                         * end on record boundaries */
+    char                same_size;      /* -SAME_SIZE: each task's output
+                                         * is the size of its input */
+    int64_t             in_stream_bytes; /* input bytes flushed so far */
+    char                *carry_src;     /* partial record at the end of the
+                                         * last flushed input buffer to be
+                                         * moved to the next input buffer */
+    size_t              carry_bytes;    /* size of the carry_src record */
+    size_t              carry_put;      /* carry bytes at the beginning of
+                                         * the buffer from sp_get_in_buf() */
+    uint64_t            carry_put_index; /* buffer index carry_put was
+                                          * taken for, if carry_put_taken */
+    char                carry_put_taken; /* sp_get_in_buf() has taken the
+                                          * carry for carry_put_index */
+    char                auto_in_buf_size; /* -IN_BUF_SIZE=AUTO */
+    volatile size_t     in_buf_fill;    /* number of bytes to fill in each
+                                         * input buffer, at most in_buf_size.
+                                         * adjusted by pump threads for
+                                         * -IN_BUF_SIZE=AUTO */
+    uint64_t            task_time_us;   /* -TASK_TIME target task duration */
+    double              us_per_byte;    /* smoothed pump cost per input byte */
+    uint64_t            stat_tasks;     /* the following statistics are */
+    uint64_t            stat_in_bytes;  /* updated by pump threads with */
+    uint64_t            stat_busy_us;   /* the sump_mtx locked */
+    uint64_t            stat_wait_us;
+    uint64_t            stat_idle_us;
+    char                *stats_buf;     /* sp_get_stats() report */
     char                in_file_alloc;  /* in_file string was malloc()'d and
                                          * should be free()'d */
     char                *in_file;       /* input file str or NULL if none */
@@ -231,6 +480,48 @@ struct sump
     char                **exec_argv;    /* exec process command line */
 };
 
+/* struct for an overflow output segment, a full task output buffer that
+ * waits to be read while the task continues writing into another buffer
+ */
+struct out_seg
+{
+    struct out_seg      *next;  /* next segment in chain or free list */
+    char                *buf;   /* segment bytes, the size of the output's
+                                 * task output buffers */
+    size_t              bytes;  /* number of bytes in buf */
+};
+
+/* struct for a process-wide pool of buffers shared by the sump pumps
+ * that name it with -BUF_POOL.  the free buffers of each power of 2 size
+ * class are linked through their first bytes.
+ */
+struct buf_pool
+{
+    struct buf_pool     *next;          /* next pool in Buf_pools */
+    char                *name;          /* pool name */
+    int                 users;          /* number of sump pumps using it */
+    char                *free_bufs[BUF_POOL_CLASSES];
+};
+
+/* struct for the process-wide executor whose worker threads run the tasks
+ * of the sump pumps started with -EXECUTOR, in place of threads of their
+ * own.  ex->mtx protects the pump list and the counts.
+ */
+struct executor
+{
+    pthread_mutex_t     mtx;
+    sp_park_t           work_park;      /* a task may be available */
+    pthread_t           *workers;       /* worker threads */
+    unsigned            num_workers;
+    unsigned            max_workers;    /* size of workers array */
+    unsigned            num_running;    /* tasks being run by the workers */
+    unsigned            num_idle_pumps; /* pumps that are not done and are
+                                         * not running a task */
+    sp_t                pumps;          /* pumps linked through ex_next */
+    int                 users;          /* number of sump pumps using it */
+    char                shutdown;       /* workers should exit */
+};
+
 /* struct for an output of a task */
 struct task_out
 {
@@ -242,9 +533,23 @@ struct task_out
     char        stalled;  /* the map thread handling this task is
                            * stalled waiting for the writer thread to
                            * empty its full buf */
+    struct out_seg *seg_head; /* chain of full output buffers written */
+    struct out_seg *seg_tail; /* before buf, in order, or NULL if none */
+    char        queued;   /* the output is ready to be read by an
+                           * unordered output reader */
+    char        taken;    /* an unordered output reader has started
+                           * reading this output */
+    uint64_t    ready_seq; /* for an unordered output, the order in which
+                            * this output became ready */
+    int64_t     file_offset; /* for -SAME_SIZE, the output file offset of
+                              * the next bytes of this output */
 };
 
 
+/* macro to get the task with the specified task number */
+#define TASK_BY_NUMBER(sp, n) \
+    (&(sp)->task[(sp)->task_order[(n) % (sp)->num_tasks]])
+
 #define INVALID_FD      (-1)
 #define PIPE_BUF_SIZE   4096
 
@@ -297,12 +602,21 @@ struct sp_task
     struct sump *sp;            /* the "host" sp_t of this task */
     uint64_t    task_number;    /* task number */
     int         thread_index;   /* id of thread performing this task */
+    int         node;           /* -NUMA node index of the input buffer
+                                 * the task begins in, or -1 */
     char        *in_buf;        /* input buffer */
     size_t      in_buf_bytes;   /* number of bytes written into in_buf
                                  * by the reader thread.  these bytes
                                  * will be read out by map task */
     char        *rec_buf;       /* buf to hold rec returned by pf_get_rec() */
     size_t      rec_buf_size;   /* size of rec_buf */
+    size_t      *rec_index;     /* offsets in in_buf of the ends of the
+                                 * whole text records in the task's first
+                                 * input buffer, for pfunc_get_recs() */
+    size_t      rec_index_size; /* capacity of rec_index */
+    size_t      rec_index_count;/* number of offsets in rec_index, or
+                                 * (size_t)-1 if not yet built */
+    size_t      rec_index_pos;  /* next rec_index entry to be returned */
     char        *curr_rec;      /* pointer to the current record */
     char        *temp_buf;       /* temp buf to help with printf */
     size_t      temp_buf_size;   /* size of the temp buf */
@@ -313,15 +627,31 @@ struct sp_task
     uint64_t    curr_in_buf_index; /* current input buffer index */
     char        *begin_rec;      /* pointer to the beginning record */
     uint64_t    begin_in_buf_index;/* beginning input buffer index */
+    char        *read_begin;     /* where the task began reading its
+                                  * current input buffer */
+    uint64_t    in_bytes_read;   /* input bytes the task has finished
+                                  * reading */
+    int64_t     in_offset;       /* offset of the task's first record in
+                                  * the input stream */
     /* the following 2 members are set by the thread calling sp_write_input()
      */
     uint64_t    expected_end_index; /* expected end in buf index */
     int         expected_end_offset; /* expected end in buf offset */
+    char        spec_state;     /* SPEC_* state for -SPECULATIVE */
+    char        has_bufs;       /* output buffers are allocated */
+    char        bufs_idle;      /* the pages of the output buffers have
+                                 * been released by release_idle_mem() */
+    uint64_t    begin_us;       /* time the task was begun by a thread */
+    uint64_t    wait_us;        /* time the task spent waiting for input
+                                 * buffers or output buffer space */
     
     char        first_group_rec; /* next record read will be the first
                                   * record for its record group */
     char        first_in_buf;     /* this task is still reading its
                                    * first input buffer */
+    char        verify_end;      /* the actual ending position of this
+                                  * task has not yet been verified to be
+                                  * its expected ending */
     char        input_eof;       /* boolean: this task is done reading
                                   * its input */
     char        output_eof;      /* boolean: thread performing task is
@@ -332,6 +662,8 @@ struct sp_task
     int         outs_drained;   /* number of outputs for this task that
                                  * have been completely drained (read) */
     struct task_out *out;       /* array of task outputs */
+    sp_park_t   out_empty_park; /* the stalled output buffer of this task
+                                 * has been read and is empty */
 };
 
 /* struct for a sump pump input buffer */
@@ -342,11 +674,30 @@ typedef struct in_buf
                                  * by the reader thread.  these bytes
                                  * will be read out by map task */
     size_t      in_buf_size;    /* size of the in_buf */
-    size_t      alloc_size;     /* allocation size of the in_buf */
+    int64_t     stream_offset;  /* input stream offset of in_buf */
     unsigned    num_readers;    /* number of threads performing
                                  * tasks that read this buf */
     unsigned    num_readers_done;/* number of reader threads that are
                                   * done with this buffer */
+    sp_park_t   readable_park;  /* this input buffer is available for
+                                 * reading by pump funcs */
+    /* for -SPECULATIVE, where each task finds its own input boundaries */
+    char        speculated;     /* this buffer's task finds its first rec */
+    char        straddled;      /* the previous task reads the beginning */
+    char        starts_partial; /* begins with the rest of a record */
+    char        spec_verify;    /* verify the previous task's end */
+    size_t      spec_start;     /* offset of the first task record */
+    size_t      spec_end;       /* offset where the previous task ended */
+    char        prev_tail[2 * SP_MAX_DELIM_SIZE]; /* prev_in_buf_tail */
+    size_t      prev_tail_bytes;
+    struct sp_task *own_task;   /* task that begins in this buffer */
+    char        own_state;      /* OWN_* state of own_task */
+    /* for sp_write_input_ref(), where in_buf is the caller's buffer */
+    char        is_ref;         /* in_buf is owned by the caller */
+    sp_release_t ref_release;   /* caller function to be called once all
+                                 * readers are done, NULL once called */
+    void        *ref_arg;       /* caller arg for ref_release */
+    int         node;           /* -NUMA node index of in_buf, or -1 */
 } in_buf_t;
 
 /* struct for a link (copy thread) between an output of one sump pump and
@@ -382,13 +733,36 @@ struct sp_file
     size_t      transfer_size;  /* read or write request size */
     int         error_code;     /* error code */
     int         can_seek;       /* if true, then direct/async-capable file */
+    int         uring;          /* ,URING: direct i/o through io_uring */
+    int         num_readers;    /* ,READERS=%d: reader threads */
+    int         num_writers;    /* ,WRITERS=%d: writer threads */
+    int         cache;          /* ,CACHE= page cache policy */
+    int64_t     cache_done;     /* ,CACHE=DROP: bytes dropped from cache */
+    int64_t     cache_flushing; /* ,CACHE=DROP: end of the bytes whose
+                                 * write-back has been started */
+    char        auto_transfer;  /* ,TRANSFER=AUTO */
+    char        auto_count;     /* ,COUNT=AUTO */
+    char        sync;           /* ,SYNC: flush writes to stable storage */
+    size_t      sync_size;      /* ,SYNC=%d: bytes written between flushes,
+                                 * or 0 to flush only after the last */
+    size_t      sync_pending;   /* bytes written since the last flush */
     int         is_std;         /* file is either stdin, stdout or stderr */
+    char        *map;           /* ,MMAP: mapping of the input file */
+    size_t      map_size;       /* size of the mapping */
+    int         map_refs;       /* references to the mapping by the reader
+                                 * and unreleased input buffers */
 };
 
 /* file access modes */
 #define MODE_UNSPECIFIED    0   /* no access mode has been specified */
 #define MODE_BUFFERED       1   /* use standard read() or write() calls */
 #define MODE_DIRECT         2   /* direct and asynchronous r/w requests */
+#define MODE_MMAP           3   /* input buffers are windows of a mapping */
+
+/* page cache policies */
+#define CACHE_KEEP          0   /* no page cache advice */
+#define CACHE_SEQUENTIAL    1   /* advise sequential access */
+#define CACHE_DROP          2   /* also drop pages once read or written */
 
 
 /* struct for a sump pump output */
@@ -406,11 +780,28 @@ struct sump_out
                                          * should be free()'d */
     char                *file;         /* output file str or NULL if none */
     struct sp_file      *file_sp;      /* output file for this sump pump out */
+    char                page_align;    /* page-align the output buffers so a
+                                        * direct file writer can write them
+                                        * in place */
     uint64_t            cnt_task_drained; /* number of tasks that have
                                            * been completed and their
                                            * output buffer for this
                                            * particular output has been
                                            * completely read */
+    sp_park_t           ready_park;    /* a task's output for this output
+                                        * is ready to be read */
+    struct sp_task      *curr_task;    /* task whose output is being read,
+                                        * or NULL if not yet known */
+    char                unordered;     /* read the task outputs in the
+                                        * order they become ready rather
+                                        * than in task order */
+    uint64_t            cnt_ready;     /* for an unordered output, the
+                                        * number of task outputs that have
+                                        * become ready */
+    struct out_seg      *curr_seg;     /* overflow segment of curr_task
+                                        * being read, or NULL if reading
+                                        * the task output buffer */
+    struct out_seg      *free_segs;    /* free overflow segments */
 };
 
 
@@ -427,6 +818,42 @@ struct sump_aio
 };
 #endif
 
+#if defined(SP_URING)
+/* struct for an io_uring instance of a ,URING file reader or writer
+ * thread, driven with the raw system calls.
+ */
+struct sp_uring
+{
+    int                 fd;             /* io_uring file descriptor */
+    void                *sq_ring;       /* submission queue ring mapping */
+    size_t              sq_ring_size;
+    void                *cq_ring;       /* completion queue ring mapping */
+    size_t              cq_ring_size;
+    struct io_uring_sqe *sqes;          /* submission queue entries */
+    size_t              sqes_size;
+    volatile unsigned   *sq_tail;
+    unsigned            sq_mask;
+    unsigned            *sq_array;
+    volatile unsigned   *cq_head;
+    volatile unsigned   *cq_tail;
+    unsigned            cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned            to_submit;      /* entries queued but not submitted */
+};
+
+/* struct for a request of a ,URING file reader or writer */
+struct sump_uring_io
+{
+    uint64_t            buf_index;      /* sump pump buffer index */
+    size_t              buf_offset;     /* beginning io offset within buffer */
+    char                last_buf_io;    /* boolean indicating last io for buf*/
+    char                done;           /* the request has completed */
+    int64_t             file_offset;    /* file offset */
+    size_t              nbytes;         /* request size */
+    ssize_t             result;         /* bytes transferred, or -errno */
+};
+#endif
+
 
 /* global sump pump mutex */
 static pthread_mutex_t  Global_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -437,6 +864,19 @@ static int              Global_external_count;
 /* file descriptor for /dev/zero */
 static int Zero_fd;
 
+/* the -BUF_POOL buffer pools, protected by Global_lock */
+static struct buf_pool  *Buf_pools;
+
+/* the -EXECUTOR shared executor, or NULL.  protected by Global_lock */
+static struct executor  *Executor;
+
+#if defined(SP_NUMA)
+/* the NUMA nodes that have cpus, found by get_numa_topology() */
+static int              Numa_nodes = -1;
+static int              Numa_node_id[SP_MAX_NUMA_NODES];
+static cpu_set_t        Numa_node_cpus[SP_MAX_NUMA_NODES];
+#endif
+
 /* default size for sp_write_input() and sp_read_output() transfers for
  * regression testing of those interfaces.
  */
@@ -445,6 +885,16 @@ static size_t Default_rw_test_size;
 /* default file access mode */
 static int Default_file_mode = MODE_DIRECT;
 
+/* boolean: spin before sleeping on a parking spot.  only worthwhile if
+ * there is more than one processor.
+ */
+static int Park_spin;
+
+/* function to search backwards in a buffer for a character, selected
+ * according to the processor's vector instruction support.
+ */
+static char *(*Scan_back)(char *buf, size_t size, int c);
+
 
 /* die - quit program due to a fatal sump pump infrastructure error.
  */
@@ -460,6 +910,132 @@ static void die(char *fmt, ...)
 }
 
 
+/* park_init - internal routine to initialize a parking spot.
+ */
+static void park_init(sp_park_t *p)
+{
+    p->seq = 0;
+    p->waiters = 0;
+    p->spin_limit = PARK_SPIN_MIN;
+#if !defined(SP_FUTEX)
+    pthread_mutex_init(&p->mtx, NULL);
+    pthread_cond_init(&p->cond, NULL);
+#endif
+}
+
+
+/* park_destroy - internal routine to free the resources of a parking spot.
+ */
+static void park_destroy(sp_park_t *p)
+{
+#if !defined(SP_FUTEX)
+    pthread_mutex_destroy(&p->mtx);
+    pthread_cond_destroy(&p->cond);
+#endif
+}
+
+
+/* park_prepare - internal routine to get the sequence number of a parking
+ *                spot before checking the condition to be waited for.
+ *
+ * Returns: the sequence number to be passed to park_wait()
+ */
+static int park_prepare(sp_park_t *p)
+{
+    int         seq;
+
+    seq = p->seq;
+    SP_MEMORY_BARRIER();
+    return (seq);
+}
+
+
+/* park_wait - internal routine to sleep until the parking spot has been
+ *             woken since park_prepare() returned seq.  May return
+ *             spuriously, so the caller should recheck its condition.
+ */
+static void park_wait(sp_park_t *p, int seq)
+{
+    int         i;
+    int         limit;
+
+    if (Park_spin)
+    {
+        /* spin for a while.  double the spin limit if the wakeup came
+         * while spinning, otherwise halve it.  the spin limit is only a
+         * hint, so racing updates of it are harmless.
+         */
+        limit = p->spin_limit;
+        for (i = 0; i < limit; i++)
+        {
+            if (p->seq != seq)
+            {
+                if (limit < PARK_SPIN_MAX)
+                    p->spin_limit = limit * 2;
+                return;
+            }
+            SP_CPU_RELAX();
+        }
+        if (limit > PARK_SPIN_MIN)
+            p->spin_limit = limit / 2;
+    }
+    SP_ATOMIC_ADD32(&p->waiters, 1);
+#if defined(SP_FUTEX)
+    if (p->seq == seq)
+        syscall(SYS_futex, &p->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&p->mtx);
+    while (p->seq == seq)
+        pthread_cond_wait(&p->cond, &p->mtx);
+    pthread_mutex_unlock(&p->mtx);
+#endif
+    SP_ATOMIC_ADD32(&p->waiters, -1);
+}
+
+
+/* park_cond_wait - internal routine that is the parking spot equivalent
+ *                  of pthread_cond_wait().  The caller must have locked
+ *                  mtx, and the state being waited for must only be
+ *                  changed while mtx is locked, with park_wake() called
+ *                  after the change.
+ */
+static void park_cond_wait(sp_park_t *p, pthread_mutex_t *mtx)
+{
+    int         seq;
+
+    seq = park_prepare(p);
+    pthread_mutex_unlock(mtx);
+    park_wait(p, seq);
+    pthread_mutex_lock(mtx);
+}
+
+
+/* park_wake - internal routine to wake either one or all of the threads
+ *             waiting on a parking spot.  The caller should have already
+ *             made the state change the waiters are waiting for.
+ */
+static void park_wake(sp_park_t *p, int all)
+{
+#if defined(SP_FUTEX)
+    SP_ATOMIC_ADD32(&p->seq, 1);
+    if (p->waiters != 0)
+        syscall(SYS_futex, &p->seq, FUTEX_WAKE_PRIVATE,
+                all ? INT_MAX : 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&p->mtx);
+    p->seq++;
+    if (p->waiters != 0)
+    {
+        if (all)
+            pthread_cond_broadcast(&p->cond);
+        else
+            pthread_cond_signal(&p->cond);
+    }
+    pthread_mutex_unlock(&p->mtx);
+#endif
+}
+
+
 #define PAGE_SIZE       page_size()
 
 /* page_size - internal routine to get the system page size.
@@ -621,17 +1197,39 @@ static int start_error(sp_t sp, const char *fmt, ...)
 }
 
 
+/* wake_output_readers - internal routine to wake the reader of each
+ *                       sump pump output.
+ */
+static void wake_output_readers(sp_t sp)
+{
+    unsigned    i;
+
+    for (i = 0; i < sp->num_outputs; i++)
+        park_wake(&sp->out[i].ready_park, TRUE);
+}
+
+
 /* broadcast_all_conds - internal routine to broadcast all sump pump conditions
  *                       The sump_mtx should already be locked.
  */
 static void broadcast_all_conds(sp_t sp)
 {
-    pthread_cond_broadcast(&sp->in_buf_readable_cond); /*multiple sp threads*/
-    pthread_cond_broadcast(&sp->in_buf_done_cond);/* sp_write_input() caller */
-    pthread_cond_broadcast(&sp->task_avail_cond);   /* multiple sp threads */
-    pthread_cond_broadcast(&sp->task_drained_cond);/* sp_write_input() caller*/
-    pthread_cond_broadcast(&sp->task_output_ready_cond); /* mult sp threads */
-    pthread_cond_broadcast(&sp->task_output_empty_cond); /* mult sp threads */
+    unsigned    i;
+
+    pthread_cond_broadcast(&sp->task_output_ready_cond); /* sort state */
+    /* the parking spots only exist once the sump pump threads have been
+     * created (never for sorts).
+     */
+    if (sp->thread == NULL)
+        return;
+    park_wake(&sp->in_buf_done_park, TRUE);       /* sp_write_input() caller*/
+    park_wake(sp->task_avail, TRUE);        /* multiple sp threads */
+    park_wake(&sp->task_drained_park, TRUE);      /* sp_write_input() caller*/
+    for (i = 0; i < sp->num_in_bufs; i++)         /* multiple sp threads */
+        park_wake(&sp->in_buf[i].readable_park, TRUE);
+    for (i = 0; i < sp->num_tasks; i++)           /* stalled sp threads */
+        park_wake(&sp->task[i].out_empty_park, TRUE);
+    wake_output_readers(sp);
 }
 
 
@@ -701,6 +1299,164 @@ static void init_zero_fd()
 #endif
 
 
+#if defined(__linux__)
+
+/* get_cgroup_cpu_limit - internal routine to get the number of cpus allowed
+ *                        by the cgroup v2 cpu.max quotas of the cgroup of
+ *                        the process and its ancestors, rounded up.
+ *
+ * Returns: the number of cpus, or 0 if there is no quota.
+ */
+static int get_cgroup_cpu_limit()
+{
+    FILE        *fp;
+    char        line[512];
+    char        path[600];
+    char        *p;
+    double      quota;
+    double      period;
+    int         limit = 0;
+    int         n;
+
+    if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+        return (0);
+    /* the cgroup v2 line is "0::<path>" */
+    p = NULL;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            p = line + 3;
+            p[strcspn(p, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose(fp);
+    if (p == NULL)
+        return (0);
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s", strcmp(p, "/") ? p : "");
+    for (;;)
+    {
+        n = (int)strlen(path);
+        snprintf(path + n, sizeof(path) - n, "/cpu.max");
+        if ((fp = fopen(path, "r")) != NULL)
+        {
+            if (fscanf(fp, "%lf %lf", &quota, &period) == 2 && period > 0)
+            {
+                int     cpus = (int)((quota + period - 1) / period);
+
+                if (cpus < 1)
+                    cpus = 1;
+                if (limit == 0 || cpus < limit)
+                    limit = cpus;
+            }
+            fclose(fp);
+        }
+        path[n] = '\0';
+        /* go up to the parent cgroup, stopping at the cgroup root */
+        if ((p = strrchr(path, '/')) == NULL ||
+            p - path < (int)strlen("/sys/fs/cgroup"))
+        {
+            break;
+        }
+        *p = '\0';
+    }
+    return (limit);
+}
+
+#endif
+
+
+/* get_logical_processor_count - internal routine to get the number of
+ *                               logical processors the process can use:
+ *                               the online processors, limited by the
+ *                               process affinity mask and, on Linux, the
+ *                               cgroup v2 cpu.max quota.
+ */
+static int get_logical_processor_count()
+{
+#if defined(win_nt)
+    {
+        SYSTEM_INFO si;
+        DWORD_PTR   proc_mask;
+        DWORD_PTR   sys_mask;
+        int         count = 0;
+
+        GetSystemInfo(&si);
+        if (!GetProcessAffinityMask(GetCurrentProcess(),
+                                    &proc_mask, &sys_mask))
+        {
+            return si.dwNumberOfProcessors;
+        }
+        for (; proc_mask != 0; proc_mask &= proc_mask - 1)
+            count++;
+        return (count);
+    }
+#else
+    int         count = sysconf(_SC_NPROCESSORS_ONLN);
+# if defined(__linux__)
+    cpu_set_t   allowed;
+    int         limit;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 &&
+        CPU_COUNT(&allowed) != 0 && CPU_COUNT(&allowed) < count)
+    {
+        count = CPU_COUNT(&allowed);
+    }
+    if ((limit = get_cgroup_cpu_limit()) != 0 && limit < count)
+        count = limit;
+# endif
+    return (count);
+#endif
+}
+
+
+/* create_thread - internal routine to create a thread for a sump pump.
+ *                 With -CPUS, pump thread i (pump_index i) is bound to
+ *                 the cpus of the list in turn, and the sump pump's other
+ *                 threads (pump_index -1) are bound to all of its cpus.
+ *                 Otherwise with -NUMA, pump thread i is bound to the
+ *                 nodes in turn.
+ *
+ * Returns: the pthread_create() return value
+ */
+static int create_thread(sp_t sp, pthread_t *thread,
+                         void *(*func)(void *), void *arg, int pump_index)
+{
+#if defined(__linux__)
+    pthread_attr_t      attr;
+    cpu_set_t           set;
+    const cpu_set_t     *bind = NULL;
+    int                 ret;
+    int                 k;
+
+    if (sp->num_cpus != 0)
+    {
+        CPU_ZERO(&set);
+        if (pump_index >= 0)
+            CPU_SET(sp->cpus[pump_index % sp->num_cpus], &set);
+        else
+            for (k = 0; k < sp->num_cpus; k++)
+                CPU_SET(sp->cpus[k], &set);
+        bind = &set;
+    }
+# if defined(SP_NUMA)
+    else if (sp->numa_nodes != 0 && pump_index >= 0)
+        bind = &sp->numa_cpus[pump_index % sp->numa_nodes];
+# endif
+    if (bind != NULL)
+    {
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), bind);
+        ret = pthread_create(thread, &attr, func, arg);
+        pthread_attr_destroy(&attr);
+        return (ret);
+    }
+#endif
+    return (pthread_create(thread, NULL, func, arg));
+}
+
+
 #if !defined(SUMP_PUMP_NO_SORT)
 
 /* function pointers to nsort library entry points.  These are 
@@ -848,9 +1604,6 @@ int sp_start_sort(sp_t *caller_sp,
     char                *def;
     char                thread_drctv[30];
     unsigned char       *p;
-# if defined(win_nt)
-    SYSTEM_INFO         si;
-# endif
 
     *caller_sp = NULL;  /* assume the worst for now */
     sp = (sp_t)calloc(1, sizeof(struct sump));
@@ -862,18 +1615,14 @@ int sp_start_sort(sp_t *caller_sp,
         return (SP_MEM_ALLOC_ERROR);
     *caller_sp = sp;  /* allow access to error_buf even if failure */
     /* fill in default parameters */
-# if defined(win_nt)
-    GetSystemInfo(&si);
-    sp->num_threads = si.dwNumberOfProcessors;
-# else
-    sp->num_threads = sysconf(_SC_NPROCESSORS_ONLN);
-# endif
+    sp->num_threads = get_logical_processor_count();
     sprintf(thread_drctv, "-threads=%d ", sp->num_threads);
     if (sp->num_outputs > 32)
         sp->num_outputs = 32;
     sp->num_outputs = 1;
     sp->out = (struct sump_out *)calloc(1, sizeof(struct sump_out));
     sp->delimiter = (void *)"\n";
+    sp->delim_size = 1;
     sp->rec_size = 0;
 
     if (link_in_nsort() != 0)    /* if error */
@@ -1211,6 +1960,7 @@ int pfunc_exec(sp_task_t t, void *unused)
     pthread_t           err_thread;
 #endif
     int                 buf_bytes;
+    int                 len;
     pid_t               child;
     int                 status;
     char	        errmsg[100];
@@ -1461,13 +2211,11 @@ int pfunc_exec(sp_task_t t, void *unused)
         for (;;)
         {
             /* for each record in the group */
-            while (pfunc_get_rec(t, &rec) > 0)
+            while ((len = (int)pfunc_get_rec(t, &rec)) > 0)
             {
-                int     len;
                 int     copy_size;
         
                 /* buffer and write to in.wr_fd */
-                len = strlen(rec);
                 while (len)
                 {
                     copy_size = len;
@@ -1626,6 +2374,102 @@ int pfunc_exec(sp_task_t t, void *unused)
 }
 
 
+/* cache_advise - internal routine to give the page cache advice of the
+ *                ,CACHE= policy of a file read or written with normal
+ *                (not direct) requests.
+ */
+static void cache_advise(sp_file_t spf)
+{
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (spf->cache == CACHE_KEEP || !spf->can_seek)
+        return;
+    posix_fadvise(spf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (spf->cache == CACHE_DROP)
+        posix_fadvise(spf->fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif
+}
+
+
+/* cache_behind - internal routine to drop the pages of a ,CACHE=DROP file
+ *                from the page cache once they are behind the specified
+ *                file offset, so that a sequential pass over a large file
+ *                doesn't push everything else out of the cache.  Written
+ *                pages must be clean to be dropped, so the write-back of
+ *                each range is started as soon as the range is written
+ *                and only waited for after the next range is written.
+ *                If final is set, all pages before the offset are dropped.
+ */
+static void cache_behind(sp_file_t spf, int64_t offset, int writing, int final)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    int64_t     drop_end;
+
+    if (spf->cache != CACHE_DROP || !spf->can_seek ||
+        (!final && offset - spf->cache_flushing < CACHE_BEHIND_SIZE))
+    {
+        return;
+    }
+    drop_end = (writing && !final) ? spf->cache_flushing : offset;
+# if defined(SYNC_FILE_RANGE_WRITE)
+    if (writing)
+    {
+        if (offset > spf->cache_flushing)
+            sync_file_range(spf->fd, spf->cache_flushing,
+                            offset - spf->cache_flushing,
+                            SYNC_FILE_RANGE_WRITE);
+        if (drop_end > spf->cache_done)
+            sync_file_range(spf->fd, spf->cache_done,
+                            drop_end - spf->cache_done,
+                            SYNC_FILE_RANGE_WAIT_BEFORE |
+                            SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+# endif
+    if (drop_end > spf->cache_done)
+        posix_fadvise(spf->fd, spf->cache_done, drop_end - spf->cache_done,
+                      POSIX_FADV_DONTNEED);
+    spf->cache_done = drop_end;
+    spf->cache_flushing = offset;
+#endif
+}
+
+
+/* sync_written - internal routine for a ,SYNC output file to count the
+ *                bytes whose writes have completed, and to flush them to
+ *                stable storage once ,SYNC=%d bytes have been written
+ *                since the last flush, or if final is set, after the last
+ *                write.  The caller serializes the calls of the writer
+ *                threads of a ,WRITERS file.
+ *
+ * Returns: TRUE if successful, FALSE if an error was raised.
+ */
+static int sync_written(sp_file_t spf, size_t bytes, int final)
+{
+    char        err_buf[200];
+
+    if (!spf->sync || !spf->can_seek)
+        return (TRUE);
+    spf->sync_pending += bytes;
+    if (!final && (spf->sync_size == 0 || spf->sync_pending < spf->sync_size))
+        return (TRUE);
+    TRACE("sync_written: flushing %d bytes\n", (int)spf->sync_pending);
+    spf->sync_pending = 0;
+#if defined(win_nt)
+    if (!FlushFileBuffers(spf->fd))
+#else
+    if (fdatasync(spf->fd) != 0)
+#endif
+    {
+        sp_raise_error(spf->sp, SP_FILE_WRITE_ERROR,
+                       "%s: fdatasync() failure: %s\n", spf->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)));
+        spf->error_code = SP_FILE_WRITE_ERROR;
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+
 /* file_reader_test - test routine for a file reader thread using 
  *                            normal read() calls into an intermediate
  *                            buffer followed by writes into the sump pump.
@@ -1696,6 +2540,7 @@ static void *file_reader_buffered(void *arg)
     char                *read_buf;
     int                 eof;
     int                 ret;
+    int64_t             file_offset = 0;
     sp_file_t           sp_src = (sp_file_t)arg;
     sp_t                sp = sp_src->sp;
     char                err_buf[200];
@@ -1704,6 +2549,7 @@ static void *file_reader_buffered(void *arg)
 #endif
 
     TRACE("file_reader_buffered starting\n");
+    cache_advise(sp_src);
             
     /* keep looping until there is no additional input */
     for (index = 0; ; index++)
@@ -1751,9 +2597,12 @@ static void *file_reader_buffered(void *arg)
             TRACE("file_reader: sp_put_in_buf_bytes ret: %d\n", ret);
             break;      /* silently quit on a downstream error */
         }
+        file_offset += filled_bytes;
         if (eof)
             break;
+        cache_behind(sp_src, file_offset, FALSE, FALSE);
     }
+    cache_behind(sp_src, file_offset, FALSE, TRUE);
 #if defined(win_nt)
     CloseHandle(sp_src->fd);
     sp_src->fd = INVALID_HANDLE_VALUE;
@@ -1766,64 +2615,379 @@ static void *file_reader_buffered(void *arg)
 }
 
 
-/* file_writer_buffered - main routine for a file writer thread using normal
- *                        write() calls.
+#if !defined(win_nt)
+/* struct shared by the ,READERS threads of an input file */
+struct range_readers
+{
+    sp_file_t           sp_src;
+    pthread_mutex_t     claim_mtx;      /* for claiming the next buffer */
+    pthread_mutex_t     put_mtx;        /* for bufs_put and stop */
+    pthread_cond_t      put_cond;       /* bufs_put or stop has changed */
+    uint64_t            next_buf;       /* next input buffer to claim */
+    int64_t             next_offset;    /* file offset of the next buffer */
+    uint64_t            bufs_put;       /* input buffers put so far */
+    int                 stop;           /* eof has been put, or an error */
+};
+
+
+/* range_reader_main - main routine for each of the ,READERS threads of an
+ *                     input file.  A thread claims the next input buffer
+ *                     and the file range that will fill it, then reads
+ *                     the range with pread() while the other threads read
+ *                     theirs, and puts the buffer once the previous one
+ *                     has been put.
  */
-static void *file_writer_buffered(void *arg)
+static void *range_reader_main(void *arg)
 {
-    char                *buf;
+    struct range_readers *rr = (struct range_readers *)arg;
+    sp_file_t           sp_src = rr->sp_src;
+    sp_t                sp = sp_src->sp;
+    uint64_t            index;
+    int64_t             offset;
+    char                *read_buf;
+    size_t              buf_size;
+    size_t              filled_bytes;
+    size_t              request;
     ssize_t             size;
-    sp_file_t           sp_dst = (sp_file_t)arg;
-    sp_t                sp = sp_dst->sp;
-    int64_t             file_size = 0;
-#if defined(win_nt)
-    DWORD               wr_size;
-#else
-    int                 fd = sp_dst->fd;
-#endif      
-    int                 out_index = sp_dst->out_index;
+    int                 stop;
+    int                 eof;
     char                err_buf[200];
-    
-    TRACE("file_writer_buffered: allocating %d buffer bytes\n", sp_dst->transfer_size);
-    buf = (char *)malloc(sp_dst->transfer_size);
-    if (buf == NULL)
-    {
-        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
-                       "%s: buffer malloc failure, size %d\n",
-                       sp_dst->fname, (int)sp_dst->transfer_size);
-    }
-        
-    for ( ; buf != NULL; )
+
+    for (;;)
     {
-        size = sp_read_output(sp, out_index, buf, sp_dst->transfer_size);
-        if (size <= 0)
+        pthread_mutex_lock(&rr->claim_mtx);
+        index = rr->next_buf;
+        /* don't get ahead of the ring of input buffers */
+        pthread_mutex_lock(&rr->put_mtx);
+        while (!rr->stop && index >= rr->bufs_put + sp->num_in_bufs)
+            pthread_cond_wait(&rr->put_cond, &rr->put_mtx);
+        stop = rr->stop;
+        pthread_mutex_unlock(&rr->put_mtx);
+        if (stop ||
+            sp_get_in_buf(sp, index, (void **)&read_buf, &buf_size) != SP_OK)
+        {
+            pthread_mutex_unlock(&rr->claim_mtx);
+            break;
+        }
+        rr->next_buf++;
+        offset = rr->next_offset;
+        rr->next_offset += buf_size;
+        pthread_mutex_unlock(&rr->claim_mtx);
+
+        for (filled_bytes = 0; filled_bytes < buf_size; filled_bytes += size)
         {
+            /* limit request size to 2GB */
+            request = buf_size - filled_bytes;
+            if (request > 0x80000000)
+                request = 0x80000000;
+            size = pread(sp_src->fd, read_buf + filled_bytes, request,
+                         offset + filled_bytes);
+            TRACE("range_reader: read %d bytes\n", (int)size);
             if (size < 0)
             {
-                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                sp_raise_error(sp, SP_FILE_READ_ERROR,
+                               "%s: pread() failure: %s\n",
+                               sp_src->fname,
+                               get_error_msg(0, err_buf, sizeof(err_buf)));
+                filled_bytes = 0;
+                break;
             }
-            break;
+            if (size == 0)  /* if EOF */
+                break;
+        }
+        eof = (filled_bytes < buf_size);
+
+        pthread_mutex_lock(&rr->put_mtx);
+        while (!rr->stop && rr->bufs_put != index)
+            pthread_cond_wait(&rr->put_cond, &rr->put_mtx);
+        if (!rr->stop)
+        {
+            /* silently quit on a downstream error */
+            if (sp_put_in_buf_bytes(sp, index, filled_bytes, eof) != SP_OK ||
+                eof)
+            {
+                rr->stop = TRUE;
+            }
+            rr->bufs_put++;
+            cache_behind(sp_src, offset + filled_bytes, FALSE, rr->stop);
+        }
+        pthread_cond_broadcast(&rr->put_cond);
+        pthread_mutex_unlock(&rr->put_mtx);
+    }
+    /* let threads waiting for this one's buffer give up */
+    pthread_mutex_lock(&rr->put_mtx);
+    rr->stop = TRUE;
+    pthread_cond_broadcast(&rr->put_cond);
+    pthread_mutex_unlock(&rr->put_mtx);
+    return (NULL);
+}
+
+
+/* file_reader_ranges - main routine for the reader thread of a ,READERS=%d
+ *                      input file, which reads alongside the additional
+ *                      reader threads it creates.
+ */
+static void *file_reader_ranges(void *arg)
+{
+    sp_file_t           sp_src = (sp_file_t)arg;
+    struct range_readers rr;
+    pthread_t           *threads;
+    int                 i;
+
+    TRACE("file_reader_ranges starting %d readers\n", sp_src->num_readers);
+    memset(&rr, 0, sizeof(rr));
+    rr.sp_src = sp_src;
+    pthread_mutex_init(&rr.claim_mtx, NULL);
+    pthread_mutex_init(&rr.put_mtx, NULL);
+    pthread_cond_init(&rr.put_cond, NULL);
+    cache_advise(sp_src);
+    threads = (pthread_t *)calloc(sp_src->num_readers - 1, sizeof(pthread_t));
+    for (i = 0; threads != NULL && i < sp_src->num_readers - 1; i++)
+    {
+        if (create_thread(sp_src->sp, &threads[i], range_reader_main,
+                          &rr, -1) != 0)
+        {
+            break;      /* make do with fewer readers */
+        }
+    }
+    range_reader_main(&rr);
+    while (i-- > 0)
+        pthread_join(threads[i], NULL);
+    if (threads != NULL)
+        free(threads);
+    pthread_mutex_destroy(&rr.claim_mtx);
+    pthread_mutex_destroy(&rr.put_mtx);
+    pthread_cond_destroy(&rr.put_cond);
+    /*close(sp_src->fd);*/
+    sp_src->fd = INVALID_FD;
+    TRACE("file_reader_ranges done: %d\n", sp_src->error_code);
+    return (NULL);
+}
+#endif
+
+
+#if !defined(win_nt)
+
+/* drop_map_ref - internal routine to drop a reference to the mapping of an
+ *                ,MMAP input file, unmapping it when it was the last one.
+ */
+static void drop_map_ref(sp_file_t sp_src)
+{
+    if (SP_ATOMIC_ADD32(&sp_src->map_refs, -1) == 1 && sp_src->map != NULL)
+        munmap(sp_src->map, sp_src->map_size);
+}
+
+
+/* release_map_window - internal release function for the input buffers
+ *                      that are windows of an ,MMAP input file mapping.
+ */
+static void release_map_window(void *buf, size_t size, void *arg)
+{
+    drop_map_ref((sp_file_t)arg);
+}
+
+
+/* file_reader_mmap - main routine for a file reader thread that maps the
+ *                    file and gives windows of the mapping to the sump
+ *                    pump as its input buffers.  The pages of the windows
+ *                    that fill the input buffer ring are prefetched ahead
+ *                    of the sump pump tasks.
+ */
+static void *file_reader_mmap(void *arg)
+{
+    sp_file_t           sp_src = (sp_file_t)arg;
+    sp_t                sp = sp_src->sp;
+    struct stat         st;
+    size_t              offset;
+    size_t              size;
+    size_t              ahead;
+    size_t              prefetch;
+    char                err_buf[200];
+
+    TRACE("file_reader_mmap starting\n");
+    if (fstat(sp_src->fd, &st) != 0)
+    {
+        sp_raise_error(sp, SP_FILE_READ_ERROR, "%s: fstat() failure: %s\n",
+                       sp_src->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)));
+        return (NULL);
+    }
+    sp_src->map_size = (size_t)st.st_size;
+    if (sp_src->map_size != 0)
+    {
+        sp_src->map = (char *)mmap(NULL, sp_src->map_size, PROT_READ,
+                                   MAP_SHARED, sp_src->fd, 0);
+        if (sp_src->map == MAP_FAILED)
+        {
+            sp_raise_error(sp, SP_FILE_READ_ERROR,
+                           "%s: mmap() failure: %s\n", sp_src->fname,
+                           get_error_msg(0, err_buf, sizeof(err_buf)));
+            return (NULL);
+        }
+        madvise(sp_src->map, sp_src->map_size, MADV_SEQUENTIAL);
+    }
+    sp_src->map_refs = 1;       /* the reader's reference */
+
+    prefetch = sp->in_buf_size * sp->num_in_bufs;
+    for (offset = ahead = 0; offset < sp_src->map_size; offset += size)
+    {
+        size = sp->in_buf_fill;
+        if (size > sp_src->map_size - offset)
+            size = sp_src->map_size - offset;
+
+        /* prefetch the windows that will fill the input buffer ring */
+        if (ahead < offset + prefetch && ahead < sp_src->map_size)
+        {
+            size_t      end = offset + prefetch;
+            size_t      bytes;
+
+            /* madvise() needs a page-aligned start, so the range begins
+             * at the page holding ahead and still reaches end.
+             */
+            if (end > sp_src->map_size)
+                end = sp_src->map_size;
+            ahead &= ~((size_t)PAGE_SIZE - 1);
+            bytes = end - ahead;
+            madvise(sp_src->map + ahead, bytes, MADV_WILLNEED);
+            ahead = end;
         }
-        TRACE("file_writer: writing %d bytes at offset %"PTFlld"\n",
-              size, file_size);  
+
+        SP_ATOMIC_ADD32(&sp_src->map_refs, 1);
+        if (sp_write_input_ref(sp, sp_src->map + offset, size,
+                               release_map_window, sp_src) != SP_OK)
+        {
+            break;      /* silently quit on a downstream error */
+        }
+    }
+    if (offset >= sp_src->map_size)
+        sp_write_input(sp, NULL, 0);
+    drop_map_ref(sp_src);
+    TRACE("file_reader_mmap done: %d\n", sp_src->error_code);
+    return (NULL);
+}
+
+#endif
+
+
+/* write_dst_bytes - internal routine for file_writer_buffered() to write
+ *                   bytes to its output file.
+ *
+ * Returns: TRUE if successful, FALSE if an error was raised.
+ */
+static int write_dst_bytes(sp_file_t sp_dst, char *buf, ssize_t size)
+{
+#if defined(win_nt)
+    DWORD               wr_size;
+#endif
+    char                err_buf[200];
+
+    TRACE("file_writer: writing %d bytes\n", size);
 #if defined(win_nt)
-        if (!WriteFile(sp_dst->fd, buf, size, &wr_size, NULL))
+    if (!WriteFile(sp_dst->fd, buf, size, &wr_size, NULL))
 #else
-        if (write(fd, buf, (unsigned int)size) != size)
+    if (write(sp_dst->fd, buf, (unsigned int)size) != size)
 #endif
+    {
+        sp_raise_error(sp_dst->sp, SP_FILE_WRITE_ERROR,
+                       "%s: write() failure: %s\n",
+                       sp_dst->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)));
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+        TRACE("output file write error: %s\n", err_buf);
+        return (FALSE);
+    }
+    return (sync_written(sp_dst, size, FALSE));
+}
+
+
+/* file_writer_buffered - main routine for a file writer thread using normal
+ *                        write() calls.  Unless the output is from a sort,
+ *                        task output buffers holding at least the transfer
+ *                        size are written directly, while smaller ones are
+ *                        gathered in the transfer buffer.
+ */
+static void *file_writer_buffered(void *arg)
+{
+    char                *buf;
+    void                *view;
+    ssize_t             size;
+    ssize_t             buf_bytes = 0;
+    ssize_t             take;
+    sp_file_t           sp_dst = (sp_file_t)arg;
+    sp_t                sp = sp_dst->sp;
+    int64_t             file_size = 0;
+    int                 out_index = sp_dst->out_index;
+    char                err_buf[200];
+    
+    TRACE("file_writer_buffered: allocating %d buffer bytes\n", sp_dst->transfer_size);
+    cache_advise(sp_dst);
+    buf = (char *)malloc(sp_dst->transfer_size);
+    if (buf == NULL)
+    {
+        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
+                       "%s: buffer malloc failure, size %d\n",
+                       sp_dst->fname, (int)sp_dst->transfer_size);
+    }
+        
+    for ( ; buf != NULL; )
+    {
+        if (sp->flags & SP_SORT)
+        {
+            size = sp_read_output(sp, out_index, buf, sp_dst->transfer_size);
+            if (size <= 0)
+            {
+                if (size < 0)
+                    sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                break;
+            }
+            if (!write_dst_bytes(sp_dst, buf, size))
+                break;
+            file_size += size;
+            cache_behind(sp_dst, file_size, TRUE, FALSE);
+            continue;
+        }
+
+        size = sp_read_output_view(sp, out_index, &view);
+        if (size < 0)
         {
-            sp_raise_error(sp, SP_FILE_WRITE_ERROR,
-                           "%s: write() failure: %s\n",
-                           sp_dst->fname,
-                           get_error_msg(0, err_buf, sizeof(err_buf)));
             sp_dst->error_code = SP_FILE_WRITE_ERROR;
-            TRACE("output file write error: %s\n", err_buf);
             break;
         }
-        file_size += size;
+        if (size == 0)      /* output EOF, write any gathered bytes */
+        {
+            if (buf_bytes != 0 && write_dst_bytes(sp_dst, buf, buf_bytes))
+                file_size += buf_bytes;
+            break;
+        }
+        if (buf_bytes == 0 && size >= (ssize_t)sp_dst->transfer_size)
+        {
+            if (!write_dst_bytes(sp_dst, (char *)view, size))
+                break;
+            file_size += size;
+            sp_release_output(sp, out_index, size);
+            cache_behind(sp_dst, file_size, TRUE, FALSE);
+            continue;
+        }
+        take = (ssize_t)sp_dst->transfer_size - buf_bytes;
+        if (take > size)
+            take = size;
+        memcpy(buf + buf_bytes, view, take);
+        buf_bytes += take;
+        sp_release_output(sp, out_index, take);
+        if (buf_bytes == (ssize_t)sp_dst->transfer_size)
+        {
+            if (!write_dst_bytes(sp_dst, buf, buf_bytes))
+                break;
+            file_size += buf_bytes;
+            buf_bytes = 0;
+            cache_behind(sp_dst, file_size, TRUE, FALSE);
+        }
     }
     if (buf != NULL && sp_dst->can_seek)
     {
+        if (sp_dst->error_code == 0)
+            sync_written(sp_dst, 0, TRUE);
+        cache_behind(sp_dst, file_size, TRUE, TRUE);
 #if defined(win_nt)
         if (!SetEndOfFile(sp_dst->fd))
 #else
@@ -1853,130 +3017,443 @@ static void *file_writer_buffered(void *arg)
 }
 
 
-#if defined(AIO_CAPABLE)
+#if !defined(win_nt)
+/* struct shared by the ,WRITERS threads of an output file */
+struct range_writers
+{
+    sp_file_t           sp_dst;
+    pthread_mutex_t     claim_mtx;      /* for claiming the next output */
+    int64_t             next_offset;    /* file offset of the next output,
+                                         * or for -SAME_SIZE, the end of
+                                         * the output claimed so far */
+    int64_t             claimed;        /* bytes of output claimed */
+    int64_t             alloc_end;      /* end of the preallocated range, or
+                                         * -1 if preallocation failed */
+    int                 stop;           /* output eof, or an error */
+};
 
-/* file_reader_direct - main routine for a file reader thread using direct
- *                      aio_read() calls on sump pump input buffers.
+
+/* pwrite_range - internal routine for the ,WRITERS threads to write bytes
+ *                at the specified offset of their output file.
+ *
+ * Returns: TRUE if successful, FALSE if an error was raised.
  */
-static void *file_reader_direct(void *arg)
+static int pwrite_range(sp_file_t sp_dst, char *buf, size_t size,
+                        int64_t offset)
 {
-    ssize_t             size;
-    ssize_t             request;
-    size_t              in_buf_size;
-    uint64_t            aios_started;
-    int64_t             file_read_offset = 0;
-    struct sump_aio     *spaio;
-    struct aiocb        *aio;
-    const struct aiocb  *cb[1];
-    int                 eof;
-    sp_file_t           sp_src = (sp_file_t)arg;
-    sp_t                sp = sp_src->sp;
+    size_t              request;
+    ssize_t             ret;
     char                err_buf[200];
-    int                 aio_count;
-    int                 start;
-    int                 done;
-    uint64_t            next_in_buf;
-    size_t              next_buf_offset;
-    char                *buf;
-    int                 put_result;
-#if defined(win_nt)
-    int                 i;
-#endif
 
-    if (sp_src->aio_count <= 0)
-        aio_count = 2;
-    else
-        aio_count = sp_src->aio_count;
-    TRACE("file_reader_direct allocating %d aio structs\n", aio_count);
-    spaio = (struct sump_aio *)calloc(sizeof(struct sump_aio), aio_count);
-    if (spaio == NULL)
+    while (size != 0)
     {
-        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
-                       "%s: aio malloc failure, size %d\n",
-                       sp_src->fname, (int)aio_count);
-        TRACE("file_reader_direct done: %d\n", sp_src->error_code);
-        return (NULL);
-    }
-#if defined(win_nt)
-    for (i = 0; i < aio_count; i++)
-    {
-        spaio[i].aio.sump_over.hEvent = CreateEvent(NULL, 1, 0, NULL);
-        if (spaio[i].aio.sump_over.hEvent == NULL)
-            die("file_reader_direct, CreateEvent failed\n");
+        /* limit request size to 2GB */
+        request = size > 0x80000000 ? 0x80000000 : size;
+        ret = pwrite(sp_dst->fd, buf, request, offset);
+        TRACE("range_writer: wrote %d bytes\n", (int)ret);
+        if (ret <= 0)
+        {
+            sp_raise_error(sp_dst->sp, SP_FILE_WRITE_ERROR,
+                           "%s: pwrite() failure: %s\n",
+                           sp_dst->fname,
+                           get_error_msg(0, err_buf, sizeof(err_buf)));
+            sp_dst->error_code = SP_FILE_WRITE_ERROR;
+            return (FALSE);
+        }
+        buf += ret;
+        size -= ret;
+        offset += ret;
     }
-#endif
-    
-    /* keep looping until there is no additional input */
-    next_in_buf = 0;
-    next_buf_offset = 0;
-    for (aios_started = 0; ; aios_started++)
+    return (TRUE);
+}
+
+
+/* range_writer_main - main routine for each of the ,WRITERS threads of an
+ *                     output file.  A thread claims the next output bytes
+ *                     and the file offset that follows the bytes claimed
+ *                     before them, or with -SAME_SIZE, the offset of the
+ *                     task's input, so that the outputs of the tasks are
+ *                     claimed in whatever order they are ready.  If the
+ *                     bytes are the last output of a done task, it writes
+ *                     them with pwrite() while the other threads claim and
+ *                     write the outputs of other tasks.  Otherwise, since
+ *                     the task will reuse its output buffer, it writes
+ *                     them before letting the next output be claimed.
+ *                     With ,SYNC, the writes are flushed to stable storage
+ *                     in batches.
+ */
+static void *range_writer_main(void *arg)
+{
+    struct range_writers *rw = (struct range_writers *)arg;
+    sp_file_t           sp_dst = rw->sp_dst;
+    sp_t                sp = sp_dst->sp;
+    int                 out_index = sp_dst->out_index;
+    void                *view;
+    void                *hold;
+    ssize_t             size;
+    int64_t             offset;
+    sp_task_t           t;
+    int                 ok;
+
+    for (;;)
     {
-        start = aios_started % aio_count;
-        aio = &spaio[start].aio;
-        aio->aio_fildes = sp_src->fd;
-        /* if getting of the buffer fails. */
-        if (sp_get_in_buf(sp, next_in_buf, (void **)&buf, &in_buf_size) != SP_OK)
+        pthread_mutex_lock(&rw->claim_mtx);
+        if (rw->stop)
         {
-            sp_raise_error(sp, SP_FILE_READ_ERROR,
-                           "sp_get_in_buf() failure with in_buf %lld\n",
-                           aios_started);
+            pthread_mutex_unlock(&rw->claim_mtx);
             break;
         }
-        request = in_buf_size - next_buf_offset;
-        if (request > sp_src->transfer_size)
-            request = sp_src->transfer_size;
-        aio->aio_buf = buf + next_buf_offset;
-        aio->aio_nbytes = request;
-        aio->aio_offset = file_read_offset;
-        spaio[start].buf_index = next_in_buf;
-        spaio[start].buf_offset = next_buf_offset;
-        spaio[start].file_offset = file_read_offset;
-        spaio[start].nbytes = request;
-        spaio[start].last_buf_io = (next_buf_offset + request == in_buf_size);
-        next_buf_offset += request;
-        TRACE("file_reader: reading %d bytes at offset %"PTFlld"\n",
-              request, file_read_offset);
-        if (next_buf_offset == in_buf_size)
-        {
-            next_in_buf++;
-            next_buf_offset = 0;
-        }
-        if (aio_read(aio) < 0)
-        {
-            get_error_msg(aio_error(aio), err_buf, sizeof(err_buf));
-            TRACE("file_reader_direct: read failed: %s\n", err_buf);
-            sp_src->error_code = SP_FILE_READ_ERROR;
-            sp_raise_error(sp, SP_FILE_READ_ERROR,
-                           "%s: aio_read() failure: %s, "
-                           "offset: %"PTFlld", size: %"PTFlld"\n",
-                           sp_src->fname, err_buf,
-                           aio->aio_offset, (int64_t)request);
+        size = sp_read_output_hold(sp, out_index, &view, &hold);
+        if (size <= 0)
+        {
+            if (size < 0)
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+            rw->stop = TRUE;
+            pthread_mutex_unlock(&rw->claim_mtx);
             break;
         }
-        file_read_offset += request;
-        /* if the max number of aios has not been started, then start another.
-         */
-        if (aios_started < aio_count - 1)
-            continue;
-
-        /* wait for a previously issued request.
-         */
-        done = (aios_started + 1) % aio_count;
-        aio = &spaio[done].aio;
-        request = spaio[done].nbytes;
-        cb[0] = aio;
-        if (aio_suspend(cb, 1, NULL) != 0)
+        if (sp->same_size)
         {
-            sp_src->error_code = SP_FILE_READ_ERROR;
-            sp_raise_error(sp, SP_FILE_READ_ERROR,
-                           "%s: aio_suspend() failure: %s, "
-                           "offset: %"PTFlld", size: %"PTFlld"\n",
-                           sp_src->fname,
-                           get_error_msg(0, err_buf, sizeof(err_buf)),
-                           spaio[done].file_offset, (int64_t)request);
-            break;
+            /* the output of a task goes where the task's input was */
+            t = hold != NULL ? (sp_task_t)hold : sp->out[out_index].curr_task;
+            offset = t->out[out_index].file_offset;
+            t->out[out_index].file_offset += size;
+            if (hold != NULL && t->out[out_index].file_offset !=
+                t->in_offset + (int64_t)t->in_bytes_read)
+            {
+                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                               "%s: -SAME_SIZE task %"PTFlld" output size "
+                               "differs from its input size\n",
+                               sp_dst->fname, (int64_t)t->task_number);
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                sp_release_output_hold(sp, out_index, hold);
+                rw->stop = TRUE;
+                pthread_mutex_unlock(&rw->claim_mtx);
+                break;
+            }
+            if (rw->next_offset < offset + size)
+                rw->next_offset = offset + size;
         }
-        if ((size = aio_return(aio)) < 0)
+        else
+        {
+            offset = rw->next_offset;
+            rw->next_offset += size;
+        }
+        rw->claimed += size;
+#if defined(FALLOC_FL_KEEP_SIZE)
+        /* preallocate ahead of the writes, without changing the file
+         * size, so that concurrent writes don't fragment the file.
+         */
+        if (rw->alloc_end >= 0 && rw->next_offset > rw->alloc_end)
+        {
+            if (fallocate(sp_dst->fd, FALLOC_FL_KEEP_SIZE, rw->alloc_end,
+                          rw->next_offset - rw->alloc_end +
+                          WRITERS_PREALLOC_SIZE) == 0)
+            {
+                rw->alloc_end = rw->next_offset + WRITERS_PREALLOC_SIZE;
+            }
+            else
+                rw->alloc_end = -1;
+        }
+#endif
+        if (hold == NULL)
+        {
+            ok = pwrite_range(sp_dst, (char *)view, size, offset) &&
+                sync_written(sp_dst, size, FALSE);
+            if (ok)
+                sp_release_output(sp, out_index, size);
+            else
+                rw->stop = TRUE;
+            pthread_mutex_unlock(&rw->claim_mtx);
+        }
+        else
+        {
+            pthread_mutex_unlock(&rw->claim_mtx);
+            ok = pwrite_range(sp_dst, (char *)view, size, offset);
+            sp_release_output_hold(sp, out_index, hold);
+            pthread_mutex_lock(&rw->claim_mtx);
+            if (ok)
+                ok = sync_written(sp_dst, size, FALSE);
+            if (!ok)
+                rw->stop = TRUE;
+            pthread_mutex_unlock(&rw->claim_mtx);
+        }
+        if (!ok)
+            break;
+    }
+    return (NULL);
+}
+
+
+/* file_writer_ranges - main routine for the writer thread of a ,WRITERS=%d
+ *                      output file, which writes alongside the additional
+ *                      writer threads it creates.
+ */
+static void *file_writer_ranges(void *arg)
+{
+    sp_file_t           sp_dst = (sp_file_t)arg;
+    struct range_writers rw;
+    pthread_t           *threads;
+    char                err_buf[200];
+    int                 i;
+
+    TRACE("file_writer_ranges starting %d writers\n", sp_dst->num_writers);
+    memset(&rw, 0, sizeof(rw));
+    rw.sp_dst = sp_dst;
+    pthread_mutex_init(&rw.claim_mtx, NULL);
+    cache_advise(sp_dst);
+    threads = (pthread_t *)calloc(sp_dst->num_writers - 1, sizeof(pthread_t));
+    for (i = 0; threads != NULL && i < sp_dst->num_writers - 1; i++)
+    {
+        if (create_thread(sp_dst->sp, &threads[i], range_writer_main,
+                          &rw, -1) != 0)
+        {
+            break;      /* make do with fewer writers */
+        }
+    }
+    range_writer_main(&rw);
+    while (i-- > 0)
+        pthread_join(threads[i], NULL);
+    if (threads != NULL)
+        free(threads);
+    pthread_mutex_destroy(&rw.claim_mtx);
+    /* -SAME_SIZE output must fill the file the size of the input */
+    if (sp_dst->error_code == 0 && sp_dst->sp->same_size &&
+        rw.claimed != sp_dst->sp->in_stream_bytes)
+    {
+        sp_raise_error(sp_dst->sp, SP_FILE_WRITE_ERROR,
+                       "%s: -SAME_SIZE output of %"PTFlld" bytes differs "
+                       "from the input of %"PTFlld" bytes\n", sp_dst->fname,
+                       rw.claimed, sp_dst->sp->in_stream_bytes);
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+    }
+    if (sp_dst->error_code == 0)
+        sync_written(sp_dst, 0, TRUE);
+    /* trim the file to the bytes written, which also frees any blocks
+     * preallocated past them.
+     */
+    if (sp_dst->error_code == 0 && ftruncate(sp_dst->fd, rw.next_offset))
+    {
+        sp_raise_error(sp_dst->sp, SP_FILE_WRITE_ERROR,
+                       "%s: ftruncate() failure: %s\n",
+                       sp_dst->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)));
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+    }
+    /* the writes complete out of order, so the pages are only dropped
+     * once they are all written.
+     */
+    cache_behind(sp_dst, rw.next_offset, TRUE, TRUE);
+    /*close(sp_dst->fd);*/
+    sp_dst->fd = INVALID_FD;
+    TRACE("file_writer_ranges done: %d\n", sp_dst->error_code);
+    return (NULL);
+}
+#endif
+
+
+#if defined(AIO_CAPABLE)
+
+/* struct for tuning the number of outstanding requests of a ,COUNT=AUTO
+ * file as it is read or written */
+struct aio_tune
+{
+    char        enabled;        /* ,COUNT=AUTO was specified */
+    int         depth;          /* number of requests to keep outstanding */
+    int         max;            /* max depth, the number of aio structs */
+    int         step;           /* next change in depth: 1 or -1 */
+    int         ios;            /* requests completed in this window */
+    uint64_t    bytes;          /* bytes completed in this window */
+    uint64_t    begin_us;       /* start time of this window */
+    double      prev_rate;      /* bytes per usec in the previous window */
+};
+
+
+/* init_aio_tune - internal routine to initialize the tuning of the number
+ *                 of outstanding requests of a direct reader or writer.
+ *                 Unless ,COUNT=AUTO was specified, the depth stays at the
+ *                 number of aio structs.
+ */
+static void init_aio_tune(struct aio_tune *tune, sp_file_t spf, int aio_count)
+{
+    memset(tune, 0, sizeof(*tune));
+    tune->enabled = spf->auto_count && aio_count > 1;
+    tune->max = aio_count;
+    tune->depth = aio_count;
+    if (tune->enabled && tune->depth > AUTO_COUNT_START)
+        tune->depth = AUTO_COUNT_START;
+    tune->step = 1;
+    tune->begin_us = sp_get_time_us();
+}
+
+
+/* tune_aio_depth - internal routine called by a direct reader or writer of
+ *                  a ,COUNT=AUTO file as each of its requests completes.
+ *                  At the end of each window of completions, the rate at
+ *                  which bytes completed is compared with that of the
+ *                  previous window: the depth keeps moving in the same
+ *                  direction while the rate improves, and turns back once
+ *                  more outstanding requests only add to their latency.
+ */
+static void tune_aio_depth(struct aio_tune *tune, size_t bytes)
+{
+    uint64_t    now;
+    double      rate;
+
+    if (!tune->enabled)
+        return;
+    tune->ios++;
+    tune->bytes += bytes;
+    if (tune->ios < AUTO_COUNT_WINDOW * tune->depth)
+        return;
+    now = sp_get_time_us();
+    rate = (double)tune->bytes / (double)(now - tune->begin_us + 1);
+    TRACE("tune_aio_depth: depth %d, %d bytes/usec, latency %d usec\n",
+          tune->depth, (int)rate,
+          (int)((now - tune->begin_us) * tune->depth / tune->ios));
+    if (rate < tune->prev_rate)
+        tune->step = -tune->step;
+    if (tune->depth + tune->step < 1 || tune->depth + tune->step > tune->max)
+        tune->step = -tune->step;
+    tune->depth += tune->step;
+    tune->prev_rate = rate;
+    tune->ios = 0;
+    tune->bytes = 0;
+    tune->begin_us = now;
+}
+
+
+/* file_reader_direct - main routine for a file reader thread using direct
+ *                      aio_read() calls on sump pump input buffers.
+ */
+static void *file_reader_direct(void *arg)
+{
+    ssize_t             size;
+    ssize_t             request;
+    size_t              in_buf_size;
+    uint64_t            aios_started;
+    uint64_t            aios_completed;
+    int64_t             file_read_offset = 0;
+    struct sump_aio     *spaio;
+    struct aio_tune     tune;
+    struct aiocb        *aio;
+    const struct aiocb  *cb[1];
+    int                 eof;
+    sp_file_t           sp_src = (sp_file_t)arg;
+    sp_t                sp = sp_src->sp;
+    char                err_buf[200];
+    int                 aio_count;
+    int                 start;
+    int                 done;
+    uint64_t            next_in_buf;
+    size_t              next_buf_offset;
+    char                *buf;
+    int                 put_result;
+#if defined(win_nt)
+    int                 i;
+#endif
+
+    if (sp_src->aio_count <= 0)
+        aio_count = 2;
+    else
+        aio_count = sp_src->aio_count;
+    TRACE("file_reader_direct allocating %d aio structs\n", aio_count);
+    spaio = (struct sump_aio *)calloc(sizeof(struct sump_aio), aio_count);
+    if (spaio == NULL)
+    {
+        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
+                       "%s: aio malloc failure, size %d\n",
+                       sp_src->fname, (int)aio_count);
+        TRACE("file_reader_direct done: %d\n", sp_src->error_code);
+        return (NULL);
+    }
+#if defined(win_nt)
+    for (i = 0; i < aio_count; i++)
+    {
+        spaio[i].aio.sump_over.hEvent = CreateEvent(NULL, 1, 0, NULL);
+        if (spaio[i].aio.sump_over.hEvent == NULL)
+            die("file_reader_direct, CreateEvent failed\n");
+    }
+#endif
+    
+    /* keep looping until there is no additional input */
+    init_aio_tune(&tune, sp_src, aio_count);
+    next_in_buf = 0;
+    next_buf_offset = 0;
+    aios_completed = 0;
+    for (aios_started = 0; ; )
+    {
+        /* if the target number of aios has not been started, then start
+         * another.
+         */
+        if (aios_started - aios_completed < (uint64_t)tune.depth)
+        {
+            start = aios_started % aio_count;
+            aio = &spaio[start].aio;
+            aio->aio_fildes = sp_src->fd;
+            /* if getting of the buffer fails. */
+            if (sp_get_in_buf(sp, next_in_buf,
+                              (void **)&buf, &in_buf_size) != SP_OK)
+            {
+                sp_raise_error(sp, SP_FILE_READ_ERROR,
+                               "sp_get_in_buf() failure with in_buf %lld\n",
+                               aios_started);
+                break;
+            }
+            request = in_buf_size - next_buf_offset;
+            if (request > sp_src->transfer_size)
+                request = sp_src->transfer_size;
+            aio->aio_buf = buf + next_buf_offset;
+            aio->aio_nbytes = request;
+            aio->aio_offset = file_read_offset;
+            spaio[start].buf_index = next_in_buf;
+            spaio[start].buf_offset = next_buf_offset;
+            spaio[start].file_offset = file_read_offset;
+            spaio[start].nbytes = request;
+            spaio[start].last_buf_io = (next_buf_offset + request == in_buf_size);
+            next_buf_offset += request;
+            TRACE("file_reader: reading %d bytes at offset %"PTFlld"\n",
+                  request, file_read_offset);
+            if (next_buf_offset == in_buf_size)
+            {
+                next_in_buf++;
+                next_buf_offset = 0;
+            }
+            if (aio_read(aio) < 0)
+            {
+                get_error_msg(aio_error(aio), err_buf, sizeof(err_buf));
+                TRACE("file_reader_direct: read failed: %s\n", err_buf);
+                sp_src->error_code = SP_FILE_READ_ERROR;
+                sp_raise_error(sp, SP_FILE_READ_ERROR,
+                               "%s: aio_read() failure: %s, "
+                               "offset: %"PTFlld", size: %"PTFlld"\n",
+                               sp_src->fname, err_buf,
+                               aio->aio_offset, (int64_t)request);
+                break;
+            }
+            file_read_offset += request;
+            aios_started++;
+            continue;
+        }
+
+        /* wait for the oldest previously issued request.
+         */
+        done = aios_completed++ % aio_count;
+        aio = &spaio[done].aio;
+        request = spaio[done].nbytes;
+        cb[0] = aio;
+        if (aio_suspend(cb, 1, NULL) != 0)
+        {
+            sp_src->error_code = SP_FILE_READ_ERROR;
+            sp_raise_error(sp, SP_FILE_READ_ERROR,
+                           "%s: aio_suspend() failure: %s, "
+                           "offset: %"PTFlld", size: %"PTFlld"\n",
+                           sp_src->fname,
+                           get_error_msg(0, err_buf, sizeof(err_buf)),
+                           spaio[done].file_offset, (int64_t)request);
+            break;
+        }
+        if ((size = aio_return(aio)) < 0)
         {
             sp_src->error_code = SP_FILE_READ_ERROR;
             sp_raise_error(sp, SP_FILE_READ_ERROR,
@@ -1990,6 +3467,7 @@ static void *file_reader_direct(void *arg)
         }
 
         eof = (size < request);
+        tune_aio_depth(&tune, size);
         
         /* "put" the input buffer bytes if some bytes have been read into
          * the buffer and either eof or that was the last read for the buffer
@@ -2003,17 +3481,13 @@ static void *file_reader_direct(void *arg)
         }
         if (put_result != SP_OK || eof)
         {
-            /* clean up remaining aios and finish up */
-            if (aio_count != 1)
+            /* clean up remaining aios and finish up: wait for and ignore
+             * all previously issued aio's
+             */
+            while (aios_completed < aios_started)
             {
-                /* wait for and ignore all previously issued aio'ess
-                 */
-                do
-                {
-                    done = (done + 1) % aio_count;
-                    cb[0] = &spaio[done].aio;
-                    aio_suspend(cb, 1, NULL);
-                } while (done != start);
+                cb[0] = &spaio[aios_completed++ % aio_count].aio;
+                aio_suspend(cb, 1, NULL);
             }
             break;
         }
@@ -2033,13 +3507,128 @@ static void *file_reader_direct(void *arg)
 }
 
 
+/* start_write - internal routine for file_writer_direct() to start an
+ *               aio_write() of the specified bytes with the aio struct of
+ *               the specified aio number.
+ *
+ * Returns: 0 on success, or -1 if the write could not be started.
+ */
+static int start_write(sp_file_t sp_dst, struct sump_aio *spaio,
+                       int aio_count, uint64_t aio_number, char *src,
+                       ssize_t request, int64_t file_offset)
+{
+    struct sump_aio     *spa = &spaio[aio_number % aio_count];
+    struct aiocb        *aio = &spa->aio;
+    char                err_buf[200];
+
+    TRACE("file_writer[%d]: writing %"PTFlld" bytes at offset %"PTFlld"\n",
+          sp_dst->out_index, (int64_t)request, file_offset);
+    aio->aio_fildes = sp_dst->fd;
+    aio->aio_buf = src;
+    aio->aio_nbytes = request;
+    aio->aio_offset = file_offset;
+    spa->buf_index = 0;    /* not used */
+    spa->buf_offset = 0;   /* not used */
+    spa->file_offset = file_offset;
+    spa->nbytes = request;
+    spa->last_buf_io = 0;  /* not used */
+    if (aio_write(aio) < 0)
+    {
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+        sp_raise_error(sp_dst->sp, SP_FILE_WRITE_ERROR,
+                       "%s: aio_write() failure: %s, "
+                       "offset: %lld, size: %lld\n",
+                       sp_dst->fname,
+                       get_error_msg(aio_error(aio), err_buf,
+                                     sizeof(err_buf)),
+                       file_offset, (int64_t)request);
+        return (-1);
+    }
+    return (0);
+}
+
+
+/* wait_write_done - internal routine for file_writer_direct() to wait for
+ *                   its oldest outstanding write to complete.
+ *
+ * Returns: 0 on success, or -1 if the write failed.
+ */
+static int wait_write_done(sp_file_t sp_dst, struct sump_aio *spaio,
+                           int aio_count, uint64_t *aios_completed,
+                           struct aio_tune *tune)
+{
+    sp_t                sp = sp_dst->sp;
+    int                 done = (int)(*aios_completed % aio_count);
+    struct aiocb        *aio = &spaio[done].aio;
+    const struct aiocb  *cb[1];
+    ssize_t             request = spaio[done].nbytes;
+    ssize_t             size;
+    int                 ret;
+    char                err_buf[200];
+
+    cb[0] = aio;
+#if defined(win_nt)
+    ret = aio_suspend(cb, 1, NULL);
+#else
+    while ((ret = aio_suspend(cb, 1, NULL)) != 0 && errno == EINTR)
+        continue;
+#endif
+    if (ret != 0)
+    {
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+        sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                       "%s: aio_suspend() failure: %s, "
+                       "offset: %lld, size: %lld\n",
+                       sp_dst->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)),
+                       spaio[done].file_offset, (int64_t)request);
+        return (-1);
+    }
+    if ((size = aio_return(aio)) < 0)
+    {
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+        sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                       "%s: aio_return() failure: %s, "
+                       "offset: %lld, size: %lld\n",
+                       sp_dst->fname,
+                       get_error_msg(aio_error(aio), err_buf,
+                                     sizeof(err_buf)),
+                       spaio[done].file_offset, (int64_t)request);
+        return (-1);
+    }
+    if (size != request)
+    {
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+        sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                       "%s: aio_write() return failure: %s, "
+                       "offset: %"PTFlld", "
+                       "returned size %"PTFlld
+                       " != requested size: %"PTFlld"\n",
+                       sp_dst->fname,
+                       get_error_msg(aio_error(aio), err_buf,
+                                     sizeof(err_buf)),
+                       spaio[done].file_offset,
+                       (int64_t)size, (int64_t)request);
+        return (-1);
+    }
+    tune_aio_depth(tune, size);
+    (*aios_completed)++;
+    if (!sync_written(sp_dst, size, FALSE))
+        return (-1);
+    return (0);
+}
+
+
 /* file_writer_direct - main routine for a file writer thread using direct
- *                      aio_write() calls.
+ *                      aio_write() calls.  The task output buffers are
+ *                      viewed rather than copied, and written in place
+ *                      wherever they are aligned like the file.  Only the
+ *                      fragments around them, and buffers that are not so
+ *                      aligned, are copied into the staging buffers.
  */
 static void *file_writer_direct(void *arg)
 {
     char                *buf;
-    ssize_t             size;
     ssize_t             alloc_size;
     sp_file_t           sp_dst = (sp_file_t)arg;
     sp_t                sp = sp_dst->sp;
@@ -2047,16 +3636,24 @@ static void *file_writer_direct(void *arg)
     ssize_t             request;
     uint64_t            aios_started;
     uint64_t            aios_completed;
+    uint64_t            in_place_end;   /* aios_started after the last
+                                         * in-place write of the view */
+    struct aio_tune     tune;
     int64_t             file_write_offset = 0;
+    int64_t             next_offset;
     struct sump_aio     *spaio;
-    struct aiocb        *aio;
-    const struct aiocb  *cb[1];
     int                 aio_count;
     char                err_buf[200];
-    int                 start;
-    int                 done;
-    int                 eof;
+    char                *view;          /* unwritten task output bytes */
+    ssize_t             view_size;
+    size_t              view_consumed;  /* view bytes written or staged */
+    char                *stage;         /* staging buffer of the next aio */
+    ssize_t             stage_fill;
+    int                 aligned;
     int                 ret;
+#if defined(win_nt)
+    struct aiocb        *aio;
+#endif
     char                *remainder_start = NULL;
     int64_t             remainder_size = 0;
 #if defined(win_nt)
@@ -2111,123 +3708,136 @@ static void *file_writer_direct(void *arg)
     }
 #endif
 
+    /* write the task output buffers in place where they are aligned like
+     * the file, and stage the rest.
+     */
+    init_aio_tune(&tune, sp_dst, aio_count);
+    aios_started = 0;
     aios_completed = 0;
-    for (aios_started = 0; ; )
+    in_place_end = 0;
+    stage_fill = 0;
+    view = NULL;
+    view_size = 0;
+    view_consumed = 0;
+    for (;;)
     {
-        start = aios_started % aio_count;
-        aio = &spaio[start].aio;
-        aio->aio_fildes = sp_dst->fd;
-        aio->aio_buf = buf + start * sp_dst->transfer_size;
-        request = sp_read_output(sp, out_index, (void *)aio->aio_buf,
-                              sp_dst->transfer_size);
-        if (request < 0)
+        if (view_size == 0)
         {
-            sp_dst->error_code = SP_FILE_WRITE_ERROR;
-            break;
+            if (view_consumed != 0)
+            {
+                /* the buffer can be reused once its in-place writes are
+                 * done.
+                 */
+                while (aios_completed < in_place_end)
+                    if (wait_write_done(sp_dst, spaio, aio_count,
+                                        &aios_completed, &tune) != 0)
+                        break;
+                if (sp_dst->error_code != 0)
+                    break;
+                sp_release_output(sp, out_index, view_consumed);
+                view_consumed = 0;
+            }
+            view_size = sp_read_output_view(sp, out_index, (void **)&view);
+            if (view_size < 0)
+            {
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                break;
+            }
+            if (view_size == 0)
+                break;
         }
 
-        /* if not a write or not a full write, then its eof.
+        /* the stage is the buffer of the next aio, once it is free and
+         * fewer than the target number of aios are outstanding.
          */
-        eof = (request < sp_dst->transfer_size);
-        if (eof &&
-            (remainder_size = request % PAGE_SIZE) != 0)
-        {
-            request -= remainder_size;
-            remainder_start = (char *)aio->aio_buf + request;
-        }
-        if (request != 0)
+        while (aios_started - aios_completed >= (uint64_t)tune.depth)
+            if (wait_write_done(sp_dst, spaio, aio_count,
+                                &aios_completed, &tune) != 0)
+                break;
+        if (sp_dst->error_code != 0)
+            break;
+        stage = buf + (aios_started % aio_count) * sp_dst->transfer_size;
+        next_offset = file_write_offset + stage_fill;
+        aligned = ((size_t)view - (size_t)next_offset) % PAGE_SIZE == 0;
+        if (aligned && next_offset % PAGE_SIZE == 0 && view_size >= PAGE_SIZE)
         {
-            TRACE("file_writer[%d]: writing %"PTFlld" bytes at offset %"PTFlld"\n",
-                  out_index, (int64_t)request, file_write_offset);  
-            aio->aio_nbytes = request;
-            aio->aio_offset = file_write_offset;
-            spaio[start].buf_index = 0;    /* not used */
-            spaio[start].buf_offset = 0;   /* not used */
-            spaio[start].file_offset = file_write_offset;
-            spaio[start].nbytes = request;
-            spaio[start].last_buf_io = 0;  /* not used */
-            if (aio_write(aio) < 0)
+            if (stage_fill != 0)
             {
-                sp_dst->error_code = SP_FILE_WRITE_ERROR;
-                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
-                               "%s: aio_write() failure: %s, "
-                               "offset: %lld, size: %lld\n",
-                               sp_dst->fname,
-                               get_error_msg(aio_error(&aio[start]), err_buf,
-                                             sizeof(err_buf)),
-                               spaio[done].file_offset, request);
-                break;
+                request = stage_fill;
+                stage_fill = 0;
+                if (start_write(sp_dst, spaio, aio_count, aios_started,
+                                stage, request, file_write_offset) != 0)
+                    break;
+                aios_started++;
+                file_write_offset += request;
+                continue;
             }
+            request = view_size - view_size % PAGE_SIZE;
+            if (request > (ssize_t)sp_dst->transfer_size)
+                request = sp_dst->transfer_size;
+            if (start_write(sp_dst, spaio, aio_count, aios_started,
+                            view, request, file_write_offset) != 0)
+                break;
+            in_place_end = ++aios_started;
             file_write_offset += request;
-            aios_started++;
-        }
-        else if (aios_started == 0)  /* if no direct output whatsoever */
-            break;
-        
-        /* if not eof and the max number of aios has not been started,
-         * then start another.
-         */
-        if (!eof && aios_started < aio_count)
+            view += request;
+            view_size -= request;
+            view_consumed += request;
             continue;
+        }
 
-        /* wait for a previously issued request.
-         * if eof, then wait for all previously issued requests.
+        /* stage a head fragment up to the page boundary if the view is
+         * aligned like the file, otherwise as much as fits.
          */
-        do
+        request = sp_dst->transfer_size - stage_fill;
+        if (aligned && next_offset % PAGE_SIZE != 0 &&
+            request > (ssize_t)(PAGE_SIZE - next_offset % PAGE_SIZE))
         {
-            done = aios_completed % aio_count;
-            aio = &spaio[done].aio;
-            request = spaio[done].nbytes;
-            cb[0] = aio;
-#if defined(win_nt)
-            ret = aio_suspend(cb, 1, NULL);
-#else
-            while ((ret = aio_suspend(cb, 1, NULL)) != 0 && errno == EINTR)
-                continue;
-#endif
-            if (ret != 0)
-            {
-                sp_dst->error_code = SP_FILE_WRITE_ERROR;
-                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
-                               "%s: aio_suspend() failure: %s, "
-                               "offset: %lld, size: %lld\n",
-                               sp_dst->fname,
-                               get_error_msg(0, err_buf, sizeof(err_buf)),
-                               spaio[done].file_offset, request);
-                break;
-            }
-            if ((size = aio_return(aio)) < 0)
-            {
-                sp_dst->error_code = SP_FILE_WRITE_ERROR;
-                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
-                               "%s: aio_return() failure: %s, "
-                               "offset: %lld, size: %lld\n",
-                               sp_dst->fname,
-                               get_error_msg(aio_error(aio), err_buf,
-                                             sizeof(err_buf)),
-                               spaio[done].file_offset, request);
-                break;
-            }
-            if (size != request)
-            {
-                sp_dst->error_code = SP_FILE_WRITE_ERROR;
-                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
-                               "%s: aio_write() return failure: %s, "
-                               "offset: %"PTFlld", "
-                               "returned size %"PTFlld
-                               " != requested size: %"PTFlld"\n",
-                               sp_dst->fname,
-                               get_error_msg(aio_error(aio), err_buf,
-                                             sizeof(err_buf)),
-                               spaio[done].file_offset,
-                               (int64_t)size, (int64_t)request);
+            request = PAGE_SIZE - next_offset % PAGE_SIZE;
+        }
+        if (request > view_size)
+            request = view_size;
+        memcpy(stage + stage_fill, view, request);
+        stage_fill += request;
+        view += request;
+        view_size -= request;
+        view_consumed += request;
+        if (stage_fill == (ssize_t)sp_dst->transfer_size)
+        {
+            stage_fill = 0;
+            if (start_write(sp_dst, spaio, aio_count, aios_started,
+                            stage, sp_dst->transfer_size,
+                            file_write_offset) != 0)
                 break;
-            }
+            aios_started++;
+            file_write_offset += sp_dst->transfer_size;
+        }
+    }
+
+    /* write the staged tail, less any partial page */
+    if (sp_dst->error_code == 0 && stage_fill != 0)
+    {
+        stage = buf + (aios_started % aio_count) * sp_dst->transfer_size;
+        remainder_size = stage_fill % PAGE_SIZE;
+        request = stage_fill - remainder_size;
+        remainder_start = stage + request;
+        if (request != 0 &&
+            start_write(sp_dst, spaio, aio_count, aios_started,
+                        stage, request, file_write_offset) == 0)
+        {
+            aios_started++;
+            file_write_offset += request;
+        }
+    }
+    /* wait for all outstanding writes, even after an error */
+    while (aios_completed < aios_started)
+    {
+        if (wait_write_done(sp_dst, spaio, aio_count,
+                            &aios_completed, &tune) != 0)
             aios_completed++;
-        } while (eof && aios_completed < aios_started);
-        if (eof || sp_dst->error_code != 0)
-            break;
     }
+    if (view_consumed != 0)
+        sp_release_output(sp, out_index, view_consumed);
     if (sp_dst->error_code == 0 && remainder_size != 0)
     {
         TRACE("file_writer[%d]: writing remaining %"PTFlld" bytes at offset %"PTFlld"\n",
@@ -2316,6 +3926,8 @@ static void *file_writer_direct(void *arg)
         }
 #endif
     }
+    if (sp_dst->error_code == 0)
+        sync_written(sp_dst, 0, TRUE);
 #if defined(win_nt)
     /* truncate output file, since we didn't truncate it when we opened it. */
     high = (LONG)(file_write_offset >> 32);
@@ -2371,242 +3983,888 @@ static void *file_writer_direct(void *arg)
     return NULL;
 }
 
-#endif
 
+#if defined(SP_URING)
 
-/* sp_wait - can be called by an external thread, e.g. the thread that
- *           called sp_start(), to wait for all sump pump activity to cease.
- *
- * Returns: SP_OK or a sump pump error code
+/* uring_exit - internal routine to tear down an io_uring instance.
  */
-int sp_wait(sp_t sp)
+static void uring_exit(struct sp_uring *ur)
 {
-    unsigned    i;
-    int         ret;
-
-    /* if already waited for this sump pump to complete */
-    if (sp->wait_done == TRUE)
-        return (sp->error_code);
-    if (sp->flags & SP_SORT)
-    {
-#if !defined(SUMP_PUMP_NO_SORT)
-        /* if the sort output is going to a file, and we haven't yet
-         * waited for it to complete.
-         */
-        if (sp->sort_state == SORT_OUTPUT && sp->out[0].file != NULL)
-        {
-            size_t  zero = 0;
-            
-            ret = (*Nsort_return_recs)(NULL, &zero, &sp->nsort_ctx);
-            if (ret != NSORT_END_OF_OUTPUT)
-                post_nsort_error(sp, ret);
-            sp->sort_state = SORT_DONE;
-        }
-#endif
-        pthread_mutex_lock(&sp->sump_mtx);
-        while (sp->error_code == 0 && sp->sort_state != SORT_DONE)
-        {
-            TRACE("sp_wait() condition wait");
-            pthread_cond_wait(&sp->task_output_ready_cond, &sp->sump_mtx);
-        }
-        pthread_mutex_unlock(&sp->sump_mtx);
-        return (sp->error_code);
-    }
-    else /* normal (non-sort) sump pump */
-    {
-        TRACE("waiting for input file reader\n");
-        if (sp->in_file_sp != NULL)
-        {
-            if ((ret = sp_file_wait(sp->in_file_sp)) != SP_OK)
-                return (sp->error_code == SP_OK ? ret : sp->error_code);
-        }
-        for (i = 0; i < sp->num_threads; i++)
-        {
-            TRACE("waiting for pump thread %d\n", i);
-            pthread_join(sp->thread[i], NULL);
-        }
-        for (i = 0; i < sp->num_outputs; i++)
-        {
-            if (sp->out[i].file_sp != NULL)
-            {
-                TRACE("waiting for output %d thread\n", i);
-                if ((ret = sp_file_wait(sp->out[i].file_sp)) != SP_OK)
-                    return (sp->error_code == SP_OK ? ret : sp->error_code);
-            }
-        }
-    }
-    sp->wait_done = TRUE;
-    return (sp->error_code);
+    if (ur->sqes != NULL && ur->sqes != MAP_FAILED)
+        munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_ring != NULL && ur->cq_ring != MAP_FAILED)
+        munmap(ur->cq_ring, ur->cq_ring_size);
+    if (ur->sq_ring != NULL && ur->sq_ring != MAP_FAILED)
+        munmap(ur->sq_ring, ur->sq_ring_size);
+    if (ur->fd >= 0)
+        close(ur->fd);
 }
 
 
-/* syntax error - internal routine to internally record a syntax error
- *                message for possible later retrieval.
+/* uring_init - internal routine to set up an io_uring instance with at
+ *              least the specified number of entries.
+ *
+ * Returns: 0 on success, or -1 if io_uring is not available.
  */
-static void syntax_error(sp_t sp, char *p, char *err_msg)
+static int uring_init(struct sp_uring *ur, unsigned entries)
 {
-    int         ret;
-    const char  *fmt = "syntax error: %s at: \"%s\"\n";
-
-    if (sp->error_code != 0)          /* if prior error */
-        return;                       /* ignore this one */
-    sp->error_code = SP_SYNTAX_ERROR;
-
-#if defined(win_nt)
-    ret = _snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
-    if (ret == -1)
-        ret = _scprintf(fmt, err_msg, p);
-#else
-    ret = snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
-#endif
-    if ((size_t)ret >= sp->error_buf_size)
-    {
-        if (sp->error_buf_size != 0)
-            free(sp->error_buf);
-        sp->error_buf_size = (size_t)ret + 1;
-        sp->error_buf = (char *)malloc(sp->error_buf_size);
-#if defined(win_nt)
-        _snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
-#else
-        snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
-#endif
+    struct io_uring_params      p;
+    char                        *sq;
+    char                        *cq;
+
+    memset(ur, 0, sizeof(*ur));
+    memset(&p, 0, sizeof(p));
+    ur->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ur->fd < 0)
+        return (-1);
+    ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ur->cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    ur->cq_ring = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+    ur->sqes = (struct io_uring_sqe *)
+        mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED ||
+        ur->sqes == MAP_FAILED)
+    {
+        uring_exit(ur);
+        return (-1);
     }
-    
-    return;
+    sq = (char *)ur->sq_ring;
+    cq = (char *)ur->cq_ring;
+    ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ur->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ur->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return (0);
 }
 
 
-/* get_numeric_arg - internal routine to convert an ascii number to int64_t
+/* uring_queue - internal routine to queue a read or write request.  The
+ *               caller never has more requests in flight than entries, so
+ *               the submission queue cannot be full.
  */
-static int64_t get_numeric_arg(sp_t sp, char **caller_p)
+static void uring_queue(struct sp_uring *ur, int opcode, int fd, void *addr,
+                        size_t len, int64_t offset, int fixed_index,
+                        unsigned user_data)
 {
-    int         negative = 0;
-    int64_t     result = 0;
-    char        *p = *caller_p;
-
-    if (*p == '-')
-    {
-        p++;
-        negative = 1;
-    }
-    if (*p < '0' || *p > '9')
-    {
-        syntax_error(sp, p, "expected numeric argument");
-        return 0;
-    }
-    while (*p >= '0' && *p <= '9')
-    {
-        result = result * 10 + (*p - '0');
-        p++;
-    }
-    *caller_p = p;
-    return (negative ? -result : result);
+    unsigned            tail = *ur->sq_tail;
+    unsigned            index = tail & ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->buf_index = (uint16_t)fixed_index;
+    sqe->user_data = user_data;
+    ur->sq_array[index] = index;
+    SP_MEMORY_BARRIER();
+    *ur->sq_tail = tail + 1;
+    ur->to_submit++;
 }
 
 
-/* get_scale - internal routine to convert 'k', 'm' of 'g' to a numeric value
+/* uring_enter - internal routine to submit the queued requests and, if
+ *               wait is set, wait for at least one completion.
+ *
+ * Returns: 0 on success, otherwise -1 with errno set.
  */
-static int64_t get_scale(char **caller_p)
+static int uring_enter(struct sp_uring *ur, int wait)
 {
-    char        *p = *caller_p;
-    int64_t     factor = 1;
+    int         ret;
 
-    if (*p == 'k' || *p == 'K')
-        factor = 1024;
-    else if (*p == 'm' || *p == 'M')
-        factor = 1024 * 1024;
-    else if (*p == 'g' || *p == 'G')
-        factor = 1024 * 1024 * 1024;
-    else
-        return (1);
-    *caller_p = p + 1;
-    return (factor);
+    for (;;)
+    {
+        ret = (int)syscall(__NR_io_uring_enter, ur->fd, ur->to_submit,
+                           wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                           NULL, 0);
+        if (ret >= 0)
+        {
+            ur->to_submit -= ret;
+            return (0);
+        }
+        if (errno != EINTR)
+            return (-1);
+    }
 }
 
 
-/* scan - internal routine to scan the sp_start() string for a keyword.
+/* uring_reap - internal routine to mark the requests of all available
+ *              completions done, in whatever order they completed.
  */
-static int scan(char *kw, char **dp)
+static void uring_reap(struct sp_uring *ur, struct sump_uring_io *ios)
 {
-    unsigned char       *kp;
-    unsigned char       *p;
-
-    kp = (unsigned char *)kw;
-    p = *(unsigned char **)dp;
-    
-    /* while we haven't hit the end of the keyword or the end of the
-     * definition string, and
-     * there is a either a match in the current characters or the keyword
-     * string contains an '_' and if we skip over it the chars match.
-     */
-    while (*kp != '\0' &&
-           *p != '\0' &&
-           (toupper(*kp) == toupper(*p) ||
-            (*kp == '_' && (kp++, toupper(*kp) == toupper(*p)))))
-    {
-        /* go on to next characters in each string */
-        kp++;
-        p++;
-    }
+    unsigned            head = *ur->cq_head;
+    unsigned            tail = *ur->cq_tail;
+    struct io_uring_cqe *cqe;
 
-    /* there was a match if we got to the end of the keyword string and
-     * either the last character of the keyword was '=' or the ending
-     * definition string character is not alphabetic nor underscore
-     */
-    if (*kp == '\0' &&
-        (*(kp - 1) == '=' ||
-         !((toupper(*p) >= 'A' && toupper(*p) <= 'Z') || *p == '_')))
+    SP_MEMORY_BARRIER();
+    for ( ; head != tail; head++)
     {
-        /* update definition pointer */
-        *dp = (char *)p;
-        return TRUE;
+        cqe = &ur->cqes[head & ur->cq_mask];
+        ios[cqe->user_data].result = cqe->res;
+        ios[cqe->user_data].done = TRUE;
     }
-    else
-        return FALSE;
+    SP_MEMORY_BARRIER();
+    *ur->cq_head = head;
 }
 
 
-/* get_file_mods - internal routine to get file name modifiers,
- *                 e.g. access mode and transfer size.
+/* file_reader_uring - main routine for a ,URING file reader thread.  Direct
+ *                     reads of the sump pump input buffers are kept queued
+ *                     in an io_uring up to the ,COUNT depth, and retired in
+ *                     file order as they complete in any order.  When the
+ *                     input buffer memory stays put for the life of the
+ *                     sump pump, the buffers are registered with the
+ *                     io_uring as they are first used.  Falls back to
+ *                     file_reader_direct() if io_uring is not available.
  */
-static void get_file_mods(sp_file_t spf, char *mods)
+static void *file_reader_uring(void *arg)
 {
-    char        *p = mods;
-
-    for (;;)
+    sp_file_t           sp_src = (sp_file_t)arg;
+    sp_t                sp = sp_src->sp;
+    struct sp_uring     ur;
+    struct sump_uring_io *ios;
+    struct sump_uring_io *io;
+    unsigned            count;
+    uint64_t            issued = 0;
+    uint64_t            retired = 0;
+    uint64_t            next_in_buf = 0;
+    uint64_t            bufs_put = 0;
+    size_t              next_buf_offset = 0;
+    int64_t             file_read_offset = 0;
+    char                *buf = NULL;
+    size_t              in_buf_size = 0;
+    size_t              request;
+    size_t              size;
+    int                 eof = FALSE;
+    int                 stop = FALSE;
+    char                err_buf[200];
+    unsigned            num_fixed = 0;
+    char                **fixed_buf = NULL;
+    size_t              *fixed_size = NULL;
+    unsigned            slot;
+    struct iovec        iov;
+    struct io_uring_rsrc_register   reg;
+    struct io_uring_rsrc_update2    upd;
+
+    count = sp_src->aio_count <= 0 ? 2 : (unsigned)sp_src->aio_count;
+    if (uring_init(&ur, count) != 0)
+        return (file_reader_direct(arg));
+    if ((ios = (struct sump_uring_io *)
+         calloc(count, sizeof(struct sump_uring_io))) == NULL)
     {
-        while (*p == ',')
-            p++;
-        if (*p == '\0')
-            break;
-        else if (scan("BUFFERED", &p) || scan("BUF", &p))
-        {
-            spf->mode = MODE_BUFFERED;
-        }
-        else if (scan("DIRECT", &p) || scan("DIR", &p))
+        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
+                       "%s: io_uring request malloc failure, size %d\n",
+                       sp_src->fname, (int)count);
+        uring_exit(&ur);
+        return (NULL);
+    }
+    if (sp->memory == 0 && sp->buf_pool == NULL && !sp->elastic)
+    {
+        num_fixed = sp->num_in_bufs;
+        fixed_buf = (char **)calloc(num_fixed, sizeof(char *));
+        fixed_size = (size_t *)calloc(num_fixed, sizeof(size_t));
+        memset(&reg, 0, sizeof(reg));
+        reg.nr = num_fixed;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (fixed_buf == NULL || fixed_size == NULL ||
+            syscall(__NR_io_uring_register, ur.fd, IORING_REGISTER_BUFFERS2,
+                    &reg, sizeof(reg)) != 0)
         {
-            spf->mode = MODE_DIRECT;
+            num_fixed = 0;
         }
-        else if (scan("COUNT", &p) || scan("CO", &p))
+    }
+
+    for (;;)
+    {
+        /* queue reads while there are free requests and the next read's
+         * input buffer is within the ring of input buffers.
+         */
+        while (!eof && !stop && issued - retired < count &&
+               (next_buf_offset != 0 ||
+                next_in_buf < bufs_put + sp->num_in_bufs))
         {
-            if (*p != ':' && *p != '=')
+            if (next_buf_offset == 0)
             {
-                syntax_error(spf->sp, p, "expected ':' or '=' after 'count'");
-                return;
+                /* let the queued reads proceed while waiting */
+                if (ur.to_submit != 0 && uring_enter(&ur, FALSE) != 0)
+                    break;
+                if (sp_get_in_buf(sp, next_in_buf,
+                                  (void **)&buf, &in_buf_size) != SP_OK)
+                {
+                    sp_raise_error(sp, SP_FILE_READ_ERROR,
+                                   "sp_get_in_buf() failure with in_buf %lld\n",
+                                   next_in_buf);
+                    stop = TRUE;
+                    break;
+                }
             }
-            p++;
-            spf->aio_count = (int)get_numeric_arg(spf->sp, &p);
-        }
-        else if (scan("TRANSFER", &p) || scan("TRANS", &p) || scan("TR", &p))
-        {
-            if (*p != ':' && *p != '=')
+            request = in_buf_size - next_buf_offset;
+            if (request > sp_src->transfer_size)
+                request = sp_src->transfer_size;
+            io = &ios[issued % count];
+            io->buf_index = next_in_buf;
+            io->buf_offset = next_buf_offset;
+            io->file_offset = file_read_offset;
+            io->nbytes = request;
+            io->last_buf_io = (next_buf_offset + request == in_buf_size);
+            io->done = FALSE;
+            slot = num_fixed != 0 ? (unsigned)(next_in_buf % num_fixed) : 0;
+            if (num_fixed != 0 &&
+                (fixed_buf[slot] != buf || fixed_size[slot] < in_buf_size))
+            {
+                iov.iov_base = buf;
+                iov.iov_len = in_buf_size;
+                memset(&upd, 0, sizeof(upd));
+                upd.offset = slot;
+                upd.data = (uint64_t)(uintptr_t)&iov;
+                upd.nr = 1;
+                if (syscall(__NR_io_uring_register, ur.fd,
+                            IORING_REGISTER_BUFFERS_UPDATE,
+                            &upd, sizeof(upd)) == 1)
+                {
+                    fixed_buf[slot] = buf;
+                    fixed_size[slot] = in_buf_size;
+                }
+                else
+                    num_fixed = 0;
+            }
+            TRACE("file_reader_uring: reading %d bytes at offset %"PTFlld"\n",
+                  (int)request, file_read_offset);
+            uring_queue(&ur, num_fixed != 0 ? IORING_OP_READ_FIXED :
+                        IORING_OP_READ, sp_src->fd, buf + next_buf_offset,
+                        request, file_read_offset, (int)slot,
+                        (unsigned)(issued % count));
+            issued++;
+            file_read_offset += request;
+            next_buf_offset += request;
+            if (next_buf_offset == in_buf_size)
+            {
+                next_in_buf++;
+                next_buf_offset = 0;
+            }
+        }
+        if (issued == retired)
+            break;
+
+        if (!ios[retired % count].done)
+        {
+            if (uring_enter(&ur, TRUE) != 0)
+            {
+                /* without the completions the buffers can't be reused */
+                die("%s: io_uring_enter() failure: %s\n", sp_src->fname,
+                    strerror_r(errno, err_buf, sizeof(err_buf)));
+            }
+            uring_reap(&ur, ios);
+        }
+
+        /* retire the completed reads in file order */
+        while (retired < issued && (io = &ios[retired % count])->done)
+        {
+            retired++;
+            if (eof || stop)
+                continue;       /* read beyond eof, or after an error */
+            if (io->result < 0)
+            {
+                sp_src->error_code = SP_FILE_READ_ERROR;
+                sp_raise_error(sp, SP_FILE_READ_ERROR,
+                               "%s: io_uring read failure: %s, "
+                               "offset: %"PTFlld", size: %"PTFlld"\n",
+                               sp_src->fname,
+                               strerror_r((int)-io->result, err_buf,
+                                          sizeof(err_buf)),
+                               io->file_offset, (int64_t)io->nbytes);
+                stop = TRUE;
+                continue;
+            }
+            eof = ((size_t)io->result < io->nbytes);
+            size = io->buf_offset + (size_t)io->result;
+            if (eof || io->last_buf_io)
+            {
+                if (sp_put_in_buf_bytes(sp, io->buf_index, size, eof) != SP_OK)
+                    stop = TRUE;        /* silently quit on a downstream error */
+                bufs_put++;
+            }
+        }
+    }
+    uring_exit(&ur);
+    free(ios);
+    if (fixed_buf != NULL)
+        free(fixed_buf);
+    if (fixed_size != NULL)
+        free(fixed_size);
+    /*close(sp_src->fd);*/
+    sp_src->fd = INVALID_FD;
+    TRACE("file_reader_uring done: %d\n", sp_src->error_code);
+    return (NULL);
+}
+
+
+/* file_writer_uring - main routine for a ,URING file writer thread.  The
+ *                     sump pump output is read into a registered buffer of
+ *                     ,COUNT transfer size pieces, and each piece is reused
+ *                     as soon as its direct write completes, in whatever
+ *                     order the writes complete.  Falls back to
+ *                     file_writer_direct() if io_uring is not available.
+ */
+static void *file_writer_uring(void *arg)
+{
+    sp_file_t           sp_dst = (sp_file_t)arg;
+    sp_t                sp = sp_dst->sp;
+    int                 out_index = sp_dst->out_index;
+    struct sp_uring     ur;
+    struct sump_uring_io *ios;
+    struct sump_uring_io *io;
+    unsigned            *free_slots;
+    unsigned            num_free;
+    unsigned            count;
+    unsigned            slot;
+    unsigned            i;
+    char                *buf;
+    size_t              alloc_size;
+    ssize_t             request;
+    ssize_t             ret;
+    int64_t             file_write_offset = 0;
+    char                *remainder_start = NULL;
+    int64_t             remainder_size = 0;
+    int                 fixed;
+    int                 eof = FALSE;
+    char                err_buf[200];
+    struct iovec        iov;
+
+    count = sp_dst->aio_count <= 0 ? 2 : (unsigned)sp_dst->aio_count;
+    if (uring_init(&ur, count) != 0)
+        return (file_writer_direct(arg));
+    ios = (struct sump_uring_io *)calloc(count, sizeof(struct sump_uring_io));
+    free_slots = (unsigned *)calloc(count, sizeof(unsigned));
+    alloc_size = sp_dst->transfer_size * count;
+    init_zero_fd();
+    buf = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, Zero_fd, 0);
+    if (buf == MAP_FAILED)
+        buf = NULL;
+    if (ios == NULL || free_slots == NULL || buf == NULL)
+    {
+        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
+                       "%s: io_uring writer allocation failure\n",
+                       sp_dst->fname);
+        sp_dst->error_code = SP_MEM_ALLOC_ERROR;
+        eof = TRUE;
+        count = 0;
+    }
+    for (num_free = 0; num_free < count; num_free++)
+        free_slots[num_free] = count - 1 - num_free;
+    iov.iov_base = buf;
+    iov.iov_len = alloc_size;
+    fixed = buf != NULL &&
+        syscall(__NR_io_uring_register, ur.fd, IORING_REGISTER_BUFFERS,
+                &iov, 1) == 0;
+
+    for (;;)
+    {
+        /* fill and queue the free pieces of the buffer */
+        while (!eof && num_free != 0)
+        {
+            /* let the queued writes proceed while waiting for output */
+            if (ur.to_submit != 0 && uring_enter(&ur, FALSE) != 0)
+                break;
+            slot = free_slots[--num_free];
+            io = &ios[slot];
+            request = sp_read_output(sp, out_index,
+                                     buf + slot * sp_dst->transfer_size,
+                                     sp_dst->transfer_size);
+            if (request < 0)
+            {
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                free_slots[num_free++] = slot;
+                eof = TRUE;
+                break;
+            }
+            eof = (request < (ssize_t)sp_dst->transfer_size);
+            if (eof && (remainder_size = request % PAGE_SIZE) != 0)
+            {
+                request -= remainder_size;
+                remainder_start = buf + slot * sp_dst->transfer_size + request;
+            }
+            if (request == 0)
+            {
+                free_slots[num_free++] = slot;
+                continue;
+            }
+            TRACE("file_writer_uring[%d]: writing %"PTFlld" bytes at offset %"PTFlld"\n",
+                  out_index, (int64_t)request, file_write_offset);
+            io->file_offset = file_write_offset;
+            io->nbytes = request;
+            io->done = FALSE;
+            uring_queue(&ur, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+                        sp_dst->fd, buf + slot * sp_dst->transfer_size,
+                        request, file_write_offset, 0, slot);
+            file_write_offset += request;
+        }
+        if (num_free == count)
+            break;
+
+        if (uring_enter(&ur, TRUE) != 0)
+        {
+            /* without the completions the buffer can't be reused */
+            die("%s: io_uring_enter() failure: %s\n", sp_dst->fname,
+                strerror_r(errno, err_buf, sizeof(err_buf)));
+        }
+        uring_reap(&ur, ios);
+        for (i = 0; i < count; i++)
+        {
+            io = &ios[i];
+            if (!io->done)
+                continue;
+            io->done = FALSE;
+            free_slots[num_free++] = i;
+            if (io->result != (ssize_t)io->nbytes && sp_dst->error_code == 0)
+            {
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                               "%s: io_uring write failure: %s, "
+                               "offset: %"PTFlld", "
+                               "returned size %"PTFlld
+                               " != requested size: %"PTFlld"\n",
+                               sp_dst->fname,
+                               io->result < 0 ?
+                               strerror_r((int)-io->result, err_buf,
+                                          sizeof(err_buf)) : "short write",
+                               io->file_offset, (int64_t)io->result,
+                               (int64_t)io->nbytes);
+                eof = TRUE;
+            }
+            else if (io->result == (ssize_t)io->nbytes &&
+                     !sync_written(sp_dst, io->nbytes, FALSE))
+            {
+                eof = TRUE;
+            }
+        }
+    }
+    uring_exit(&ur);
+
+    if (sp_dst->error_code == 0 && remainder_size != 0)
+    {
+        TRACE("file_writer_uring[%d]: writing remaining %"PTFlld" bytes at offset %"PTFlld"\n",
+              out_index, (int64_t)remainder_size, file_write_offset);
+        /* close file descriptor that was opened with O_DIRECT */
+        close(sp_dst->fd);
+        /* reopen file without O_DIRECT */
+        if ((sp_dst->fd = open(sp_dst->fname, O_WRONLY, 0777)) < 0)
+        {
+            sp_dst->error_code = SP_FILE_WRITE_ERROR;
+            sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                           "%s: remainder open() return failure: %s\n",
+                           sp_dst->fname,
+                           strerror_r(errno, err_buf, sizeof(err_buf)));
+        }
+        else
+        {
+            ret = pwrite(sp_dst->fd, remainder_start,
+                         remainder_size, file_write_offset);
+            if (ret != remainder_size)
+            {
+                sp_dst->error_code = SP_FILE_WRITE_ERROR;
+                sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                               "%s: pwrite() return failure: %s, "
+                               "offset: %lld, "
+                               "returned size %d != requested size: %lld\n",
+                               sp_dst->fname,
+                               strerror_r(errno, err_buf, sizeof(err_buf)),
+                               file_write_offset, (int)ret, remainder_size);
+            }
+            else
+                file_write_offset += remainder_size;
+        }
+    }
+    if (sp_dst->error_code == 0 && sp_dst->fd >= 0)
+        sync_written(sp_dst, 0, TRUE);
+    if (sp_dst->fd >= 0 && ftruncate(sp_dst->fd, file_write_offset))
+    {
+        sp_raise_error(sp, SP_FILE_WRITE_ERROR,
+                       "%s: ftruncate() failure: %s\n",
+                       sp_dst->fname,
+                       get_error_msg(0, err_buf, sizeof(err_buf)));
+        sp_dst->error_code = SP_FILE_WRITE_ERROR;
+    }
+    if (buf != NULL)
+        munmap(buf, alloc_size);
+    if (ios != NULL)
+        free(ios);
+    if (free_slots != NULL)
+        free(free_slots);
+    /*close(sp_dst->fd);*/
+    sp_dst->fd = INVALID_FD;
+    TRACE("file_writer_uring[%d] done: %d\n", out_index, sp_dst->error_code);
+    return (NULL);
+}
+#endif
+
+#endif
+
+
+/* executor_wait - internal routine to wait until the -EXECUTOR workers
+ *                 have run all the tasks of a sump pump, or it has an
+ *                 error and they are no longer running its tasks, then
+ *                 remove the pump from the executor.
+ */
+static void executor_wait(sp_t sp)
+{
+    struct executor     *ex = sp->executor;
+    sp_t                *pp;
+    int                 seq;
+    int                 input_eof;
+
+    for (;;)
+    {
+        seq = park_prepare(&sp->ex_done_park);
+        pthread_mutex_lock(&ex->mtx);
+        for (pp = &ex->pumps; *pp != NULL && *pp != sp; pp = &(*pp)->ex_next)
+            continue;
+        if (*pp == NULL)        /* already removed */
+        {
+            pthread_mutex_unlock(&ex->mtx);
+            return;
+        }
+        if (sp->ex_running == 0)
+        {
+            input_eof = sp->input_eof;
+            SP_MEMORY_BARRIER();
+            if (sp->error_code != 0 ||
+                (sp->cnt_task_begun == sp->cnt_task_init && input_eof))
+            {
+                if (!sp->ex_done)
+                {
+                    sp->ex_done = TRUE;
+                    ex->num_idle_pumps--;
+                }
+                *pp = sp->ex_next;
+                pthread_mutex_unlock(&ex->mtx);
+                return;
+            }
+        }
+        pthread_mutex_unlock(&ex->mtx);
+        park_wait(&sp->ex_done_park, seq);
+    }
+}
+
+
+/* sp_wait - can be called by an external thread, e.g. the thread that
+ *           called sp_start(), to wait for all sump pump activity to cease.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_wait(sp_t sp)
+{
+    unsigned    i;
+    int         ret;
+
+    /* if already waited for this sump pump to complete */
+    if (sp->wait_done == TRUE)
+        return (sp->error_code);
+    if (sp->flags & SP_SORT)
+    {
+#if !defined(SUMP_PUMP_NO_SORT)
+        /* if the sort output is going to a file, and we haven't yet
+         * waited for it to complete.
+         */
+        if (sp->sort_state == SORT_OUTPUT && sp->out[0].file != NULL)
+        {
+            size_t  zero = 0;
+            
+            ret = (*Nsort_return_recs)(NULL, &zero, &sp->nsort_ctx);
+            if (ret != NSORT_END_OF_OUTPUT)
+                post_nsort_error(sp, ret);
+            sp->sort_state = SORT_DONE;
+        }
+#endif
+        pthread_mutex_lock(&sp->sump_mtx);
+        while (sp->error_code == 0 && sp->sort_state != SORT_DONE)
+        {
+            TRACE("sp_wait() condition wait");
+            pthread_cond_wait(&sp->task_output_ready_cond, &sp->sump_mtx);
+        }
+        pthread_mutex_unlock(&sp->sump_mtx);
+        return (sp->error_code);
+    }
+    else /* normal (non-sort) sump pump */
+    {
+        TRACE("waiting for input file reader\n");
+        if (sp->in_file_sp != NULL)
+        {
+            if ((ret = sp_file_wait(sp->in_file_sp)) != SP_OK)
+                return (sp->error_code == SP_OK ? ret : sp->error_code);
+        }
+        if (sp->executor != NULL)
+            executor_wait(sp);
+        else
+        {
+            for (i = 0; i < sp->num_threads; i++)
+            {
+                TRACE("waiting for pump thread %d\n", i);
+                pthread_join(sp->thread[i], NULL);
+            }
+        }
+        for (i = 0; i < sp->num_outputs; i++)
+        {
+            if (sp->out[i].file_sp != NULL)
+            {
+                TRACE("waiting for output %d thread\n", i);
+                if ((ret = sp_file_wait(sp->out[i].file_sp)) != SP_OK)
+                    return (sp->error_code == SP_OK ? ret : sp->error_code);
+            }
+        }
+    }
+    sp->wait_done = TRUE;
+    return (sp->error_code);
+}
+
+
+/* syntax error - internal routine to internally record a syntax error
+ *                message for possible later retrieval.
+ */
+static void syntax_error(sp_t sp, char *p, char *err_msg)
+{
+    int         ret;
+    const char  *fmt = "syntax error: %s at: \"%s\"\n";
+
+    if (sp->error_code != 0)          /* if prior error */
+        return;                       /* ignore this one */
+    sp->error_code = SP_SYNTAX_ERROR;
+
+#if defined(win_nt)
+    ret = _snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
+    if (ret == -1)
+        ret = _scprintf(fmt, err_msg, p);
+#else
+    ret = snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
+#endif
+    if ((size_t)ret >= sp->error_buf_size)
+    {
+        if (sp->error_buf_size != 0)
+            free(sp->error_buf);
+        sp->error_buf_size = (size_t)ret + 1;
+        sp->error_buf = (char *)malloc(sp->error_buf_size);
+#if defined(win_nt)
+        _snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
+#else
+        snprintf(sp->error_buf, sp->error_buf_size, fmt, err_msg, p);
+#endif
+    }
+    
+    return;
+}
+
+
+/* get_numeric_arg - internal routine to convert an ascii number to int64_t
+ */
+static int64_t get_numeric_arg(sp_t sp, char **caller_p)
+{
+    int         negative = 0;
+    int64_t     result = 0;
+    char        *p = *caller_p;
+
+    if (*p == '-')
+    {
+        p++;
+        negative = 1;
+    }
+    if (*p < '0' || *p > '9')
+    {
+        syntax_error(sp, p, "expected numeric argument");
+        return 0;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        result = result * 10 + (*p - '0');
+        p++;
+    }
+    *caller_p = p;
+    return (negative ? -result : result);
+}
+
+
+/* get_scale - internal routine to convert 'k', 'm' of 'g' to a numeric value
+ */
+static int64_t get_scale(char **caller_p)
+{
+    char        *p = *caller_p;
+    int64_t     factor = 1;
+
+    if (*p == 'k' || *p == 'K')
+        factor = 1024;
+    else if (*p == 'm' || *p == 'M')
+        factor = 1024 * 1024;
+    else if (*p == 'g' || *p == 'G')
+        factor = 1024 * 1024 * 1024;
+    else
+        return (1);
+    *caller_p = p + 1;
+    return (factor);
+}
+
+
+/* scan - internal routine to scan the sp_start() string for a keyword.
+ */
+static int scan(char *kw, char **dp)
+{
+    unsigned char       *kp;
+    unsigned char       *p;
+
+    kp = (unsigned char *)kw;
+    p = *(unsigned char **)dp;
+    
+    /* while we haven't hit the end of the keyword or the end of the
+     * definition string, and
+     * there is a either a match in the current characters or the keyword
+     * string contains an '_' and if we skip over it the chars match.
+     */
+    while (*kp != '\0' &&
+           *p != '\0' &&
+           (toupper(*kp) == toupper(*p) ||
+            (*kp == '_' && (kp++, toupper(*kp) == toupper(*p)))))
+    {
+        /* go on to next characters in each string */
+        kp++;
+        p++;
+    }
+
+    /* there was a match if we got to the end of the keyword string and
+     * either the last character of the keyword was '=' or the ending
+     * definition string character is not alphabetic nor underscore
+     */
+    if (*kp == '\0' &&
+        (*(kp - 1) == '=' ||
+         !((toupper(*p) >= 'A' && toupper(*p) <= 'Z') || *p == '_')))
+    {
+        /* update definition pointer */
+        *dp = (char *)p;
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
+
+
+/* get_file_mods - internal routine to get file name modifiers,
+ *                 e.g. access mode and transfer size.
+ */
+static void get_file_mods(sp_file_t spf, char *mods)
+{
+    char        *p = mods;
+
+    for (;;)
+    {
+        while (*p == ',')
+            p++;
+        if (*p == '\0')
+            break;
+        else if (scan("BUFFERED", &p) || scan("BUF", &p))
+        {
+            spf->mode = MODE_BUFFERED;
+        }
+        else if (scan("DIRECT", &p) || scan("DIR", &p))
+        {
+            spf->mode = MODE_DIRECT;
+        }
+        else if (scan("MMAP", &p))
+        {
+            spf->mode = MODE_MMAP;
+        }
+        else if (scan("READERS", &p))
+        {
+            if (*p != ':' && *p != '=')
+            {
+                syntax_error(spf->sp, p, "expected ':' or '=' after 'readers'");
+                return;
+            }
+            p++;
+            spf->num_readers = (int)get_numeric_arg(spf->sp, &p);
+        }
+        else if (scan("WRITERS", &p))
+        {
+            if (*p != ':' && *p != '=')
+            {
+                syntax_error(spf->sp, p, "expected ':' or '=' after 'writers'");
+                return;
+            }
+            p++;
+            spf->num_writers = (int)get_numeric_arg(spf->sp, &p);
+        }
+        else if (scan("URING", &p))
+        {
+            spf->mode = MODE_DIRECT;
+            spf->uring = TRUE;
+        }
+        else if (scan("COUNT", &p) || scan("CO", &p))
+        {
+            if (*p != ':' && *p != '=')
+            {
+                syntax_error(spf->sp, p, "expected ':' or '=' after 'count'");
+                return;
+            }
+            p++;
+            if (scan("AUTO", &p))
+                spf->auto_count = TRUE;
+            else
+                spf->aio_count = (int)get_numeric_arg(spf->sp, &p);
+        }
+        else if (scan("TRANSFER", &p) || scan("TRANS", &p) || scan("TR", &p))
+        {
+            if (*p != ':' && *p != '=')
             {
                 syntax_error(spf->sp, p, "expected ':' of '='");
                 return;
             }
             p++;
-            spf->transfer_size = (size_t)get_numeric_arg(spf->sp, &p);
-            spf->transfer_size *= (size_t)get_scale(&p);
+            if (scan("AUTO", &p))
+                spf->auto_transfer = TRUE;
+            else
+            {
+                spf->transfer_size = (size_t)get_numeric_arg(spf->sp, &p);
+                spf->transfer_size *= (size_t)get_scale(&p);
+            }
+        }
+        else if (scan("SYNC", &p))
+        {
+            spf->sync = TRUE;
+            if (*p == ':' || *p == '=')
+            {
+                p++;
+                spf->sync_size = (size_t)get_numeric_arg(spf->sp, &p);
+                spf->sync_size *= (size_t)get_scale(&p);
+            }
+        }
+        else if (scan("CACHE", &p))
+        {
+            if (*p != ':' && *p != '=')
+            {
+                syntax_error(spf->sp, p, "expected ':' or '=' after 'cache'");
+                return;
+            }
+            p++;
+            if (scan("KEEP", &p))
+                spf->cache = CACHE_KEEP;
+            else if (scan("SEQUENTIAL", &p) || scan("SEQ", &p))
+                spf->cache = CACHE_SEQUENTIAL;
+            else if (scan("DROP", &p))
+                spf->cache = CACHE_DROP;
+            else
+            {
+                syntax_error(spf->sp, p,
+                             "expected 'keep', 'sequential' or 'drop'");
+                return;
+            }
         }
         else
         {
@@ -2617,6 +4875,158 @@ static void get_file_mods(sp_file_t spf, char *mods)
 }
 
 
+/* out_file_direct - internal routine to tell whether the output file of
+ *                   the specified output will be written in direct mode,
+ *                   whether by its modifiers or by default.  This is known
+ *                   before the file is opened, so its output buffers can
+ *                   be allocated to suit.
+ */
+static int out_file_direct(sp_t sp, unsigned index)
+{
+    struct sp_file      spf;
+    char                *fname = sp->out[index].file;
+    char                *comma_char;
+    int                 mode;
+
+    if (fname == NULL ||
+        strncmp(fname, "<stdout>", 8) == 0 ||
+        strncmp(fname, "<stderr>", 8) == 0)
+    {
+        return (FALSE);
+    }
+    memset(&spf, 0, sizeof(spf));
+    spf.sp = sp;
+    if ((comma_char = strchr(fname, ',')) != NULL)
+        get_file_mods(&spf, comma_char + 1);
+    mode = spf.mode;
+    if (spf.num_writers > 1 && mode == MODE_UNSPECIFIED)
+        mode = MODE_BUFFERED;
+    if (mode == MODE_UNSPECIFIED)
+    {
+#if !defined(win_nt)
+        struct stat     buf;
+        char            *name;
+
+        /* only a normal file, or one that is yet to be created, defaults
+         * to direct mode.
+         */
+        if ((name = strdup(fname)) != NULL)
+        {
+            if ((comma_char = strchr(name, ',')) != NULL)
+                *comma_char = '\0';
+            if (stat(name, &buf) == 0 && !S_ISREG(buf.st_mode))
+                mode = MODE_BUFFERED;
+            free(name);
+        }
+#endif
+        if (mode == MODE_UNSPECIFIED)
+            mode = Default_file_mode;
+    }
+    return (mode == MODE_DIRECT);
+}
+
+
+#if defined(__linux__)
+/* get_queue_limit - internal routine to get a request queue limit, e.g.
+ *                   "max_sectors_kb", of the block device holding a file.
+ *
+ * Returns: the limit, or 0 if it is not known.
+ */
+static long get_queue_limit(sp_file_t spf, const char *name)
+{
+    struct stat buf;
+    FILE        *fp;
+    char        path[200];
+    long        limit = 0;
+
+    if (fstat(spf->fd, &buf) != 0)
+        return (0);
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/%s",
+             major(buf.st_dev), minor(buf.st_dev), name);
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        /* a partition has the queue of its whole device */
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/%s",
+                 major(buf.st_dev), minor(buf.st_dev), name);
+        fp = fopen(path, "r");
+    }
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%ld", &limit) != 1 || limit < 0)
+            limit = 0;
+        fclose(fp);
+    }
+    return (limit);
+}
+#endif
+
+
+/* auto_transfer_size - internal routine to pick the request size of a
+ *                      ,TRANSFER=AUTO file.  Direct requests are sized to
+ *                      the largest request the device takes, while normal
+ *                      requests are at least the default size.  Either is
+ *                      a multiple of the file's preferred block size and,
+ *                      if given, is reduced to a divisor of the multiple.
+ *
+ * Returns: the request size.
+ */
+static size_t auto_transfer_size(sp_file_t spf, size_t default_size,
+                                 size_t multiple)
+{
+    size_t      size = default_size;
+#if !defined(win_nt)
+    struct stat buf;
+    long        limit;
+
+# if defined(__linux__)
+    if (spf->mode == MODE_DIRECT &&
+        (limit = get_queue_limit(spf, "max_sectors_kb")) > 0)
+    {
+        size = (size_t)limit * 1024;
+    }
+# endif
+    if (fstat(spf->fd, &buf) == 0 && buf.st_blksize > 0)
+    {
+        limit = (long)buf.st_blksize;
+        if (spf->mode != MODE_DIRECT && size < (size_t)limit)
+            size = (size_t)limit;
+        size += (limit - size % limit) % limit;
+    }
+#endif
+    size += (PAGE_SIZE - size % PAGE_SIZE) % PAGE_SIZE;
+    if (size > AUTO_TRANSFER_MAX)
+        size = AUTO_TRANSFER_MAX;
+    if (multiple != 0 && multiple % PAGE_SIZE == 0)
+    {
+        while (multiple % size != 0)
+            size -= PAGE_SIZE;
+    }
+    TRACE("auto_transfer_size: %s: %d\n", spf->fname, (int)size);
+    return (size);
+}
+
+
+/* auto_aio_count - internal routine to pick the max number of outstanding
+ *                  requests of a ,COUNT=AUTO file from the request queue
+ *                  of its device.  The number actually kept outstanding is
+ *                  tuned as the file is read or written.
+ *
+ * Returns: the max number of outstanding requests.
+ */
+static int auto_aio_count(sp_file_t spf)
+{
+    int         count = AUTO_COUNT_MAX;
+#if defined(__linux__)
+    long        limit;
+
+    if ((limit = get_queue_limit(spf, "nr_requests")) > 0 && limit < count)
+        count = (int)limit;
+#endif
+    TRACE("auto_aio_count: %s: %d\n", spf->fname, count);
+    return (count);
+}
+
+
 /* sp_open_file_src - use the specified file as the input for the
  *                    specified sump pump.
  *
@@ -2628,13 +5038,45 @@ static void get_file_mods(sp_file_t spf, char *mods)
  *                                      buffered (not direct) reads.
  *                    ,DIRECT or ,DIR   The file will be read with direct
  *                                      and asynchronous reads.
+ *                    ,MMAP             The file will be memory mapped, and
+ *                                      windows of the mapping given to the
+ *                                      sump pump tasks as input buffers
+ *                                      without copying.  The file must not
+ *                                      be truncated while it is read: a
+ *                                      task touching a page past the new
+ *                                      end of the file gets a SIGBUS.
+ *                    ,URING            The file will be read with direct
+ *                                      reads through io_uring where
+ *                                      available (otherwise as ,DIRECT),
+ *                                      completing in any order, so that
+ *                                      one thread can keep ,COUNT reads
+ *                                      queued.
+ *                    ,READERS=%d       The file will be read with normal
+ *                                      reads by this many threads, each
+ *                                      reading the whole range of the next
+ *                                      input buffer with pread(), so that
+ *                                      reading a cached file scales with
+ *                                      cpus.  Implies ,BUFFERED unless
+ *                                      another mode is given.
+ *                    ,CACHE=KEEP, ,CACHE=SEQUENTIAL or ,CACHE=DROP
+ *                                      The page cache policy of normal
+ *                                      reads: none (the default), advise
+ *                                      sequential access, or also drop the
+ *                                      pages of the file from the cache
+ *                                      once they have been read.
  *                    ,TRANSFER=%d{k,m,g} or ,TRANS=%d{k,m,g} or ,TR=%d{k,m,g}
  *                                      The transfer size (read request size)
  *                                      is specified in kilo, mega or giga
- *                                      bytes.
+ *                                      bytes.  If AUTO, it is picked from
+ *                                      the file's block size and the
+ *                                      largest request of its device.
  *                    ,COUNT=%d or ,CO=%d  The count of the maximum number of
  *                                      outstanding asynchronous read requests
- *                                      is given.
+ *                                      is given.  If AUTO, the maximum is
+ *                                      picked from the request queue of the
+ *                                      device, and the number outstanding
+ *                                      is tuned to the measured rate of
+ *                                      completions during the run.
  *                    Example:
  *                       myfilename,dir,trans=4m,co=4
  *                                      The above example specifies a file
@@ -2655,432 +5097,1232 @@ sp_file_t sp_open_file_src(sp_t sp, const char *fname_mods)
     void        *(*reader_main)(void *);
     int         is_stdin;
     int         specified_mode;
+    size_t      max_count;
+
+    if ((sp_src = (sp_file_t)calloc(1, sizeof(struct sp_file))) == NULL)
+        return (NULL);
+    sp_src->sp = sp;
+
+    comma_char = strchr(fname_mods, ',');
+    fname_len = (int)
+        (comma_char == NULL ? strlen(fname_mods) : comma_char - fname_mods);
+    sp_src->fname = (char *)calloc(1, fname_len + 1);
+    memcpy(sp_src->fname, fname_mods, fname_len);
+    sp_src->fname[fname_len] = '\0';
+    if (comma_char != NULL)
+        get_file_mods(sp_src, comma_char + 1);
+    
+    /* parallel range readers read with pread(), not direct requests */
+    if (sp_src->num_readers > 1 && sp_src->mode == MODE_UNSPECIFIED)
+        sp_src->mode = MODE_BUFFERED;
+    specified_mode = sp_src->mode;
+    is_stdin = (strcmp(sp_src->fname, "<stdin>") == 0);
+#if defined(win_nt)
+    if (is_stdin)
+    {
+        sp_src->fd = GetStdHandle(STD_INPUT_HANDLE);
+        if (sp_src->transfer_size == 0)
+            /* there is a read size limit for keyboard input, but is this it?*/
+            sp_src->transfer_size = 8192;
+        sp_src->mode = MODE_BUFFERED;
+    }
+    else
+    {
+        sp_src->fd = CreateFile(sp_src->fname,
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                NULL,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                NULL);
+        if (sp_src->fd == INVALID_HANDLE_VALUE)
+            return (NULL);
+        sp_src->can_seek = (GetFileType(sp_src->fd) == FILE_TYPE_DISK);
+    }
+#else
+    if (is_stdin)
+    {
+        sp_src->fd = 0;
+        sp_src->mode = MODE_BUFFERED;
+    }        
+    else
+    {
+        struct stat     buf;
+        
+        sp_src->fd = open(sp_src->fname, 0);
+        if (sp_src->fd < 0)
+            return (NULL);
+        if (fstat(sp_src->fd, &buf) != 0)
+            return (NULL);
+        sp_src->can_seek = S_ISREG(buf.st_mode);
+    }
+#endif
+
+    /* if direct mode was specified, but it is not a file */
+    if (specified_mode == MODE_DIRECT && !sp_src->can_seek)
+    {
+        start_error(sp, "direct mode reads were requested for file %s, but it"
+                    " is either not a normal file or stdin\n", sp_src->fname);
+        return (NULL);
+    }
+
+    if (sp_src->mode == MODE_UNSPECIFIED)
+        sp_src->mode = sp_src->can_seek ? Default_file_mode : MODE_BUFFERED;
+
+    if (sp_src->mode == MODE_MMAP)
+    {
+        if (!sp_src->can_seek)
+        {
+            start_error(sp, "mmap mode reads were requested for file %s, but "
+                        "it is either not a normal file or stdin\n",
+                        sp_src->fname);
+            return (NULL);
+        }
+        if (sp->flags & SP_SORT)
+        {
+            start_error(sp, "mmap mode reads were requested for file %s, but "
+                        "the sump pump is a sort\n", sp_src->fname);
+            return (NULL);
+        }
+#if defined(win_nt)
+        sp_src->mode = MODE_BUFFERED;
+#endif
+    }
+
+    /* aligned input buffers can't be read ahead since the beginning of
+     * each buffer depends on the end of the previous one.
+     */
+    if (sp->align_in_bufs && sp_src->mode == MODE_DIRECT)
+    {
+        if (specified_mode == MODE_DIRECT)
+        {
+            start_error(sp, "direct mode reads were requested for file %s, "
+                        "but -ALIGN_IN_BUFS was specified\n", sp_src->fname);
+            return (NULL);
+        }
+        sp_src->mode = MODE_BUFFERED;
+    }
+
+    /* if file mode is direct (whether by specification or default)
+     */
+    if (sp_src->mode == MODE_DIRECT)
+    {
+        /* if a transfer size has been specified that is not a multiple of the
+         * page size, then silently revert to buffered mode.
+         * We probably should instead stay with direct mode, allocate separate
+         * read buffers, and copy the data into the sump pump input buffers.
+         */
+        if (sp_src->transfer_size != 0 &&
+            sp_src->transfer_size % PAGE_SIZE != 0)
+        {
+            sp_src->mode = MODE_BUFFERED;
+            start_error(sp, "direct mode reads for file %s,"
+                        " but the specified transfer size is not a "
+                        "multiple of the page size\n", sp_src->fname);
+            return (NULL);
+        }
+        /* if transfer size has been set and the input buffer size is not a
+         * multiple of it, then default to buffered.  This is because the 
+         * input buffers are directly read into.
+         * We could use vectored reads to eliminate this restriction.
+         */
+        if (sp_src->transfer_size != 0 &&
+            sp->in_buf_size % sp_src->transfer_size != 0)
+        {
+            sp_src->mode = MODE_BUFFERED;
+            start_error(sp, "direct mode reads for file %s, but "
+                        "the sump pump input buffer size is not a multiple "
+                        "of the specified transfer size\n", sp_src->fname);
+            return (NULL);
+        }
+        /* if the input buffer size is not a multiple of the page size
+         */
+        if (sp->in_buf_size % PAGE_SIZE != 0)
+        {
+            /* flag error if direct was specified, otherwise use buffered */
+            if (specified_mode == MODE_DIRECT)
+            {
+                start_error(sp,
+                            "direct mode reads were specified for file %s, "
+                            "but the sump pump input buffer size is not a "
+                            "multiple of the page size\n", sp_src->fname);
+                return (NULL);
+            }
+            sp_src->mode = MODE_BUFFERED;
+        }
+    }
+
+#if !defined(win_nt)
+    if (sp_src->mode == MODE_MMAP)
+        reader_main = file_reader_mmap;
+    else
+#endif
+#if defined(AIO_CAPABLE)
+    if (sp_src->can_seek && sp_src->mode == MODE_DIRECT)
+    {
+        reader_main = file_reader_direct;
+# if defined(SP_URING)
+        if (sp_src->uring)
+            reader_main = file_reader_uring;
+# endif
+        if (sp_src->auto_transfer)
+            sp_src->transfer_size =
+                auto_transfer_size(sp_src, 512 * 1024, sp->in_buf_size);
+        if (sp_src->transfer_size == 0)
+            sp_src->transfer_size = 512 * 1024; /* probably should be larger
+                                                 * for Windows. */
+        if (sp_src->auto_count)
+            sp_src->aio_count = auto_aio_count(sp_src);
+        if (sp_src->aio_count == 0)
+            sp_src->aio_count = 4;
+        /* the reads can't get ahead of the input buffer ring */
+        max_count = (sp->num_in_bufs - 1) *
+            (sp->in_buf_size / sp_src->transfer_size);
+        if ((size_t)sp_src->aio_count > max_count)
+            sp_src->aio_count = max_count < 1 ? 1 : (int)max_count;
+
+        /* now close file and reopen it as direct */
+# if defined(win_nt)
+        CloseHandle(sp_src->fd);
+        sp_src->fd = CreateFile(sp_src->fname,
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                NULL,
+                                OPEN_EXISTING,
+                                FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                                NULL);
+        if (sp_src->fd == INVALID_HANDLE_VALUE)
+            return (NULL);
+# else
+        close(sp_src->fd);
+        sp_src->fd = open(sp_src->fname, O_DIRECT);
+        if (sp_src->fd < 0)
+            return (NULL);
+# endif
+    }
+    else
+#endif
+    {
+        if (Default_rw_test_size != 0)
+        {
+            /* test mode for some regression tests */
+            reader_main = file_reader_test;
+            sp_src->transfer_size = Default_rw_test_size;
+        }
+#if !defined(win_nt)
+        /* aligned input buffers must be filled one after another */
+        else if (sp_src->num_readers > 1 && sp_src->can_seek &&
+                 !sp->align_in_bufs)
+        {
+            reader_main = file_reader_ranges;
+        }
+#endif
+        else
+            reader_main = file_reader_buffered;
+        if (sp_src->auto_transfer && sp_src->can_seek &&
+            reader_main != file_reader_test)
+        {
+            sp_src->transfer_size =
+                auto_transfer_size(sp_src, DEFAULT_BUFFERED_TRANSFER_SIZE, 0);
+        }
+        if (sp_src->transfer_size == 0)
+        {
+            if (sp_src->can_seek)  /* if normal file */
+                sp_src->transfer_size = DEFAULT_BUFFERED_TRANSFER_SIZE;
+            else
+                sp_src->transfer_size = DEFAULT_PIPE_TRANSFER_SIZE;
+        }
+    }
+    
+    /* create reader thread */
+    if (create_thread(sp, &sp_src->thread, reader_main, sp_src, -1) != 0)
+        return (NULL);
+    return (sp_src);
+}
+
+
+/* sp_open_file_dst - use the specified file as the output for the
+ *                    specified output of the specified sump pump.
+ *
+ * Parameters:
+ *      sp -          sp_t identifier for which we are opening an output file.
+ *      out_index -   Integer indicating the sump pump output index.
+ *      fname_mods -  Name of the file, potentially followed by one or more
+ *                    of the following modifiers (with no intervening spaces):
+ *                    ,BUFFERED or ,BUF The file will be written with normal
+ *                                      buffered (not direct) writes.
+ *                    ,DIRECT or ,DIR   The file will be written with direct
+ *                                      and asynchronous writes.
+ *                    ,URING            The file will be written with direct
+ *                                      writes through io_uring where
+ *                                      available (otherwise as ,DIRECT),
+ *                                      completing in any order.
+ *                    ,WRITERS=%d       The file will be written with
+ *                                      pwrite() by this many threads, each
+ *                                      writing the output of a different
+ *                                      task at the offset that follows the
+ *                                      output of the tasks before it.  The
+ *                                      file is preallocated ahead of the
+ *                                      writes.  Implies ,BUFFERED unless
+ *                                      another mode is given.
+ *                    ,SYNC or ,SYNC=%d{k,m,g}
+ *                                      The written bytes are flushed to
+ *                                      stable storage with fdatasync()
+ *                                      each time this many bytes have been
+ *                                      written, and once after the last
+ *                                      write before the file is trimmed.
+ *                                      Without a size, only the final
+ *                                      flush is made.
+ *                    ,CACHE=KEEP, ,CACHE=SEQUENTIAL or ,CACHE=DROP
+ *                                      The page cache policy of normal
+ *                                      writes: none (the default), advise
+ *                                      sequential access, or also write
+ *                                      back the pages of the file behind
+ *                                      the writes and drop them from the
+ *                                      cache.
+ *                    ,TRANSFER=%d{k,m,g} or ,TRANS=%d{k,m,g} or ,TR=%d{k,m,g}
+ *                                      The transfer size (write request size)
+ *                                      is specified in kilo, mega or giga
+ *                                      bytes.  If AUTO, it is picked from
+ *                                      the file's block size and the
+ *                                      largest request of its device.
+ *                    ,COUNT=%d or ,CO=%d  The count of the maximum number of
+ *                                      outstanding asynchronous write requests
+ *                                      is given.  If AUTO, the maximum is
+ *                                      picked from the request queue of the
+ *                                      device, and the number outstanding
+ *                                      is tuned to the measured rate of
+ *                                      completions during the run.
+ *                    Example:
+ *                       myfilename,dir,trans=4m,co=4
+ *                                      The above example specifies a file
+ *                                      name of "myfilename", with direct
+ *                                      and asynchronous writes, with a
+ *                                      request size of 4 MB, and a maximum
+ *                                      of 4 outstanding asynchronous write
+ *                                      requests at any time.
+ *
+ * Returns: NULL if an error occurs in opening the file, otherwise
+ *          a valid sump pump file structure.
+ */
+sp_file_t sp_open_file_dst(sp_t sp, unsigned out_index, const char *fname_mods)
+{
+    sp_file_t           sp_dst;
+    int                 ret;
+    char                *comma_char;
+    int                 fname_len;
+    void                *(*writer_main)(void *);
+    int                 specified_mode;
 
-    if ((sp_src = (sp_file_t)calloc(1, sizeof(struct sp_file))) == NULL)
+    if ((sp_dst = (sp_file_t)calloc(1, sizeof(struct sp_file))) == NULL)
         return (NULL);
-    sp_src->sp = sp;
+    sp_dst->sp = sp;
 
     comma_char = strchr(fname_mods, ',');
     fname_len = (int)
         (comma_char == NULL ? strlen(fname_mods) : comma_char - fname_mods);
-    sp_src->fname = (char *)calloc(1, fname_len + 1);
-    memcpy(sp_src->fname, fname_mods, fname_len);
-    sp_src->fname[fname_len] = '\0';
+    sp_dst->fname = (char *)calloc(1, fname_len + 1);
+    memcpy(sp_dst->fname, fname_mods, fname_len);
+    sp_dst->fname[fname_len] = '\0';
     if (comma_char != NULL)
-        get_file_mods(sp_src, comma_char + 1);
-    
-    specified_mode = sp_src->mode;
-    is_stdin = (strcmp(sp_src->fname, "<stdin>") == 0);
+        get_file_mods(sp_dst, comma_char + 1);
+
+    /* parallel range writers write with pwrite(), not direct requests */
+    if (sp_dst->num_writers > 1 && sp_dst->mode == MODE_UNSPECIFIED)
+        sp_dst->mode = MODE_BUFFERED;
+    specified_mode = sp_dst->mode;
 #if defined(win_nt)
-    if (is_stdin)
-    {
-        sp_src->fd = GetStdHandle(STD_INPUT_HANDLE);
-        if (sp_src->transfer_size == 0)
-            /* there is a read size limit for keyboard input, but is this it?*/
-            sp_src->transfer_size = 8192;
-        sp_src->mode = MODE_BUFFERED;
-    }
+    if (strcmp(sp_dst->fname, "<stdout>") == 0)
+        sp_dst->fd = GetStdHandle(STD_OUTPUT_HANDLE);
+    else if (strcmp(sp_dst->fname, "<stderr>") == 0)
+        sp_dst->fd = GetStdHandle(STD_ERROR_HANDLE);
     else
     {
-        sp_src->fd = CreateFile(sp_src->fname,
-                                GENERIC_READ,
+        sp_dst->fd = CreateFile(sp_dst->fname,
+                                GENERIC_WRITE,
                                 FILE_SHARE_READ,
                                 NULL,
-                                OPEN_EXISTING,
+                                OPEN_ALWAYS,
                                 FILE_ATTRIBUTE_NORMAL,
                                 NULL);
-        if (sp_src->fd == INVALID_HANDLE_VALUE)
+        if (sp_dst->fd == INVALID_HANDLE_VALUE)
             return (NULL);
-        sp_src->can_seek = (GetFileType(sp_src->fd) == FILE_TYPE_DISK);
+        sp_dst->can_seek = (GetFileType(sp_dst->fd) == FILE_TYPE_DISK);
     }
 #else
-    if (is_stdin)
-    {
-        sp_src->fd = 0;
-        sp_src->mode = MODE_BUFFERED;
-    }        
+    if (strcmp(sp_dst->fname, "<stdout>") == 0)
+        sp_dst->fd = 1;
+    else if (strcmp(sp_dst->fname, "<stderr>") == 0)
+        sp_dst->fd = 2;
     else
     {
         struct stat     buf;
         
-        sp_src->fd = open(sp_src->fname, 0);
-        if (sp_src->fd < 0)
+        sp_dst->fd = open(sp_dst->fname, O_WRONLY | O_CREAT, 0777);
+        if (sp_dst->fd < 0)
             return (NULL);
-        if (fstat(sp_src->fd, &buf) != 0)
+        if (fstat(sp_dst->fd, &buf) != 0)
             return (NULL);
-        sp_src->can_seek = S_ISREG(buf.st_mode);
+        sp_dst->can_seek = S_ISREG(buf.st_mode);
     }
 #endif
 
-    /* if direct mode was specified, but it is not a file */
-    if (specified_mode == MODE_DIRECT && !sp_src->can_seek)
+    /* if direct mode was specified but file is not a normal file */
+    if (specified_mode == MODE_DIRECT && !sp_dst->can_seek)
     {
-        start_error(sp, "direct mode reads were requested for file %s, but it"
-                    " is either not a normal file or stdin\n", sp_src->fname);
+        start_error(sp, "direct mode writes were requested for file %s, but it"
+                    " is either not a file or stdout/stderr\n", sp_dst->fname);
         return (NULL);
     }
 
-    if (sp_src->mode == MODE_UNSPECIFIED)
-        sp_src->mode = sp_src->can_seek ? Default_file_mode : MODE_BUFFERED;
+    if (sp_dst->mode == MODE_UNSPECIFIED)
+        sp_dst->mode = sp_dst->can_seek ? Default_file_mode : MODE_BUFFERED;
 
     /* if file mode is direct (whether by specification or default)
      */
-    if (sp_src->mode == MODE_DIRECT)
+    if (sp_dst->mode == MODE_DIRECT)
     {
         /* if a transfer size has been specified that is not a multiple of the
          * page size, then silently revert to buffered mode.
          * We probably should instead stay with direct mode, allocate separate
          * read buffers, and copy the data into the sump pump input buffers.
          */
-        if (sp_src->transfer_size != 0 &&
-            sp_src->transfer_size % PAGE_SIZE != 0)
-        {
-            sp_src->mode = MODE_BUFFERED;
-            start_error(sp, "direct mode reads for file %s,"
-                        " but the specified transfer size is not a "
-                        "multiple of the page size\n", sp_src->fname);
-            return (NULL);
-        }
-        /* if transfer size has been set and the input buffer size is not a
-         * multiple of it, then default to buffered.  This is because the 
-         * input buffers are directly read into.
-         * We could use vectored reads to eliminate this restriction.
-         */
-        if (sp_src->transfer_size != 0 &&
-            sp->in_buf_size % sp_src->transfer_size != 0)
+        if (sp_dst->transfer_size != 0 &&
+            sp_dst->transfer_size % PAGE_SIZE != 0)
         {
-            sp_src->mode = MODE_BUFFERED;
-            start_error(sp, "direct mode reads for file %s, but "
-                        "the sump pump input buffer size is not a multiple "
-                        "of the specified transfer size\n", sp_src->fname);
+            sp_dst->mode = MODE_BUFFERED;
+            start_error(sp, "direct mode writes for file %s"
+                        ", but the transfer size is not a "
+                        "multiple of the page size\n", sp_dst->fname);
             return (NULL);
         }
-        /* if the input buffer size is not a multiple of the page size
-         */
-        if (sp->in_buf_size % PAGE_SIZE != 0)
-        {
-            /* flag error if direct was specified, otherwise use buffered */
-            if (specified_mode == MODE_DIRECT)
-            {
-                start_error(sp,
-                            "direct mode reads were specified for file %s, "
-                            "but the sump pump input buffer size is not a "
-                            "multiple of the page size\n", sp_src->fname);
-                return (NULL);
-            }
-            sp_src->mode = MODE_BUFFERED;
-        }
     }
 
 #if defined(AIO_CAPABLE)
-    if (sp_src->can_seek && sp_src->mode == MODE_DIRECT)
+    if (sp_dst->can_seek && sp_dst->mode == MODE_DIRECT)
     {
-        reader_main = file_reader_direct;
-        if (sp_src->transfer_size == 0)
-            sp_src->transfer_size = 512 * 1024; /* probably should be larger
-                                                 * for Windows. */
-        if (sp_src->aio_count == 0)
-            sp_src->aio_count = 4;
+        writer_main = file_writer_direct;
+# if defined(SP_URING)
+        if (sp_dst->uring)
+            writer_main = file_writer_uring;
+# endif
+        if (sp_dst->auto_transfer)
+            sp_dst->transfer_size = auto_transfer_size(sp_dst, 512 * 1024, 0);
+        if (sp_dst->transfer_size == 0)
+            sp_dst->transfer_size = 512 * 1024;
+        if (sp_dst->auto_count)
+            sp_dst->aio_count = auto_aio_count(sp_dst);
+        if (sp_dst->aio_count == 0)
+            sp_dst->aio_count = 4;
 
         /* now close file and reopen it as direct */
 # if defined(win_nt)
-        CloseHandle(sp_src->fd);
-        sp_src->fd = CreateFile(sp_src->fname,
-                                GENERIC_READ,
+        CloseHandle(sp_dst->fd);
+        sp_dst->fd = CreateFile(sp_dst->fname,
+                                GENERIC_WRITE,
                                 FILE_SHARE_READ,
                                 NULL,
-                                OPEN_EXISTING,
+                                OPEN_ALWAYS,
                                 FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
                                 NULL);
-        if (sp_src->fd == INVALID_HANDLE_VALUE)
+        if (sp_dst->fd == INVALID_HANDLE_VALUE)
             return (NULL);
 # else
-        close(sp_src->fd);
-        sp_src->fd = open(sp_src->fname, O_DIRECT);
-        if (sp_src->fd < 0)
+        close(sp_dst->fd);
+        sp_dst->fd = open(sp_dst->fname, O_DIRECT | O_WRONLY | O_CREAT, 0777);
+        if (sp_dst->fd < 0)
             return (NULL);
 # endif
     }
     else
 #endif
     {
-        if (Default_rw_test_size != 0)
+        writer_main = file_writer_buffered;
+#if !defined(win_nt)
+        if (sp_dst->num_writers > 1 && sp_dst->can_seek &&
+            !(sp->flags & SP_SORT))
         {
-            /* test mode for some regression tests */
-            reader_main = file_reader_test;
-            sp_src->transfer_size = Default_rw_test_size;
+            writer_main = file_writer_ranges;
+            /* with -SAME_SIZE, the file offset of each task's output is
+             * known, so the outputs are written in the order they are
+             * ready.
+             */
+            if (sp->same_size)
+                sp->out[out_index].unordered = TRUE;
         }
-        else
-            reader_main = file_reader_buffered;
-        if (sp_src->transfer_size == 0)
+#endif
+        if (sp_dst->auto_transfer && sp_dst->can_seek)
+            sp_dst->transfer_size =
+                auto_transfer_size(sp_dst, DEFAULT_BUFFERED_TRANSFER_SIZE, 0);
+        if (sp_dst->transfer_size == 0)
         {
-            if (sp_src->can_seek)  /* if normal file */
-                sp_src->transfer_size = DEFAULT_BUFFERED_TRANSFER_SIZE;
+            if (Default_rw_test_size != 0)
+                sp_dst->transfer_size = Default_rw_test_size;
+            else if (sp_dst->can_seek)  /* if normal file */
+                sp_dst->transfer_size = DEFAULT_BUFFERED_TRANSFER_SIZE;
             else
-                sp_src->transfer_size = DEFAULT_PIPE_TRANSFER_SIZE;
+                sp_dst->transfer_size = DEFAULT_PIPE_TRANSFER_SIZE;
+        }
+    }
+    
+    sp_dst->out_index = out_index;
+
+    /* create writer thread */
+    if ((ret = create_thread(sp, &sp_dst->thread, writer_main, sp_dst, -1)))
+        die("sp_open_file_dst: pthread_create() ret: %d\n", ret);
+    return (sp_dst);
+}
+
+
+/* sp_file_wait - wait for the specified file connection to complete.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_file_wait(sp_file_t sp_file)
+{
+    if (sp_file->wait_done == TRUE)
+        return (sp_file->error_code);
+    pthread_join(sp_file->thread, NULL);
+    sp_file->wait_done = TRUE;
+    return (sp_file->error_code);
+}
+
+
+/* alloc_pages - internal routine to allocate page-aligned memory.
+ *
+ * Returns: the memory, or NULL if it could not be allocated.
+ */
+static char *alloc_pages(size_t size)
+{
+    char        *buf;
+
+#if defined(win_nt)
+    buf = VirtualAlloc(NULL, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+    init_zero_fd();
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, Zero_fd, 0);
+    if (buf == MAP_FAILED)
+        buf = NULL;
+#endif
+    return (buf);
+}
+
+
+/* free_pages - internal routine to free memory from alloc_pages().
+ */
+static void free_pages(char *buf, size_t size)
+{
+#if defined(win_nt)
+    VirtualFree(buf, 0, MEM_RELEASE);
+#else
+    munmap(buf, size);
+#endif
+}
+
+
+#if defined(SP_NUMA)
+
+/* read_node_list - internal routine to read a sysfs list of cpus or nodes,
+ *                  e.g. "0-3,8-11", into a cpu set.
+ *
+ * Returns: 0 if the list was read, otherwise -1.
+ */
+static int read_node_list(const char *path, cpu_set_t *set)
+{
+    FILE        *fp;
+    char        buf[4096];
+    char        *p;
+    long        lo;
+    long        hi;
+
+    CPU_ZERO(set);
+    if ((fp = fopen(path, "r")) == NULL)
+        return (-1);
+    p = fgets(buf, sizeof(buf), fp);
+    fclose(fp);
+    if (p == NULL)
+        return (-1);
+    while (isdigit(*(unsigned char *)p))
+    {
+        lo = hi = strtol(p, &p, 10);
+        if (*p == '-')
+            hi = strtol(p + 1, &p, 10);
+        for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+            CPU_SET(lo, set);
+        if (*p == ',')
+            p++;
+    }
+    return (0);
+}
+
+
+/* get_numa_topology - internal routine to find the NUMA nodes that have
+ *                     cpus, once per process.
+ *
+ * Returns: the number of nodes, or 0 if they could not be found.
+ */
+static int get_numa_topology()
+{
+    cpu_set_t   nodes;
+    char        path[64];
+    int         id;
+
+    pthread_mutex_lock(&Global_lock);
+    if (Numa_nodes < 0)
+    {
+        Numa_nodes = 0;
+        if (read_node_list("/sys/devices/system/node/online", &nodes) == 0)
+        {
+            for (id = 0;
+                 id < CPU_SETSIZE && Numa_nodes < SP_MAX_NUMA_NODES; id++)
+            {
+                if (!CPU_ISSET(id, &nodes))
+                    continue;
+                sprintf(path, "/sys/devices/system/node/node%d/cpulist", id);
+                if (read_node_list(path, &Numa_node_cpus[Numa_nodes]) == 0 &&
+                    CPU_COUNT(&Numa_node_cpus[Numa_nodes]) != 0)
+                {
+                    Numa_node_id[Numa_nodes++] = id;
+                }
+            }
         }
     }
-    
-    /* create reader thread */
-    if (pthread_create(&sp_src->thread, NULL, reader_main, sp_src) != 0)
-        return (NULL);
-    return (sp_src);
+    pthread_mutex_unlock(&Global_lock);
+    return (Numa_nodes);
+}
+
+#endif
+
+
+/* init_numa - internal routine to find the NUMA nodes with cpus that this
+ *             process may run on for -NUMA.  With fewer than two such
+ *             nodes, threads and buffers are not placed.
+ *
+ * Returns: SP_OK or SP_MEM_ALLOC_ERROR
+ */
+static int init_numa(sp_t sp)
+{
+#if defined(SP_NUMA)
+    cpu_set_t   allowed;
+    int         n;
+    int         k;
+
+    n = get_numa_topology();
+    if (n < 2 || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return (SP_OK);
+    sp->numa_cpus = (cpu_set_t *)calloc(n, sizeof(cpu_set_t));
+    sp->numa_ids = (int *)calloc(n, sizeof(int));
+    sp->numa_idle = (int *)calloc(n, sizeof(int));
+    sp->in_buf_pool_node = (int *)calloc(sp->num_in_bufs, sizeof(int));
+    if (sp->numa_cpus == NULL || sp->numa_ids == NULL ||
+        sp->numa_idle == NULL || sp->in_buf_pool_node == NULL)
+    {
+        return (SP_MEM_ALLOC_ERROR);
+    }
+    for (k = 0; k < n; k++)
+    {
+        CPU_AND(&sp->numa_cpus[sp->numa_nodes], &Numa_node_cpus[k], &allowed);
+        if (CPU_COUNT(&sp->numa_cpus[sp->numa_nodes]) != 0)
+            sp->numa_ids[sp->numa_nodes++] = Numa_node_id[k];
+    }
+    if (sp->numa_nodes < 2)
+        sp->numa_nodes = 0;
+#endif
+    return (SP_OK);
 }
 
 
-/* sp_open_file_dst - use the specified file as the output for the
- *                    specified output of the specified sump pump.
+/* numa_thread_node - internal routine to get the -NUMA node index of the
+ *                    cpu that the calling pump thread is bound to.
  *
- * Parameters:
- *      sp -          sp_t identifier for which we are opening an output file.
- *      out_index -   Integer indicating the sump pump output index.
- *      fname_mods -  Name of the file, potentially followed by one or more
- *                    of the following modifiers (with no intervening spaces):
- *                    ,BUFFERED or ,BUF The file will be written with normal
- *                                      buffered (not direct) writes.
- *                    ,DIRECT or ,DIR   The file will be written with direct
- *                                      and asynchronous writes.
- *                    ,TRANSFER=%d{k,m,g} or ,TRANS=%d{k,m,g} or ,TR=%d{k,m,g}
- *                                      The transfer size (write request size)
- *                                      is specified in kilo, mega or giga
- *                                      bytes.
- *                    ,COUNT=%d or ,CO=%d  The count of the maximum number of
- *                                      outstanding asynchronous write requests
- *                                      is given.
- *                    Example:
- *                       myfilename,dir,trans=4m,co=4
- *                                      The above example specifies a file
- *                                      name of "myfilename", with direct
- *                                      and asynchronous writes, with a
- *                                      request size of 4 MB, and a maximum
- *                                      of 4 outstanding asynchronous write
- *                                      requests at any time.
+ * Returns: the node index, or -1 if not known.
+ */
+static int numa_thread_node(sp_t sp)
+{
+#if defined(SP_NUMA)
+    int         cpu;
+    int         k;
+
+    if (sp->numa_nodes != 0 && (cpu = sched_getcpu()) >= 0)
+    {
+        for (k = 0; k < sp->numa_nodes; k++)
+            if (CPU_ISSET(cpu, &sp->numa_cpus[k]))
+                return (k);
+    }
+#endif
+    return (-1);
+}
+
+
+/* bind_in_buf_mem - internal routine to place the pages of new input
+ *                   buffer memory on the next -NUMA node in turn, before
+ *                   they are first touched.
  *
- * Returns: NULL if an error occurs in opening the file, otherwise
- *          a valid sump pump file structure.
+ * Returns: the node index, or -1 if the memory was not placed.
  */
-sp_file_t sp_open_file_dst(sp_t sp, unsigned out_index, const char *fname_mods)
+static int bind_in_buf_mem(sp_t sp, char *buf)
 {
-    sp_file_t           sp_dst;
-    int                 ret;
-    char                *comma_char;
-    int                 fname_len;
-    void                *(*writer_main)(void *);
-    int                 specified_mode;
+#if defined(SP_NUMA) && defined(SYS_mbind)
+    unsigned long       mask[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+    int                 bits = 8 * sizeof(unsigned long);
+    int                 node;
+    int                 id;
 
-    if ((sp_dst = (sp_file_t)calloc(1, sizeof(struct sp_file))) == NULL)
-        return (NULL);
-    sp_dst->sp = sp;
+    if (sp->numa_nodes == 0 || sp->buf_pool != NULL)
+        return (-1);
+    node = sp->numa_next_node++ % sp->numa_nodes;
+    id = sp->numa_ids[node];
+    memset(mask, 0, sizeof(mask));
+    mask[id / bits] |= 1UL << (id % bits);
+    if (syscall(SYS_mbind, buf, sp->in_buf_alloc_size, SP_MPOL_PREFERRED,
+                mask, sizeof(mask) * 8, 0) != 0)
+    {
+        return (-1);
+    }
+    return (node);
+#else
+    return (-1);
+#endif
+}
 
-    comma_char = strchr(fname_mods, ',');
-    fname_len = (int)
-        (comma_char == NULL ? strlen(fname_mods) : comma_char - fname_mods);
-    sp_dst->fname = (char *)calloc(1, fname_len + 1);
-    memcpy(sp_dst->fname, fname_mods, fname_len);
-    sp_dst->fname[fname_len] = '\0';
-    if (comma_char != NULL)
-        get_file_mods(sp_dst, comma_char + 1);
 
-    specified_mode = sp_dst->mode;
+/* alloc_buf_pages - internal routine to allocate page-aligned memory for
+ *                   a task output or input buffer.  With -HUGE_PAGES, the
+ *                   memory is explicit huge pages if its size is a
+ *                   multiple of the huge page size and huge pages are
+ *                   available, otherwise it is marked for transparent
+ *                   huge pages.  With -MLOCK, the memory is locked if
+ *                   the locked memory limit allows it.
+ *
+ * Returns: the memory, or NULL if it could not be allocated.
+ */
+static char *alloc_buf_pages(sp_t sp, size_t size)
+{
+    char        *buf = NULL;
+
 #if defined(win_nt)
-    if (strcmp(sp_dst->fname, "<stdout>") == 0)
-        sp_dst->fd = GetStdHandle(STD_OUTPUT_HANDLE);
-    else if (strcmp(sp_dst->fname, "<stderr>") == 0)
-        sp_dst->fd = GetStdHandle(STD_ERROR_HANDLE);
-    else
+    if (sp->huge_pages && GetLargePageMinimum() != 0 &&
+        size % GetLargePageMinimum() == 0)
     {
-        sp_dst->fd = CreateFile(sp_dst->fname,
-                                GENERIC_WRITE,
-                                FILE_SHARE_READ,
-                                NULL,
-                                OPEN_ALWAYS,
-                                FILE_ATTRIBUTE_NORMAL,
-                                NULL);
-        if (sp_dst->fd == INVALID_HANDLE_VALUE)
-            return (NULL);
-        sp_dst->can_seek = (GetFileType(sp_dst->fd) == FILE_TYPE_DISK);
+        buf = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE |
+                           MEM_LARGE_PAGES, PAGE_READWRITE);
     }
+    if (buf == NULL)
+        buf = alloc_pages(size);
+    if (buf != NULL && sp->mlock_bufs)
+        VirtualLock(buf, size);
 #else
-    if (strcmp(sp_dst->fname, "<stdout>") == 0)
-        sp_dst->fd = 1;
-    else if (strcmp(sp_dst->fname, "<stderr>") == 0)
-        sp_dst->fd = 2;
-    else
+# if defined(MAP_HUGETLB)
+    if (sp->huge_pages && size % HUGE_PAGE_SIZE == 0)
     {
-        struct stat     buf;
-        
-        sp_dst->fd = open(sp_dst->fname, O_WRONLY | O_CREAT, 0777);
-        if (sp_dst->fd < 0)
-            return (NULL);
-        if (fstat(sp_dst->fd, &buf) != 0)
-            return (NULL);
-        sp_dst->can_seek = S_ISREG(buf.st_mode);
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buf == MAP_FAILED)
+            buf = NULL;
+    }
+# endif
+    if (buf == NULL && (buf = alloc_pages(size)) != NULL && sp->huge_pages)
+    {
+# if defined(MADV_HUGEPAGE)
+        madvise(buf, size, MADV_HUGEPAGE);
+# endif
     }
+    if (buf != NULL && sp->mlock_bufs)
+        mlock(buf, size);
 #endif
+    return (buf);
+}
 
-    /* if direct mode was specified but file is not a normal file */
-    if (specified_mode == MODE_DIRECT && !sp_dst->can_seek)
+
+/* pool_class - internal routine to get the -BUF_POOL size class of a
+ *              buffer size, and the size of the buffers in the class.
+ *
+ * Returns: the size class
+ */
+static int pool_class(size_t size, size_t *class_size)
+{
+    int         cls = 0;
+
+    *class_size = (size_t)1 << BUF_POOL_MIN_SHIFT;
+    while (*class_size < size)
     {
-        start_error(sp, "direct mode writes were requested for file %s, but it"
-                    " is either not a file or stdout/stderr\n", sp_dst->fname);
-        return (NULL);
+        *class_size <<= 1;
+        cls++;
     }
+    return (cls);
+}
 
-    if (sp_dst->mode == MODE_UNSPECIFIED)
-        sp_dst->mode = sp_dst->can_seek ? Default_file_mode : MODE_BUFFERED;
 
-    /* if file mode is direct (whether by specification or default)
-     */
-    if (sp_dst->mode == MODE_DIRECT)
+/* join_buf_pool - internal routine to start using the named buffer pool,
+ *                 creating it if no other sump pump is using it.
+ *
+ * Returns: the buffer pool, or NULL if it could not be allocated.
+ */
+static struct buf_pool *join_buf_pool(const char *name)
+{
+    struct buf_pool     *pool;
+
+    pthread_mutex_lock(&Global_lock);
+    for (pool = Buf_pools; pool != NULL; pool = pool->next)
+        if (strcmp(pool->name, name) == 0)
+            break;
+    if (pool == NULL &&
+        (pool = (struct buf_pool *)calloc(1, sizeof(struct buf_pool))) != NULL)
     {
-        /* if a transfer size has been specified that is not a multiple of the
-         * page size, then silently revert to buffered mode.
-         * We probably should instead stay with direct mode, allocate separate
-         * read buffers, and copy the data into the sump pump input buffers.
-         */
-        if (sp_dst->transfer_size != 0 &&
-            sp_dst->transfer_size % PAGE_SIZE != 0)
+        if ((pool->name = strdup(name)) == NULL)
         {
-            sp_dst->mode = MODE_BUFFERED;
-            start_error(sp, "direct mode writes for file %s"
-                        ", but the transfer size is not a "
-                        "multiple of the page size\n", sp_dst->fname);
-            return (NULL);
+            free(pool);
+            pool = NULL;
+        }
+        else
+        {
+            pool->next = Buf_pools;
+            Buf_pools = pool;
         }
     }
+    if (pool != NULL)
+        pool->users++;
+    pthread_mutex_unlock(&Global_lock);
+    return (pool);
+}
 
-#if defined(AIO_CAPABLE)
-    if (sp_dst->can_seek && sp_dst->mode == MODE_DIRECT)
+
+/* leave_buf_pool - internal routine to stop using a buffer pool, freeing
+ *                  it and its buffers if no other sump pump is using it.
+ */
+static void leave_buf_pool(struct buf_pool *pool)
+{
+    struct buf_pool     **pp;
+    char                *buf;
+    size_t              class_size;
+    int                 cls;
+
+    pthread_mutex_lock(&Global_lock);
+    if (--pool->users != 0)
     {
-        writer_main = file_writer_direct;
-        if (sp_dst->transfer_size == 0)
-            sp_dst->transfer_size = 512 * 1024;
-        if (sp_dst->aio_count == 0)
-            sp_dst->aio_count = 4;
+        pthread_mutex_unlock(&Global_lock);
+        return;
+    }
+    for (pp = &Buf_pools; *pp != pool; pp = &(*pp)->next)
+        continue;
+    *pp = pool->next;
+    pthread_mutex_unlock(&Global_lock);
 
-        /* now close file and reopen it as direct */
-# if defined(win_nt)
-        CloseHandle(sp_dst->fd);
-        sp_dst->fd = CreateFile(sp_dst->fname,
-                                GENERIC_WRITE,
-                                FILE_SHARE_READ,
-                                NULL,
-                                OPEN_ALWAYS,
-                                FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
-                                NULL);
-        if (sp_dst->fd == INVALID_HANDLE_VALUE)
-            return (NULL);
-# else
-        close(sp_dst->fd);
-        sp_dst->fd = open(sp_dst->fname, O_DIRECT | O_WRONLY | O_CREAT, 0777);
-        if (sp_dst->fd < 0)
-            return (NULL);
-# endif
+    class_size = (size_t)1 << BUF_POOL_MIN_SHIFT;
+    for (cls = 0; cls < BUF_POOL_CLASSES; cls++, class_size <<= 1)
+    {
+        while ((buf = pool->free_bufs[cls]) != NULL)
+        {
+            pool->free_bufs[cls] = *(char **)buf;
+            free_pages(buf, class_size);
+        }
+    }
+    free(pool->name);
+    free(pool);
+}
+
+
+/* pool_get - internal routine to borrow a buffer of at least the specified
+ *            size from a buffer pool.
+ *
+ * Returns: the buffer, or NULL if it could not be allocated.
+ */
+static char *pool_get(sp_t sp, size_t size)
+{
+    struct buf_pool     *pool = sp->buf_pool;
+    char                *buf;
+    size_t              class_size;
+    int                 cls = pool_class(size, &class_size);
+
+    pthread_mutex_lock(&Global_lock);
+    if ((buf = pool->free_bufs[cls]) != NULL)
+        pool->free_bufs[cls] = *(char **)buf;
+    pthread_mutex_unlock(&Global_lock);
+    if (buf == NULL)
+        buf = alloc_buf_pages(sp, class_size);
+    return (buf);
+}
+
+
+/* pool_put - internal routine to return a buffer borrowed with pool_get().
+ */
+static void pool_put(struct buf_pool *pool, char *buf, size_t size)
+{
+    size_t      class_size;
+    int         cls = pool_class(size, &class_size);
+
+    pthread_mutex_lock(&Global_lock);
+    *(char **)buf = pool->free_bufs[cls];
+    pool->free_bufs[cls] = buf;
+    pthread_mutex_unlock(&Global_lock);
+}
+
+
+/* out_buf_pages - internal routine to tell whether the task output buffers
+ *                 of the specified output are allocated as whole pages.
+ */
+static int out_buf_pages(sp_t sp, unsigned index)
+{
+    return (sp->huge_pages || sp->mlock_bufs || sp->out[index].page_align);
+}
+
+
+/* alloc_out_buf - internal routine to allocate a task output buffer or
+ *                 overflow segment buffer for the specified output.
+ *
+ * Returns: the buffer, or NULL if it could not be allocated.
+ */
+static char *alloc_out_buf(sp_t sp, unsigned index)
+{
+    if (sp->buf_pool != NULL)
+        return (pool_get(sp, sp->out[index].buf_size));
+    if (out_buf_pages(sp, index))
+        return (alloc_buf_pages(sp, sp->out[index].buf_size));
+    return ((char *)malloc(sp->out[index].buf_size));
+}
+
+
+/* free_out_buf - internal routine to free a buffer from alloc_out_buf().
+ */
+static void free_out_buf(sp_t sp, unsigned index, char *buf)
+{
+    if (sp->buf_pool != NULL)
+        pool_put(sp->buf_pool, buf, sp->out[index].buf_size);
+    else if (out_buf_pages(sp, index))
+        free_pages(buf, sp->out[index].buf_size);
+    else
+        free(buf);
+}
+
+
+/* alloc_task_bufs - internal routine to allocate the output buffers of a
+ *                   task struct.
+ *
+ * Returns: SP_OK or SP_MEM_ALLOC_ERROR
+ */
+static int alloc_task_bufs(sp_t sp, sp_task_t t)
+{
+    unsigned    j;
+
+    for (j = 0; j < sp->num_outputs; j++)
+    {
+        t->out[j].buf = alloc_out_buf(sp, j);
+        if (t->out[j].buf == NULL)
+            return (SP_MEM_ALLOC_ERROR);
+        t->out[j].size = sp->out[j].buf_size;
+    }
+    t->has_bufs = TRUE;
+    sp->num_task_bufs++;
+    return (SP_OK);
+}
+
+
+/* free_task_bufs - internal routine to free the output buffers of a task
+ *                  struct that is not in use.
+ */
+static void free_task_bufs(sp_t sp, sp_task_t t)
+{
+    unsigned    j;
+
+    for (j = 0; j < sp->num_outputs; j++)
+    {
+        if (t->out[j].buf != NULL)
+            free_out_buf(sp, j, t->out[j].buf);
+        t->out[j].buf = NULL;
+    }
+    t->has_bufs = FALSE;
+    t->bufs_idle = FALSE;
+    sp->num_task_bufs--;
+}
+
+
+/* alloc_in_buf_mem - internal routine to allocate the memory for an input
+ *                    buffer.
+ *
+ * Returns: the memory, or NULL if it could not be allocated.
+ */
+static char *alloc_in_buf_mem(sp_t sp)
+{
+    char        *buf;
+
+    if (sp->buf_pool != NULL)
+        buf = pool_get(sp, sp->in_buf_alloc_size);
+    else
+        buf = alloc_buf_pages(sp, sp->in_buf_alloc_size);
+    if (buf != NULL)
+        sp->num_in_buf_mems++;
+    return (buf);
+}
+
+
+/* free_in_buf_mem - internal routine to free the memory of an input buffer.
+ */
+static void free_in_buf_mem(sp_t sp, char *buf)
+{
+    if (sp->buf_pool != NULL)
+        pool_put(sp->buf_pool, buf, sp->in_buf_alloc_size);
+    else
+        free_pages(buf, sp->in_buf_alloc_size);
+    sp->num_in_buf_mems--;
+}
+
+
+/* release_in_buf_mem - internal routine to take the memory from an input
+ *                      buffer that has been read by all its readers.  The
+ *                      memory is kept for reuse unless there are more
+ *                      allocations than input buffers that can be in use,
+ *                      or it is returned to the -BUF_POOL.  The memory of
+ *                      a carried partial record is always kept.  The
+ *                      sump_mtx should be locked.
+ */
+static void release_in_buf_mem(sp_t sp, in_buf_t *ib)
+{
+    if (ib->in_buf == NULL)
+        return;
+    if (ib->is_ref)
+        ib->is_ref = FALSE;     /* the caller's buffer is not reused */
+    else if ((sp->buf_pool != NULL ||
+              sp->num_in_buf_mems > sp->num_in_bufs_active) &&
+             sp->carry_bytes == 0)
+    {
+        free_in_buf_mem(sp, ib->in_buf);
     }
     else
+    {
+        if (sp->in_buf_pool_node != NULL)
+            sp->in_buf_pool_node[sp->num_pool_bufs] = ib->node;
+        sp->in_buf_pool[sp->num_pool_bufs++] = ib->in_buf;
+    }
+    ib->in_buf = NULL;
+}
+
+
+/* call_ref_release - internal routine to call the release function of a
+ *                    caller's buffer from sp_write_input_ref() once all
+ *                    its readers are done.  The sump_mtx should be locked,
+ *                    and is unlocked while the release function is called.
+ */
+static void call_ref_release(sp_t sp, in_buf_t *ib)
+{
+    sp_release_t        release = ib->ref_release;
+    char                *buf = ib->in_buf;
+    size_t              size = ib->in_buf_bytes;
+    void                *arg = ib->ref_arg;
+
+    if (release == NULL)
+        return;
+    /* the input buffer can be reused once the sump_mtx is unlocked */
+    ib->ref_release = NULL;
+    pthread_mutex_unlock(&sp->sump_mtx);
+    (*release)(buf, size, arg);
+    pthread_mutex_lock(&sp->sump_mtx);
+}
+
+
+/* release_idle_pages - internal routine to give the physical pages of an
+ *                      idle buffer back to the operating system while
+ *                      keeping its address range.  The pages read as
+ *                      zeros when the buffer is next used.
+ */
+static void release_idle_pages(char *buf, size_t size)
+{
+    size_t      page = PAGE_SIZE;
+    char        *begin = (char *)(((size_t)buf + page - 1) & ~(page - 1));
+    char        *end = (char *)(((size_t)buf + size) & ~(page - 1));
+
+    if (end <= begin)
+        return;
+#if defined(win_nt)
+    VirtualAlloc(begin, end - begin, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(begin, end - begin, MADV_DONTNEED);
 #endif
+}
+
+
+/* release_idle_mem - internal routine called with -MEMORY when the thread
+ *                    calling sp_write_input() must wait for the oldest
+ *                    task to be drained.  The pages of the pooled input
+ *                    buffer memory and of the output buffers of the task
+ *                    structs not in use are released, as they will not be
+ *                    needed until the pump output is read.  The sump_mtx
+ *                    should be locked.
+ */
+static void release_idle_mem(sp_t sp)
+{
+    sp_task_t   t;
+    unsigned    i;
+    unsigned    j;
+
+    if (sp->memory == 0)
+        return;
+    for (i = sp->num_pool_bufs_idle; i < sp->num_pool_bufs; i++)
+        release_idle_pages(sp->in_buf_pool[i], sp->in_buf_alloc_size);
+    sp->num_pool_bufs_idle = sp->num_pool_bufs;
+    for (i = 0; i < sp->num_free_tasks; i++)
     {
-        writer_main = file_writer_buffered;
-        if (sp_dst->transfer_size == 0)
+        t = &sp->task[sp->free_task[i]];
+        if (!t->has_bufs || t->bufs_idle)
+            continue;
+        for (j = 0; j < sp->num_outputs; j++)
+            release_idle_pages(t->out[j].buf, t->out[j].size);
+        t->bufs_idle = TRUE;
+    }
+}
+
+
+/* prefault_bufs - internal routine called by each sump pump thread as it
+ *                 starts with -PREFAULT.  The thread takes buffers that
+ *                 were allocated by sp_start() one at a time, writing a
+ *                 byte to each of their pages, until all of them have
+ *                 been taken.  The last thread to finish wakes sp_start().
+ */
+static void prefault_bufs(sp_t sp)
+{
+    size_t      page = PAGE_SIZE;
+    size_t      off;
+    unsigned    k;
+    unsigned    j;
+    volatile char *buf;
+
+    for (;;)
+    {
+        k = (unsigned)SP_ATOMIC_ADD32(&sp->prefault_next, 1);
+        if (k < sp->num_tasks_active)
         {
-            if (Default_rw_test_size != 0)
-                sp_dst->transfer_size = Default_rw_test_size;
-            else if (sp_dst->can_seek)  /* if normal file */
-                sp_dst->transfer_size = DEFAULT_BUFFERED_TRANSFER_SIZE;
-            else
-                sp_dst->transfer_size = DEFAULT_PIPE_TRANSFER_SIZE;
+            for (j = 0; sp->task[k].has_bufs && j < sp->num_outputs; j++)
+            {
+                buf = sp->task[k].out[j].buf;
+                for (off = 0; off < sp->task[k].out[j].size; off += page)
+                    buf[off] = 0;
+            }
+        }
+        else if (k - sp->num_tasks_active < sp->num_pool_bufs)
+        {
+            buf = sp->in_buf_pool[k - sp->num_tasks_active];
+            for (off = 0; off < sp->in_buf_alloc_size; off += page)
+                buf[off] = 0;
         }
+        else
+            break;
     }
-    
-    sp_dst->out_index = out_index;
-
-    /* create writer thread */
-    if ((ret = pthread_create(&sp_dst->thread, NULL, writer_main, sp_dst)))
-        die("sp_open_file_dst: pthread_create() ret: %d\n", ret);
-    return (sp_dst);
+    if (SP_ATOMIC_ADD32(&sp->prefault_pending, -1) == 1)
+        park_wake(&sp->prefault_park, TRUE);
 }
 
 
-/* sp_file_wait - wait for the specified file connection to complete.
- *
- * Returns: SP_OK or a sump pump error code
+/* threads_idle - internal routine to test if -ELASTIC was specified and
+ *                sump pump threads are idle because all initialized
+ *                tasks have been begun.  If a full task or input buffer
+ *                ring is keeping new tasks from being initialized, the
+ *                oldest task has not been drained.
  */
-int sp_file_wait(sp_file_t sp_file)
+static int threads_idle(sp_t sp)
 {
-    if (sp_file->wait_done == TRUE)
-        return (sp_file->error_code);
-    pthread_join(sp_file->thread, NULL);
-    sp_file->wait_done = TRUE;
-    return (sp_file->error_code);
+    return (sp->elastic &&
+            sp->cnt_task_begun == sp->cnt_task_init &&
+            sp->cnt_task_begun - sp->cnt_task_pumped < sp->num_threads);
 }
 
 
 /* check_task_done - internal routine to make sure there is room for at
- *                   least one new task.  
- *                   Caller must have locked sump_mtx.
+ *                   least one new task.  Before the task struct that will
+ *                   be used by the new task is reused, the actual ending
+ *                   position of its previous task is verified.
+ *                   Called without the sump_mtx locked.
  */
 static void check_task_done(sp_t sp)
 {
     sp_task_t   t;
+    int         seq;
 
     TRACE("check_task_done() called\n");
 
-    /* while there are tasks which have not yet been recognized as done.
+    /* while there is no room for a new task
      */
-    if (sp->cnt_task_init > sp->cnt_task_done)
+    for (;;)
     {
-        /* while there is no room for a new task
-         */
-        while (sp->error_code == 0 &&
-               (sp->cnt_task_init >
-                sp->cnt_task_drained + sp->num_tasks - 1))
-        {
-            TRACE("check_task_done() condition wait for task %d\n",
-                  sp->cnt_task_drained);
-            pthread_cond_wait(&sp->task_drained_cond, &sp->sump_mtx);
-        }
-        if (sp->error_code != 0)
+        seq = park_prepare(&sp->task_drained_park);
+        if (sp->error_code != 0 ||
+            sp->cnt_task_init <=
+            sp->cnt_task_drained + sp->num_tasks_active - 1)
+            break;
+        /* grow the task ring rather than leave threads idle */
+        if (threads_idle(sp) && sp->num_tasks_active < sp->num_tasks)
         {
-            TRACE("check_task_done() returning because of error_code: %d\n",
-                  sp->error_code);
-            return;
+            sp->num_tasks_active++;
+            TRACE("check_task_done() growing to %d tasks\n",
+                  sp->num_tasks_active);
+            continue;
         }
+        TRACE("check_task_done() park wait for task %d\n",
+              sp->cnt_task_drained);
+        pthread_mutex_lock(&sp->sump_mtx);
+        release_idle_mem(sp);
+        pthread_mutex_unlock(&sp->sump_mtx);
+        park_wait(&sp->task_drained_park, seq);
+    }
+    if (sp->error_code != 0)
+    {
+        TRACE("check_task_done() returning because of error_code: %d\n",
+              sp->error_code);
+        return;
+    }
+    /* shrink the task ring once the backlog has cleared */
+    if (sp->num_tasks_active > sp->base_tasks &&
+        sp->cnt_task_init - sp->cnt_task_drained < sp->num_tasks_active / 2)
+    {
+        sp->num_tasks_active--;
+    }
 
-        /* Verify the actual ending position of each done task
-         * matches its expected ending position.
-         */
-        while (sp->cnt_task_drained > sp->cnt_task_done)
+    /* take the task struct that will be used by the new task */
+    pthread_mutex_lock(&sp->sump_mtx);
+    sp->next_task = sp->free_task[--sp->num_free_tasks];
+    pthread_mutex_unlock(&sp->sump_mtx);
+    t = &sp->task[sp->next_task];
+    t->bufs_idle = FALSE;
+    if (!t->has_bufs && alloc_task_bufs(sp, t) != SP_OK)
+    {
+        sp_raise_error(sp, SP_MEM_ALLOC_ERROR,
+                       "task output buffer malloc failure\n");
+        return;
+    }
+
+    /* Verify the actual ending position of the done task that last used
+     * the task struct matches its expected ending position.
+     */
+    if (t->verify_end)
+    {
+        TRACE("check_task_done() task %d verify\n", t->task_number);
+        if (t->curr_in_buf_index != t->expected_end_index ||
+            (t->curr_rec - t->in_buf) != t->expected_end_offset)
         {
-            t = &sp->task[sp->cnt_task_done % sp->num_tasks];
-            TRACE("check_task_done() task %d verify\n",
-                  sp->cnt_task_done);
-            if (t->curr_in_buf_index != t->expected_end_index ||
-                (t->curr_rec - t->in_buf) != t->expected_end_offset)
-            {
-                die("task %d input ending mismatch: "
-                    "ci %d, ei %d, ao %d, eo %d\n",
-                    sp->cnt_task_done,
-                    t->curr_in_buf_index,
-                    t->expected_end_index,
-                    (t->curr_rec - t->in_buf),
-                    t->expected_end_offset);
-            }
-            sp->cnt_task_done++;
+            die("task %d input ending mismatch: "
+                "ci %d, ei %d, ao %d, eo %d\n",
+                t->task_number,
+                t->curr_in_buf_index,
+                t->expected_end_index,
+                (t->curr_rec - t->in_buf),
+                t->expected_end_offset);
         }
+        t->verify_end = FALSE;
     }
     TRACE("check_task_done() returning\n");
 }
 
 
 /* init_new_task - internal routine called by sp_write_input() to
- *                 initialize a new sump pump task.
+ *                 initialize and publish a new sump pump task.  The
+ *                 caller should wake a thread waiting on task_avail_park.
  */
 static sp_task_t init_new_task(sp_t sp, in_buf_t *ib, char *curr_rec)
 {            
     sp_task_t           t;
     unsigned            i;
 
-    t = &sp->task[sp->cnt_task_init % sp->num_tasks];
+    i = sp->next_task;
+    sp->task_order[sp->cnt_task_init % sp->num_tasks] = i;
+    t = &sp->task[i];
     t->task_number = sp->cnt_task_init;
     /* record starting ib and offset */
     t->in_buf = ib->in_buf;
@@ -3088,64 +6330,440 @@ static sp_task_t init_new_task(sp_t sp, in_buf_t *ib, char *curr_rec)
     t->in_buf_bytes = ib->in_buf_bytes;
     t->curr_rec = curr_rec;
     t->begin_rec = t->curr_rec;
+    t->read_begin = t->curr_rec;
+    t->in_bytes_read = 0;
+    t->in_offset = ib->stream_offset + (curr_rec - ib->in_buf);
     t->curr_in_buf_index = sp->cnt_in_buf_readable - 1;
     t->begin_in_buf_index = t->curr_in_buf_index;
+    t->node = ib->node;
     t->expected_end_index = -1;
     t->expected_end_offset = -1;
+    t->verify_end = !sp->speculative;
+    t->spec_state = SPEC_NONE;
+    if (ib->speculated)
+    {
+        /* a task reading from a previous buffer may have already read
+         * past this entire buffer, in which case this task is empty.
+         */
+        pthread_mutex_lock(&sp->sump_mtx);
+        ib->own_task = t;
+        t->spec_state =
+            ib->own_state == OWN_SKIPPED ? SPEC_EMPTY : SPEC_PENDING;
+        pthread_mutex_unlock(&sp->sump_mtx);
+    }
     t->first_in_buf = TRUE;
+    t->rec_index_count = (size_t)-1;
     t->outs_drained = 0;
     for (i = 0; i < sp->num_outputs; i++)
     {
         t->out[i].bytes_copied = 0;
         t->out[i].stalled = FALSE;
+        t->out[i].queued = FALSE;
+        t->out[i].taken = FALSE;
+        t->out[i].file_offset = t->in_offset;
     }
     t->input_eof = FALSE;
     t->output_eof = FALSE;
-    sp->cnt_task_init++;
+    /* publish the task to the sump pump threads.  the atomic increment
+     * orders the above task initialization before the new cnt_task_init.
+     */
+    SP_ATOMIC_ADD64(&sp->cnt_task_init, 1);
     return (t);
 }
 
 
-/* new_in_buf - wait, if necessary, until an in_buf is available to be filled
- *              with input data.
+/* in_buf_limit - internal routine to get the number of bytes that should
+ *                be placed in an input buffer before it is flushed.
  */
-static void new_in_buf(sp_t sp)
+static size_t in_buf_limit(sp_t sp, in_buf_t *ib)
 {
-    in_buf_t            *ib = NULL;
+    size_t      fill = sp->in_buf_fill;
 
-    TRACE("new_in_buf: waiting for buffer\n"); 
-    pthread_mutex_lock(&sp->sump_mtx);
-    while (sp->error_code == 0 &&
-           sp->cnt_in_buf_readable >= sp->cnt_in_buf_done + sp->num_in_bufs)
+    if (fill == 0 || fill > ib->in_buf_size)
+        fill = ib->in_buf_size;
+    return (fill);
+}
+
+
+/* wait_for_in_buf - internal routine to wait, if necessary, until the
+ *                   input buffer with the specified index can be filled.
+ *                   The sump_mtx should be locked.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+static int wait_for_in_buf(sp_t sp, uint64_t buf_index)
+{
+    in_buf_t            *ib;
+
+    for (;;)
     {
-        /* get oldest buffer not yet recognized as done */
-        ib = &sp->in_buf[sp->cnt_in_buf_done % sp->num_in_bufs];
-        /* if all readers of this input buffer are done reading */
-        if (ib->num_readers == ib->num_readers_done)
+        /* recognize the buffers that have been read by all their readers */
+        while (sp->cnt_in_buf_done < sp->cnt_in_buf_readable)
         {
+            ib = &sp->in_buf[sp->cnt_in_buf_done % sp->num_in_bufs];
+            if (ib->num_readers != ib->num_readers_done)
+                break;
+            /* a caller's buffer that had no reader is released here */
+            call_ref_release(sp, ib);
+            release_in_buf_mem(sp, ib);
             sp->cnt_in_buf_done++;
+        }
+        if (sp->error_code != 0 ||
+            buf_index < sp->cnt_in_buf_done + sp->num_in_bufs_active)
             break;
+        /* grow the input buffer ring rather than leave threads idle */
+        if (threads_idle(sp) && sp->num_in_bufs_active < sp->num_in_bufs)
+        {
+            sp->num_in_bufs_active++;
+            TRACE("wait_for_in_buf: growing to %d in_bufs\n",
+                  sp->num_in_bufs_active);
+            continue;
+        }
+        release_idle_mem(sp);
+        park_cond_wait(&sp->in_buf_done_park, &sp->sump_mtx);
+    }
+    if (sp->error_code != 0)
+        return (sp->error_code);
+    /* shrink the input buffer ring once the backlog has cleared */
+    if (sp->num_in_bufs_active > sp->base_in_bufs &&
+        sp->cnt_in_buf_readable - sp->cnt_in_buf_done <
+        sp->num_in_bufs_active / 2)
+    {
+        sp->num_in_bufs_active--;
+    }
+
+    return (SP_OK);
+}
+
+
+/* assign_in_buf_mem - internal routine to give memory to an input buffer
+ *                     that is about to be filled.  The sump_mtx should be
+ *                     locked.
+ *
+ * Returns: SP_OK or SP_MEM_ALLOC_ERROR
+ */
+static int assign_in_buf_mem(sp_t sp, in_buf_t *ib)
+{
+    if (ib->in_buf == NULL)
+    {
+        if (sp->num_pool_bufs != 0)
+        {
+            ib->in_buf = sp->in_buf_pool[--sp->num_pool_bufs];
+            ib->node = sp->in_buf_pool_node != NULL ?
+                sp->in_buf_pool_node[sp->num_pool_bufs] : -1;
+            if (sp->num_pool_bufs_idle > sp->num_pool_bufs)
+                sp->num_pool_bufs_idle = sp->num_pool_bufs;
         }
-        pthread_cond_wait(&sp->in_buf_done_cond, &sp->sump_mtx);
+        else if ((ib->in_buf = alloc_in_buf_mem(sp)) == NULL)
+            return (SP_MEM_ALLOC_ERROR);
+        else
+            ib->node = bind_in_buf_mem(sp, ib->in_buf);
     }
+    return (SP_OK);
+}
+
+
+/* new_in_buf - wait, if necessary, until an in_buf is available to be filled
+ *              with input data.
+ */
+static void new_in_buf(sp_t sp)
+{
+    int                 ret;
+
+    TRACE("new_in_buf: waiting for buffer\n"); 
+    pthread_mutex_lock(&sp->sump_mtx);
+    ret = wait_for_in_buf(sp, sp->cnt_in_buf_readable);
+    if (ret == SP_OK)
+        ret = assign_in_buf_mem(sp, &sp->in_buf[sp->cnt_in_buf_readable %
+                                                sp->num_in_bufs]);
     pthread_mutex_unlock(&sp->sump_mtx);
+    if (ret == SP_MEM_ALLOC_ERROR)
+        sp_raise_error(sp, ret, "input buffer allocation failure\n");
+}
+
+
+/* eof_without_new_in_buf_or_task - clean eof, no need to flush an input
+ *                                  buffer or start a new task.
+ */
+static void eof_without_new_in_buf_or_task(sp_t sp)
+{
+    pthread_mutex_lock(&sp->sump_mtx);
+    sp->input_eof = TRUE;
+    /* wake sump thread waiting for next input buffer */
+    park_wake(&sp->in_buf[sp->cnt_in_buf_readable %
+                          sp->num_in_bufs].readable_park, TRUE);
+    /* wake writer thread as it should exit on EOF */
+    wake_output_readers(sp);
+    pthread_mutex_unlock(&sp->sump_mtx);
+    /* wake all sump threads waiting for new task */
+    park_wake(sp->task_avail, TRUE);
+}
+
+
+/* scan_back_bytes - internal routine to search backwards in a buffer
+ *                    for a character, one byte at a time.
+ *
+ * Returns: a pointer to the last instance of the character, or NULL if
+ *          there is none.
+ */
+static char *scan_back_bytes(char *buf, size_t size, int c)
+{
+    char        *p;
+
+    for (p = buf + size; p > buf; )
+        if (*--p == (char)c)
+            return (p);
+    return (NULL);
+}
+
+
+#if defined(SP_SIMD_SCAN)
+/* scan_back_sse2 - internal routine to search backwards in a buffer for
+ *                  a character, 16 bytes at a time.
+ *
+ * Returns: a pointer to the last instance of the character, or NULL if
+ *          there is none.
+ */
+static char *scan_back_sse2(char *buf, size_t size, int c)
+{
+    __m128i     match = _mm_set1_epi8((char)c);
+    char        *p = buf + size;
+    unsigned    mask;
+
+    while (p - buf >= 16)
+    {
+        p -= 16;
+        mask = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)p), match));
+        if (mask != 0)
+            return (p + 31 - __builtin_clz(mask));
+    }
+    return (scan_back_bytes(buf, p - buf, c));
+}
+
+
+/* scan_back_avx2 - internal routine to search backwards in a buffer for
+ *                  a character, 64 bytes at a time.
+ *
+ * Returns: a pointer to the last instance of the character, or NULL if
+ *          there is none.
+ */
+__attribute__((target("avx2")))
+static char *scan_back_avx2(char *buf, size_t size, int c)
+{
+    __m256i     match = _mm256_set1_epi8((char)c);
+    char        *p = buf + size;
+    unsigned    hi_mask;
+    unsigned    lo_mask;
+
+    while (p - buf >= 64)
+    {
+        p -= 64;
+        hi_mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(p + 32)), match));
+        lo_mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)p), match));
+        if (hi_mask != 0)
+            return (p + 32 + 31 - __builtin_clz(hi_mask));
+        if (lo_mask != 0)
+            return (p + 31 - __builtin_clz(lo_mask));
+    }
+    return (scan_back_sse2(buf, p - buf, c));
+}
+#endif
+
+
+/* select_scanners - internal routine to select the delimiter scanning
+ *                   routines for this processor.
+ */
+static void select_scanners()
+{
+#if defined(SP_SIMD_SCAN)
+    __builtin_cpu_init();
+    Scan_back = __builtin_cpu_supports("avx2") ? scan_back_avx2
+                                               : scan_back_sse2;
+#else
+    Scan_back = scan_back_bytes;
+#endif
+}
+
+
+/* delim_ends_at - internal routine to determine if the record delimiter
+ *                 ends with the character at q in buf.  The delimiter
+ *                 bytes before q may lie in buf or, preceding buf, in the
+ *                 last prev_size bytes of prev.
+ *
+ * Returns: TRUE if the delimiter ends at q, FALSE otherwise.
+ */
+static int delim_ends_at(sp_t sp, char *buf, char *q,
+                         char *prev, size_t prev_size)
+{
+    char        *d = (char *)sp->delimiter;
+    size_t      n = sp->delim_size;
+    size_t      in_buf = (size_t)(q - buf);  /* bytes in buf before q */
+    size_t      i;
+    char        c;
+
+    for (i = 1; i < n; i++)
+    {
+        if (i <= in_buf)
+            c = q[-(ssize_t)i];
+        else if (i - in_buf <= prev_size)
+            c = prev[prev_size - (i - in_buf)];
+        else
+            return (FALSE);
+        if (c != d[n - 1 - i])
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+
+/* find_delim - internal routine to find the first record delimiter that
+ *              ends in the size bytes at buf.  If the buffer begins in the
+ *              middle of a record, the prev_size bytes at prev are the
+ *              bytes of the record before buf.
+ *
+ * Returns: a pointer to the byte following the delimiter, or NULL if no
+ *          delimiter ends in the buffer.
+ */
+static char *find_delim(sp_t sp, char *buf, size_t size,
+                        char *prev, size_t prev_size)
+{
+    char        last = ((char *)sp->delimiter)[sp->delim_size - 1];
+    char        *end = buf + size;
+    char        *q;
+
+    /* memchr() is already vectorized and processor-dispatched by the
+     * C library, so use it to find the delimiter's last byte.
+     */
+    for (q = buf; q < end && (q = memchr(q, last, end - q)) != NULL; q++)
+    {
+        if (sp->delim_size == 1 || delim_ends_at(sp, buf, q, prev, prev_size))
+            return (q + 1);
+    }
+    return (NULL);
+}
+
+
+/* find_last_delim - internal routine to find the last record delimiter
+ *                   that ends in the size bytes at buf.  The prev_size
+ *                   bytes at prev are the input bytes preceding buf.
+ *
+ * Returns: a pointer to the byte following the delimiter, or NULL if no
+ *          delimiter ends in the buffer.
+ */
+static char *find_last_delim(sp_t sp, char *buf, size_t size,
+                             char *prev, size_t prev_size)
+{
+    char        last = ((char *)sp->delimiter)[sp->delim_size - 1];
+    char        *q;
+
+    while ((q = (*Scan_back)(buf, size, last)) != NULL)
+    {
+        if (sp->delim_size == 1 || delim_ends_at(sp, buf, q, prev, prev_size))
+            return (q + 1);
+        size = q - buf;
+    }
+    return (NULL);
+}
+
+
+/* save_in_buf_tail - internal routine to remember the bytes at the end
+ *                    of the input that may be the beginning of a delimiter
+ *                    that ends in the next input buffer.
+ */
+static void save_in_buf_tail(sp_t sp, char *buf, size_t size)
+{
+    size_t      keep = sp->delim_size - 1;
+    size_t      take = size < keep ? size : keep;
+
+    memcpy(sp->prev_in_buf_tail + sp->prev_in_buf_tail_bytes,
+           buf + size - take, take);
+    sp->prev_in_buf_tail_bytes += take;
+    if (sp->prev_in_buf_tail_bytes > keep)
+    {
+        memmove(sp->prev_in_buf_tail,
+                sp->prev_in_buf_tail + sp->prev_in_buf_tail_bytes - keep, keep);
+        sp->prev_in_buf_tail_bytes = keep;
+    }
+}
+
+
+/* speculate_in_buf - internal routine for -SPECULATIVE to prepare an input
+ *                    buffer whose task will find its own first record.
+ *                    Only the end of the buffer is examined here, to
+ *                    determine whether the next buffer begins with the
+ *                    remainder of a record.
+ */
+static void speculate_in_buf(sp_t sp, in_buf_t *ib)
+{
+    char        *last = ib->in_buf + ib->in_buf_bytes - 1;
+    int         partial = sp->prev_in_buf_ending_rec_partial_bytes != 0;
+
+    /* with -GROUP_BY, the previous task always reads the beginning of
+     * this buffer to find the end of its key group.
+     */
+    ib->speculated = TRUE;
+    ib->own_task = NULL;
+    ib->own_state = OWN_WAITING;
+    ib->straddled = sp->cnt_in_buf_readable != 0 &&
+        ((sp->flags & SP_GROUP_BY) || partial);
+    ib->starts_partial = partial;
+    ib->spec_verify = ib->straddled && ib->in_buf_bytes != 0;
+    if (ib->straddled)
+        ib->num_readers = 1;
+    memcpy(ib->prev_tail, sp->prev_in_buf_tail, sp->prev_in_buf_tail_bytes);
+    ib->prev_tail_bytes = sp->prev_in_buf_tail_bytes;
+
+    if (ib->in_buf_bytes != 0)
+    {
+        sp->prev_in_buf_ending_rec_partial_bytes =
+            !(*last == ((char *)sp->delimiter)[sp->delim_size - 1] &&
+              delim_ends_at(sp, ib->in_buf, last, sp->prev_in_buf_tail,
+                            sp->prev_in_buf_tail_bytes));
+        if (sp->delim_size > 1)
+            save_in_buf_tail(sp, ib->in_buf, ib->in_buf_bytes);
+    }
+}
+
+
+/* carry_partial_rec - internal routine for -ALIGN_IN_BUFS to remove the
+ *                     partial record at the end of an input buffer that
+ *                     is about to be flushed, so that the partial record
+ *                     can instead begin the next input buffer.  This is
+ *                     not possible at eof, if the buffer contains no
+ *                     record boundary, or for a caller's buffer from
+ *                     sp_write_input_ref().
+ */
+static void carry_partial_rec(sp_t sp, in_buf_t *ib, int eof)
+{
+    size_t      partial = sp->prev_in_buf_ending_rec_partial_bytes;
+
+    if (eof || partial == 0 || partial >= ib->in_buf_bytes || ib->is_ref)
+        return;
+    ib->in_buf_bytes -= partial;
+    sp->carry_src = ib->in_buf + ib->in_buf_bytes;
+    sp->carry_bytes = partial;
+    sp->prev_in_buf_ending_rec_partial_bytes = 0;
 }
 
 
-/* eof_without_new_in_buf_or_task - clean eof, no need to flush an input
- *                                  buffer or start a new task.
+/* take_carry - internal routine for -ALIGN_IN_BUFS to move the partial
+ *              record carried from the previous input buffer to the
+ *              beginning of the next input buffer.  The previous input
+ *              buffer is never read beyond its flushed bytes, so the
+ *              carried bytes remain intact even if it is the same buffer.
+ *
+ * Returns: the number of carried bytes.
  */
-static void eof_without_new_in_buf_or_task(sp_t sp)
+static size_t take_carry(sp_t sp, in_buf_t *ib)
 {
-    pthread_mutex_lock(&sp->sump_mtx);
-    sp->input_eof = TRUE;
-    /* wake sump thread waiting for next input buffer (just signal OK?) */
-    pthread_cond_broadcast(&sp->in_buf_readable_cond);
-    /* wake all sump threads waiting for new task */
-    pthread_cond_broadcast(&sp->task_avail_cond);
-    /* wake writer thread as it should exit on EOF */
-    pthread_cond_broadcast(&sp->task_output_ready_cond); 
-    pthread_mutex_unlock(&sp->sump_mtx);
+    size_t      bytes = sp->carry_bytes;
+
+    memmove(ib->in_buf, sp->carry_src, bytes);
+    sp->carry_bytes = 0;
+    return (bytes);
 }
 
 
@@ -3165,12 +6783,28 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
     ib->num_readers_done = 0;
     curr_rec = ib->in_buf;
     ib->in_buf_bytes = buf_bytes;
+    ib->stream_offset = sp->in_stream_bytes;
+    sp->in_stream_bytes += buf_bytes;
     sp->in_buf_current_bytes = 0;
 
-    /* if this is not the first buffer and we are not processing
+    ib->speculated = FALSE;
+    ib->spec_verify = FALSE;
+
+    /* if the task will find its own boundaries in this buffer.  this is
+     * only done if a task struct is free, otherwise the empty tasks of
+     * buffers within a record or key group that spans many buffers could
+     * use up all the task structs, leaving no task for the buffer where
+     * that record or key group ends.
+     */
+    if (sp->speculative &&
+        sp->cnt_task_init <= sp->cnt_task_drained + sp->num_tasks_active - 1)
+    {
+        speculate_in_buf(sp, ib);
+    }
+    /* else if this is not the first buffer and we are not processing
      * whole buffers.
      */
-    if (sp->cnt_in_buf_readable != 0 && REC_TYPE(sp) != SP_WHOLE_BUF)
+    else if (sp->cnt_in_buf_readable != 0 && REC_TYPE(sp) != SP_WHOLE_BUF)
     {
         /* if we are grouping record by key values
          */
@@ -3204,16 +6838,18 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
                         if (*curr_rec == '0')
                             break;
                     }
-                    /* find next instance of newline in buffer, if any */
-                    curr_rec = memchr(curr_rec, *(char *)sp->delimiter,
-                                      ib->in_buf_bytes -
-                                      (curr_rec - ib->in_buf));
+                    /* find end of next delimiter in buffer, if any */
+                    curr_rec = find_delim(sp, curr_rec,
+                                          ib->in_buf_bytes -
+                                          (curr_rec - ib->in_buf),
+                                          sp->prev_in_buf_tail,
+                                          curr_rec == ib->in_buf ?
+                                          sp->prev_in_buf_tail_bytes : 0);
                     if (curr_rec == NULL)
                     {
                         curr_rec = ib->in_buf + ib->in_buf_bytes;
                         break;
                     }
-                    curr_rec++;     /* step over newline */
                 }
                 break;
 
@@ -3249,14 +6885,12 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
                 switch (REC_TYPE(sp))
                 {
                   case SP_UTF_8:
-                    /* find next instance of newline in buffer, if any */
-                    curr_rec = memchr(curr_rec, *(char *)sp->delimiter,
-                                      ib->in_buf_bytes -
-                                      (curr_rec - ib->in_buf));
+                    /* find end of next delimiter in buffer, if any */
+                    curr_rec = find_delim(sp, curr_rec, ib->in_buf_bytes,
+                                          sp->prev_in_buf_tail,
+                                          sp->prev_in_buf_tail_bytes);
                     if (curr_rec == NULL)
                         curr_rec = ib->in_buf + ib->in_buf_bytes;
-                    else
-                        curr_rec++;     /* step over newline */
                     break;
 
                   case SP_FIXED:
@@ -3271,27 +6905,34 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
     switch (REC_TYPE(sp))
     {
       case SP_UTF_8:
+        if (ib->speculated)     /* already done by speculate_in_buf() */
+            break;
         /* determine how many bytes the are in any partial record at
-         * the end of this buffer.  search backwards to find last newline
-         * character.
+         * the end of this buffer.  search backwards to find the end of
+         * the last delimiter.
          */
-        for (p = ib->in_buf + ib->in_buf_bytes - 1; p >= ib->in_buf; p--)
-            if (*p == *(char *)sp->delimiter) 
-                break;
-        if (p < ib->in_buf)      /* if there was no newline */
+        p = find_last_delim(sp, ib->in_buf, ib->in_buf_bytes,
+                            sp->prev_in_buf_tail, sp->prev_in_buf_tail_bytes);
+        if (p == NULL)      /* if there was no delimiter */
         {
             /* add entire buffer size to this partial record */
             sp->prev_in_buf_ending_rec_partial_bytes += ib->in_buf_bytes;
         }
         else
             sp->prev_in_buf_ending_rec_partial_bytes =
-                (ib->in_buf + ib->in_buf_bytes - 1) - p;
+                (ib->in_buf + ib->in_buf_bytes) - p;
+        if (sp->align_in_bufs)
+            carry_partial_rec(sp, ib, eof);
+        if (sp->delim_size > 1)
+            save_in_buf_tail(sp, ib->in_buf, ib->in_buf_bytes);
         break;
 
       case SP_FIXED:
         sp->prev_in_buf_ending_rec_partial_bytes =
             (sp->prev_in_buf_ending_rec_partial_bytes + ib->in_buf_bytes) %
             (sp->rec_size + ((sp->flags & SP_GROUP_BY) ? 1 : 0));
+        if (sp->align_in_bufs)
+            carry_partial_rec(sp, ib, eof);
         break;
 
       case SP_WHOLE_BUF:
@@ -3299,30 +6940,42 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
         curr_rec = ib->in_buf;
         break;
     }
+
+    /* if -SPECULATIVE was specified but this buffer's task boundary was
+     * found above, verify the previous task's end the same way.
+     */
+    if (sp->speculative && !ib->speculated)
+    {
+        ib->straddled = ib->num_readers != 0;
+        ib->spec_start = curr_rec - ib->in_buf;
+        ib->spec_verify = ib->straddled && ib->in_buf_bytes != 0;
+    }
         
+    /* if we found the starting point for a new task (or this was the
+     * very first input read), then add a reader for the task that will
+     * start its input with this input buffer.  this must be done before
+     * the input buffer is made readable.
+     */
+    if (curr_rec < ib->in_buf + ib->in_buf_bytes)
+        ib->num_readers++;
+
     TRACE("flush_in_buf: ib %d readable with %d bytes\n",
           sp->cnt_in_buf_readable, ib->in_buf_bytes);
     pthread_mutex_lock(&sp->sump_mtx);
     /* make input buffer available to any existing task.
      * in theory there should be only one task waiting */
     sp->cnt_in_buf_readable++;
-    pthread_cond_broadcast(&sp->in_buf_readable_cond);
+    pthread_mutex_unlock(&sp->sump_mtx);
+    park_wake(&ib->readable_park, TRUE);
 
     if (eof)
     {
-        /* if we found the starting point for a new task, then add a
-         * reader for the task that will start its input with this
-         * input buffer.
-         */
-        if (curr_rec < ib->in_buf + ib->in_buf_bytes)
-            ib->num_readers++;
-
         /* set the expected end point for the previous task as the
          * actual begin point for the task we are about to define.
          */
         if (sp->cnt_task_init != 0) /* if there was a previous task */
         {
-            t = &sp->task[(sp->cnt_task_init - 1) % sp->num_tasks];
+            t = TASK_BY_NUMBER(sp, sp->cnt_task_init - 1);
 
             /* if we just made availible a non-empty in_buf
              * that did NOT start a new task.
@@ -3335,7 +6988,6 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
                  */
                 t->expected_end_index = sp->cnt_in_buf_readable;
                 t->expected_end_offset = 0;
-                pthread_mutex_unlock(&sp->sump_mtx);
                 /* do not issue a new task here. */
                 eof_without_new_in_buf_or_task(sp);
                 return;
@@ -3359,19 +7011,20 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
         /* make sure there is at least one available task struct */
         check_task_done(sp);
         if (sp->error_code != 0)
-        {
-            pthread_mutex_unlock(&sp->sump_mtx);
             return;
-        }
 
         TRACE("flush_in_buf: initializing task %d\n", sp->cnt_task_init);
         t = init_new_task(sp, ib, curr_rec);
+        pthread_mutex_lock(&sp->sump_mtx);
         sp->input_eof = TRUE;
-        /* wake all sump threads */
-        pthread_cond_broadcast(&sp->task_avail_cond);
+        /* wake sump thread waiting for next input buffer */
+        park_wake(&sp->in_buf[sp->cnt_in_buf_readable %
+                              sp->num_in_bufs].readable_park, TRUE);
         /* wake writer thread as it should exit on EOF */
-        pthread_cond_broadcast(&sp->task_output_ready_cond); 
+        wake_output_readers(sp);
         pthread_mutex_unlock(&sp->sump_mtx);
+        /* wake all sump threads */
+        park_wake(sp->task_avail, TRUE);
         return;
     }
 
@@ -3380,17 +7033,12 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
      */
     if (curr_rec < ib->in_buf + ib->in_buf_bytes)
     {
-        /* add a reader for the task that will start its input with
-         * this input buffer.
-         */
-        ib->num_readers++;
-
         /* set the expected end point for the previous task as the
          * actual begin point for the task we are about to define.
          */
         if (sp->cnt_task_init != 0) /* if there was a previous task */
         {
-            t = &sp->task[(sp->cnt_task_init - 1) % sp->num_tasks];
+            t = TASK_BY_NUMBER(sp, sp->cnt_task_init - 1);
 
             /* the expected ending in_buf is the one just issued
              * and the offset is.
@@ -3408,18 +7056,14 @@ static void flush_in_buf(sp_t sp, size_t buf_bytes, int eof)
         /* make sure there is at least one available task struct */
         check_task_done(sp);
         if (sp->error_code != 0)
-        {
-            pthread_mutex_unlock(&sp->sump_mtx);
             return;
-        }
 
         TRACE("flush_in_buf: initializing task %d\n", sp->cnt_task_init);
         t = init_new_task(sp, ib, curr_rec);
 
         /* wake 1 sump thread */
-        pthread_cond_signal(&sp->task_avail_cond);
+        park_wake(sp->task_avail, FALSE);
     }
-    pthread_mutex_unlock(&sp->sump_mtx);
     return;
 }
 
@@ -3432,6 +7076,7 @@ ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size)
     size_t              src_remaining = size;
     size_t              dst_remaining;
     size_t              trans_size;
+    size_t              limit;
     char                *trans_src;
     char                *trans_dst;
     in_buf_t            *ib;
@@ -3533,13 +7178,16 @@ ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size)
         trans_src = (char *)buf + size - src_remaining;
         trans_size = src_remaining;
         trans_dst = ib->in_buf + sp->in_buf_current_bytes;
-        dst_remaining = ib->in_buf_size - sp->in_buf_current_bytes;
+        /* the input buffer fill size can shrink with -IN_BUF_SIZE=AUTO */
+        limit = in_buf_limit(sp, ib);
+        dst_remaining = limit > sp->in_buf_current_bytes ?
+            limit - sp->in_buf_current_bytes : 0;
         if (trans_size > dst_remaining)
             trans_size = dst_remaining;
         memcpy(trans_dst, trans_src, trans_size);
         src_remaining -= trans_size;
         sp->in_buf_current_bytes += trans_size;
-        dst_remaining = ib->in_buf_size - sp->in_buf_current_bytes;
+        dst_remaining -= trans_size;
 
         /* if this isn't EOF and there is more space remaining the in_buf,
          * then return so caller can write more bytes or declare EOF.
@@ -3555,6 +7203,18 @@ ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size)
         }
 
         flush_in_buf(sp, sp->in_buf_current_bytes, size == 0);
+
+        /* if a partial record was carried from the flushed input buffer,
+         * begin the next input buffer with it.
+         */
+        if (sp->carry_bytes != 0)
+        {
+            new_in_buf(sp);
+            if (sp->error_code != 0)
+                return (-1);
+            ib = &sp->in_buf[sp->cnt_in_buf_readable % sp->num_in_bufs];
+            sp->in_buf_current_bytes = take_carry(sp, ib);
+        }
     }
 
     if (sp->error_code)
@@ -3564,6 +7224,79 @@ ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size)
 }
 
 
+/* sp_write_input_ref - write a caller's buffer of input data to a sump pump
+ *                      without copying it.  Any input from a previous
+ *                      sp_write_input() call that is not yet in a full
+ *                      input buffer is made available first.  The
+ *                      caller's buffer becomes an input buffer, and must
+ *                      not be modified until the release function is
+ *                      called with it once all its readers are done.  The
+ *                      release function is called by a sump pump thread
+ *                      or the thread calling this function, or by
+ *                      sp_free() after an error.  It is called exactly
+ *                      once, even if an error is returned.  With
+ *                      -ALIGN_IN_BUFS, the caller's buffer is not trimmed
+ *                      to end on a record boundary.  Input EOF is
+ *                      indicated with a zero-sized sp_write_input().
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_write_input_ref(sp_t sp, void *buf, size_t size,
+                       sp_release_t release, void *arg)
+{
+    in_buf_t    *ib;
+    int         ret;
+    char        align;
+
+    if (sp->flags & SP_SORT)
+        ret = SP_SORT_INCOMPATIBLE;
+    else if (sp->input_eof)
+        ret = SP_REDUNDANT_EOF;
+    else
+        ret = sp->error_code;
+    if (ret != SP_OK || size == 0)
+    {
+        if (release != NULL)
+            (*release)(buf, size, arg);
+        return (ret);
+    }
+
+    /* flush the partially filled input buffer, if any.  a partial record
+     * at its end cannot be carried into the caller's buffer.
+     */
+    if (sp->in_buf_current_bytes != 0)
+    {
+        align = sp->align_in_bufs;
+        sp->align_in_bufs = FALSE;
+        flush_in_buf(sp, sp->in_buf_current_bytes, FALSE);
+        sp->align_in_bufs = align;
+    }
+
+    pthread_mutex_lock(&sp->sump_mtx);
+    ret = wait_for_in_buf(sp, sp->cnt_in_buf_readable);
+    if (ret == SP_OK)
+    {
+        ib = &sp->in_buf[sp->cnt_in_buf_readable % sp->num_in_bufs];
+        release_in_buf_mem(sp, ib);     /* in case it was given memory */
+        ib->in_buf = (char *)buf;
+        ib->node = -1;
+        ib->is_ref = TRUE;
+        ib->ref_release = release;
+        ib->ref_arg = arg;
+    }
+    pthread_mutex_unlock(&sp->sump_mtx);
+    if (ret != SP_OK)
+    {
+        if (release != NULL)
+            (*release)(buf, size, arg);
+        return (ret);
+    }
+
+    flush_in_buf(sp, size, FALSE);
+    return (sp->error_code);
+}
+
+
 /* sp_get_in_buf - get a pointer to an input buffer that an external
  *                    thread can fill with input data.
  *
@@ -3572,6 +7305,8 @@ ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size)
 int sp_get_in_buf(sp_t sp, uint64_t buf_index, void **buf, size_t *size)
 {
     in_buf_t    *ib;
+    size_t      limit;
+    int         ret;
     
     if (sp->flags & SP_SORT)
         return (SP_SORT_INCOMPATIBLE);
@@ -3583,27 +7318,37 @@ int sp_get_in_buf(sp_t sp, uint64_t buf_index, void **buf, size_t *size)
     {
         return (SP_BUF_INDEX_ERROR);
     }
+    /* with aligned input buffers, the beginning of a buffer is not known
+     * until the previous buffer has been flushed.
+     */
+    if (sp->align_in_bufs && buf_index != sp->cnt_in_buf_readable)
+        return (SP_BUF_INDEX_ERROR);
     pthread_mutex_lock(&sp->sump_mtx);
-    while (sp->error_code == 0 &&
-           buf_index >= sp->cnt_in_buf_done + sp->num_in_bufs)
-    {
-        /* get oldest buffer not yet recognized as done */
-        ib = &sp->in_buf[sp->cnt_in_buf_done % sp->num_in_bufs];
-        /* if all readers of this input buffer are done reading */
-        if (ib->num_readers == ib->num_readers_done)
+    ret = wait_for_in_buf(sp, buf_index);
+    ib = &sp->in_buf[buf_index % sp->num_in_bufs];
+    if (ret == SP_OK)
+        ret = assign_in_buf_mem(sp, ib);
+    if (ret == SP_OK)
+    {
+        /* return the space after any partial record carried from the
+         * previous input buffer.  the carry is moved only once, even if
+         * the buffer is asked for again before its bytes are put.
+         */
+        if (!sp->carry_put_taken || sp->carry_put_index != buf_index)
         {
-            sp->cnt_in_buf_done++;
-            continue;
+            sp->carry_put = take_carry(sp, ib);
+            sp->carry_put_index = buf_index;
+            sp->carry_put_taken = TRUE;
         }
-        pthread_cond_wait(&sp->in_buf_done_cond, &sp->sump_mtx);
-    }
-    if (sp->error_code == 0)
-    {
-        ib = &sp->in_buf[buf_index % sp->num_in_bufs];
-        *buf = ib->in_buf;
-        *size = ib->in_buf_size;
+        limit = in_buf_limit(sp, ib);
+        if (limit <= sp->carry_put)
+            limit = ib->in_buf_size;
+        *buf = ib->in_buf + sp->carry_put;
+        *size = limit - sp->carry_put;
     }
     pthread_mutex_unlock(&sp->sump_mtx);
+    if (ret == SP_MEM_ALLOC_ERROR)
+        sp_raise_error(sp, ret, "input buffer allocation failure\n");
     if (sp->error_code)
         return (sp->error_code);
     return (SP_OK);
@@ -3623,6 +7368,9 @@ int sp_put_in_buf_bytes(sp_t sp, uint64_t buf_index, size_t size, int eof)
         return (SP_SORT_INCOMPATIBLE);
     if (buf_index != sp->cnt_in_buf_readable)
         return (SP_BUF_INDEX_ERROR);
+    size += sp->carry_put;      /* include any carried partial record */
+    sp->carry_put = 0;
+    sp->carry_put_taken = FALSE;
     if (size == 0)
         eof_without_new_in_buf_or_task(sp);
     else
@@ -3643,6 +7391,57 @@ int sp_get_error(sp_t sp)
 }
 
 
+/* sp_get_stats - get a string containing the statistics report of a sump
+ *                pump, including the input buffer fill size chosen by
+ *                -IN_BUF_SIZE=AUTO.
+ *
+ * Returns: a string containing the statistics report. The string should
+ *          NOT be free()'d and is valid until the next sp_get_stats() call
+ *          for the passed sp_t or until it is sp_free()'d.
+ */
+const char *sp_get_stats(sp_t sp)
+{
+    if (sp->flags & SP_SORT)
+        return (NULL);
+    if (sp->stats_buf == NULL &&
+        (sp->stats_buf = (char *)malloc(STATS_BUF_SIZE)) == NULL)
+    {
+        return ("no stats because of malloc failure");
+    }
+    pthread_mutex_lock(&sp->sump_mtx);
+    snprintf(sp->stats_buf, STATS_BUF_SIZE,
+             "tasks:              %"PTFlld"\n"
+             "input bytes:        %"PTFlld"\n"
+             "input buffer size:  %"PTFlld"%s\n"
+             "input buffer fill:  %"PTFlld"\n"
+             "task ring:          %u of %u\n"
+             "input buffer ring:  %u of %u\n"
+             "overflow segments:  %"PTFlld" (%"PTFlld" bytes in pool)\n"
+             "numa nodes:         %d (%"PTFlld" tasks, %"PTFlld" bytes "
+             "remote)\n"
+             "pump busy time:     %.3f sec\n"
+             "pump wait time:     %.3f sec\n"
+             "thread idle time:   %.3f sec\n",
+             (long long)sp->stat_tasks,
+             (long long)sp->stat_in_bytes,
+             (long long)sp->in_buf_size,
+             sp->auto_in_buf_size ? " (auto)" : "",
+             (long long)sp->in_buf_fill,
+             sp->num_tasks_active, sp->num_tasks,
+             sp->num_in_bufs_active, sp->num_in_bufs,
+             (long long)sp->stat_overflow_segs,
+             (long long)sp->overflow_used,
+             sp->numa_nodes,
+             (long long)sp->stat_numa_remote_tasks,
+             (long long)sp->stat_numa_remote_bytes,
+             sp->stat_busy_us / 1000000.0,
+             sp->stat_wait_us / 1000000.0,
+             sp->stat_idle_us / 1000000.0);
+    pthread_mutex_unlock(&sp->sump_mtx);
+    return (sp->stats_buf);
+}
+
+
 /* pfunc_get_thread_index - can be used by pump functions to get the
  *                          index of the sump pump thread executing the
  *                          pump func.  For instance, if there are 4
@@ -3673,6 +7472,92 @@ uint64_t pfunc_get_task_number(sp_task_t t)
 }
 
 
+/* task_output_ready - internal routine to make the output of a task that
+ *                     is either stalled or done available to the reader
+ *                     of the specified output, and wake the reader.  For
+ *                     an unordered output the order of the first call for
+ *                     each task is recorded.
+ *                     The sump_mtx should already be locked.
+ */
+static void task_output_ready(sp_t sp, sp_task_t t, unsigned index)
+{
+    struct sump_out     *o = sp->out + index;
+
+    if (o->unordered && !t->out[index].queued)
+    {
+        t->out[index].queued = TRUE;
+        t->out[index].ready_seq = o->cnt_ready++;
+    }
+    park_wake(&o->ready_park, FALSE);
+}
+
+
+/* chain_out_seg - internal routine for -OVERFLOW_POOL to move the full
+ *                 output buffer of a task to the end of its chain of
+ *                 overflow segments, and let the task continue writing
+ *                 into an empty buffer from the pool instead of stalling
+ *                 until its output is read.  The sump_mtx should already
+ *                 be locked.
+ *
+ * Returns: TRUE if the buffer was chained, FALSE if the pool is exhausted.
+ */
+static int chain_out_seg(sp_t sp, sp_task_t t, unsigned index)
+{
+    struct sump_out     *o = sp->out + index;
+    struct task_out     *out = t->out + index;
+    struct out_seg      *seg;
+    char                *buf;
+    unsigned            i;
+
+    if ((seg = o->free_segs) != NULL)
+        o->free_segs = seg->next;
+    else
+    {
+        /* the pool is shared by the outputs, so make room by freeing the
+         * idle segments of the other outputs.
+         */
+        for (i = 0; i < sp->num_outputs &&
+             sp->overflow_used + o->buf_size > sp->overflow_pool; i++)
+        {
+            while ((seg = sp->out[i].free_segs) != NULL &&
+                   sp->overflow_used + o->buf_size > sp->overflow_pool)
+            {
+                sp->out[i].free_segs = seg->next;
+                free_out_buf(sp, i, seg->buf);
+                free(seg);
+                sp->overflow_used -= sp->out[i].buf_size;
+            }
+        }
+        if (sp->overflow_used + o->buf_size > sp->overflow_pool)
+            return (FALSE);
+        if ((seg = (struct out_seg *)malloc(sizeof(struct out_seg))) == NULL)
+            return (FALSE);
+        if ((seg->buf = alloc_out_buf(sp, index)) == NULL)
+        {
+            free(seg);
+            return (FALSE);
+        }
+        sp->overflow_used += o->buf_size;
+    }
+
+    /* swap the full buffer into the segment */
+    buf = seg->buf;
+    seg->buf = out->buf;
+    seg->bytes = out->bytes_copied;
+    seg->next = NULL;
+    if (out->seg_tail != NULL)
+        out->seg_tail->next = seg;
+    else
+        out->seg_head = seg;
+    out->seg_tail = seg;
+    out->buf = buf;
+    out->bytes_copied = 0;
+    sp->stat_overflow_segs++;
+    park_wake(&o->ready_park, FALSE);
+    return (TRUE);
+}
+
+
 /* pfunc_write - write function that can be used by a pump function to
  *               write the output data for the pump function.
  *
@@ -3686,6 +7571,7 @@ size_t pfunc_write(sp_task_t t, unsigned out_index, void *buf, size_t size)
     size_t      copy_bytes;
     sp_t        sp = t->sp;
     struct task_out *out = t->out + out_index;
+    uint64_t    begin;
 
     if (sp->error_code != SP_OK)
         return (0);
@@ -3713,11 +7599,18 @@ size_t pfunc_write(sp_task_t t, unsigned out_index, void *buf, size_t size)
         }
         TRACE("pfunc_write: waking output reader\n");
         pthread_mutex_lock(&sp->sump_mtx);
+        if (chain_out_seg(sp, t, out_index))
+        {
+            pthread_mutex_unlock(&sp->sump_mtx);
+            continue;
+        }
         out->stalled = TRUE;
-        pthread_cond_broadcast(&sp->task_output_ready_cond);
+        task_output_ready(sp, t, out_index);
         TRACE("pfunc_write: waiting for available output buffer\n");
+        begin = sp_get_time_us();
         while (out->stalled && sp->error_code == 0)
-            pthread_cond_wait(&sp->task_output_empty_cond, &sp->sump_mtx);
+            park_cond_wait(&t->out_empty_park, &sp->sump_mtx);
+        t->wait_us += sp_get_time_us() - begin;
         pthread_mutex_unlock(&sp->sump_mtx);
         if (sp->error_code != 0)
             return (-1);
@@ -3754,15 +7647,57 @@ static void done_reading_in_buf(sp_task_t t, int move_to_next_in_buf)
 {
     in_buf_t    *ib;
     sp_t        sp = t->sp;
+    char        *read_end;
+
+    /* count the bytes this task read from the buffer */
+    read_end = move_to_next_in_buf ?
+        t->in_buf + t->in_buf_bytes : t->curr_rec;
+    if (t->read_begin != NULL && read_end > t->read_begin)
+        t->in_bytes_read += read_end - t->read_begin;
+    t->read_begin = NULL;
 
     pthread_mutex_lock(&sp->sump_mtx);
 
     /* bump up the count of done readers for the input buffer */
     ib = &sp->in_buf[t->curr_in_buf_index % sp->num_in_bufs];
+    /* with -SPECULATIVE, a task that reads the beginning of the buffer
+     * after its first buffer notes where its input ended.
+     */
+    if (!t->first_in_buf)
+    {
+        ib->spec_end = move_to_next_in_buf ?
+            t->in_buf_bytes : (size_t)(t->curr_rec - t->in_buf);
+        /* if this task read past the entire buffer before the buffer's
+         * own task began, then that task is empty.  be done reading for
+         * it so the buffer can be reused without waiting for a pump
+         * thread to run it.
+         */
+        if (move_to_next_in_buf && ib->speculated &&
+            ib->in_buf_bytes != 0 && ib->own_state == OWN_WAITING)
+        {
+            ib->own_state = OWN_SKIPPED;
+            if (ib->own_task != NULL)
+                ib->own_task->spec_state = SPEC_EMPTY;
+            ib->spec_verify = FALSE;
+            ib->num_readers_done++;
+        }
+    }
     ib->num_readers_done++;
     /* if all readers are now done, signal the reader thread */
     if (ib->num_readers == ib->num_readers_done)
-        pthread_cond_broadcast(&sp->in_buf_done_cond);
+    {
+        /* verify the previous task ended where this buffer's task began */
+        if (ib->spec_verify && ib->spec_end != ib->spec_start)
+        {
+            die("input buffer %d task boundary mismatch: "
+                "previous task ended at %d, task began at %d\n",
+                (int)t->curr_in_buf_index,
+                (int)ib->spec_end, (int)ib->spec_start);
+        }
+        /* give a caller's buffer back to the caller */
+        call_ref_release(sp, ib);
+        park_wake(&sp->in_buf_done_park, TRUE);
+    }
 
     pthread_mutex_unlock(&sp->sump_mtx);
 
@@ -3787,6 +7722,7 @@ static void ready_in_buf(sp_task_t t)
 {
     in_buf_t     *ib;
     sp_t        sp = t->sp;
+    uint64_t    begin;
 
     pthread_mutex_lock(&sp->sump_mtx);
 
@@ -3794,11 +7730,15 @@ static void ready_in_buf(sp_task_t t)
                               * its first input buffer, it should stop
                               * at end of the current key group */
 
+    begin = sp_get_time_us();
     while (sp->error_code == 0 && !sp->input_eof && 
            t->curr_in_buf_index == sp->cnt_in_buf_readable) /*not yet readable*/
     {
-        pthread_cond_wait(&sp->in_buf_readable_cond, &sp->sump_mtx);
+        park_cond_wait(&sp->in_buf[t->curr_in_buf_index %
+                                   sp->num_in_bufs].readable_park,
+                       &sp->sump_mtx);
     }
+    t->wait_us += sp_get_time_us() - begin;
     
     /* if sp_write_input() has indicated eof and no more readable buffers
      * then that indicates eof for this task.
@@ -3820,12 +7760,71 @@ static void ready_in_buf(sp_task_t t)
         t->in_buf = ib->in_buf;
         t->in_buf_bytes = ib->in_buf_bytes;        
         t->curr_rec = t->in_buf;
+        t->read_begin = t->in_buf;
     }
 
     pthread_mutex_unlock(&sp->sump_mtx);
 }
 
 
+/* resolve_task_start - internal routine for -SPECULATIVE to find the first
+ *                      record of a task in its input buffer by skipping
+ *                      any record remainder and, with -GROUP_BY, any
+ *                      records of the previous task's key group.
+ */
+static void resolve_task_start(sp_task_t t)
+{
+    sp_t        sp = t->sp;
+    in_buf_t    *ib = &sp->in_buf[t->curr_in_buf_index % sp->num_in_bufs];
+    char        *p = t->in_buf;
+    char        *end = t->in_buf + t->in_buf_bytes;
+
+    pthread_mutex_lock(&sp->sump_mtx);
+    if (t->spec_state == SPEC_EMPTY)
+    {
+        /* the previous task has read past this entire buffer and has
+         * done so for this task, and the buffer may already be reused.
+         */
+        pthread_mutex_unlock(&sp->sump_mtx);
+        t->spec_state = SPEC_NONE;
+        t->input_eof = TRUE;
+        return;
+    }
+    ib->own_state = OWN_STARTED;
+    t->spec_state = SPEC_RESOLVING;
+    pthread_mutex_unlock(&sp->sump_mtx);
+
+    if (ib->straddled)
+    {
+        if (ib->starts_partial &&
+            (p = find_delim(sp, p, end - p,
+                            ib->prev_tail, ib->prev_tail_bytes)) == NULL)
+        {
+            p = end;
+        }
+        if (sp->flags & SP_GROUP_BY)
+        {
+            while (p < end && *p != '0')
+                if ((p = find_delim(sp, p, end - p, NULL, 0)) == NULL)
+                    p = end;
+        }
+    }
+    t->curr_rec = p;
+    t->begin_rec = p;
+    t->read_begin = p;
+    ib->spec_start = p - t->in_buf;
+    t->spec_state = SPEC_NONE;
+    /* if the buffer has no first record for this task, the task is empty
+     * rather than a continuation of the previous task's key group.
+     */
+    if (p == end)
+    {
+        done_reading_in_buf(t, FALSE);
+        t->input_eof = TRUE;
+    }
+}
+
+
 /* is_more_input - internal routine to test if there is more input for
  *                 this pump task.  This routine is called after the
  *                 pump function returns to see if there is additonal
@@ -3878,17 +7877,18 @@ static int is_more_input(sp_task_t t)
 }
 
 
-/* pfunc_get_rec - get a pointer to the next input record for a pump function.
- *                 The sump pump infrastructure allocates the record buffers
- *                 and modifies the pointer-to-a-pointer argument to point to
- *                 the buffer. If the record type is text, a null character
- *                 will terminate the record.
+/* get_rec - internal routine to get a pointer to the next input record
+ *           for a pump function.  If view is TRUE and the record lies
+ *           entirely within the current input buffer, the returned pointer
+ *           points into the input buffer and the record is not terminated
+ *           by a null character.  Otherwise the record is copied into the
+ *           task's record buffer.
  *
  * Returns: 0 if no more records are in the sump pump task input, otherwise
- *          the number bytes in the record not including the terminating null
+ *          the number bytes in the record not including any terminating null
  *          character.
  */
-size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
+static size_t get_rec(sp_task_t t, void *ptr_to_rec_ptr, int view)
 {
     void        *buf;
     char        *rec;
@@ -3897,7 +7897,7 @@ size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
     size_t      len;
     size_t      src_size;
     size_t      trans_size;
-    size_t      delim_size = 0;
+    size_t      nul_size = 0;
     sp_t        sp = t->sp;
     int         new_key_group_beginning = FALSE;
 
@@ -3907,7 +7907,7 @@ size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
         return 0;
 
     if (REC_TYPE(sp) == SP_UTF_8)
-        delim_size = 1;
+        nul_size = 1;
     
     /* if we have used all the records in the current input buffer...
      * note that we must be on a record boundry at this point.
@@ -3989,12 +7989,9 @@ size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
         switch (REC_TYPE(sp))
         {
           case SP_UTF_8:
-            next_rec = memchr(rec, *(char *)sp->delimiter, src_size);
+            next_rec = find_delim(sp, rec, src_size, (char *)buf, len);
             if (next_rec != NULL)
-            {
-                next_rec++;         /* skip over newline */
                 trans_size = next_rec - rec;
-            }
             else
                 trans_size = src_size;
             break;
@@ -4010,14 +8007,23 @@ size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
                 next_rec = NULL;
             break;
         }            
-        if (trans_size + len + delim_size > t->rec_buf_size)
+        /* if the caller only wants to view a record that lies entirely
+         * within the input buffer, there is no need to copy it.
+         */
+        if (view && len == 0 && next_rec != NULL)
+        {
+            t->curr_rec = next_rec;
+            *(void **)ptr_to_rec_ptr = rec;
+            return trans_size;
+        }
+        if (trans_size + len + nul_size > t->rec_buf_size)
         {
             size_t new_size;
 
             if (REC_TYPE(sp) == SP_FIXED)
                 new_size = sp->rec_size;
             else
-                new_size = trans_size + len + delim_size + 50;
+                new_size = trans_size + len + nul_size + 50;
             
             if (t->rec_buf == NULL)
                 t->rec_buf = (char *)calloc(1, new_size);
@@ -4038,26 +8044,167 @@ size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
             if (REC_TYPE(sp) == SP_UTF_8)
                 ((char *)buf)[len] = '\0';
             break;
-        }
-        else  /* else we need to get remainder of record from next buffer */
-        {
-            done_reading_in_buf(t, TRUE);
-            ready_in_buf(t);
-            if (t->input_eof)
+        }
+        else  /* else we need to get remainder of record from next buffer */
+        {
+            done_reading_in_buf(t, TRUE);
+            ready_in_buf(t);
+            if (t->input_eof)
+            {
+                if (REC_TYPE(sp) == SP_FIXED)
+                {
+                    die("pfunc_get_rec: partial record of "
+                        "%d bytes found at end of input\n", len);
+                }
+                return 0;
+            }
+            rec = t->curr_rec;
+        }
+    }
+    t->curr_rec = next_rec;
+    *(void **)ptr_to_rec_ptr = buf;
+    return len;
+}
+
+
+/* pfunc_get_rec - get a pointer to the next input record for a pump function.
+ *                 The sump pump infrastructure allocates the record buffers
+ *                 and modifies the pointer-to-a-pointer argument to point to
+ *                 the buffer. If the record type is text, a null character
+ *                 will terminate the record.
+ *
+ * Returns: 0 if no more records are in the sump pump task input, otherwise
+ *          the number bytes in the record not including the terminating null
+ *          character.
+ */
+size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr)
+{
+    return (get_rec(t, ptr_to_rec_ptr, FALSE));
+}
+
+
+/* pfunc_get_rec_view - get a read-only pointer to the next input record for
+ *                      a pump function.  Unlike pfunc_get_rec(), the record
+ *                      is not copied unless it spans two input buffers, so
+ *                      the pointer usually points into the input buffer and
+ *                      a text record is not terminated by a null character.
+ *                      The record must not be modified and is only valid
+ *                      until the next pfunc_get_rec() or pfunc_get_rec_view()
+ *                      call, or until the pump function returns.
+ *
+ * Returns: 0 if no more records are in the sump pump task input, otherwise
+ *          the number bytes in the record, including the newline of a text
+ *          record.
+ */
+size_t pfunc_get_rec_view(sp_task_t t, void *ptr_to_rec_ptr)
+{
+    return (get_rec(t, ptr_to_rec_ptr, TRUE));
+}
+
+
+/* build_rec_index - internal routine to build the index of the ends of
+ *                   the whole text records from the current record to the
+ *                   end of the task's current input buffer.
+ */
+static void build_rec_index(sp_task_t t)
+{
+    sp_t        sp = t->sp;
+    char        *p = t->curr_rec;
+    char        *end = t->in_buf + t->in_buf_bytes;
+    size_t      count = 0;
+
+    while (p < end && (p = find_delim(sp, p, end - p, NULL, 0)) != NULL)
+    {
+        if (count == t->rec_index_size)
+        {
+            t->rec_index_size = t->rec_index_size ? 2 * t->rec_index_size : 256;
+            t->rec_index = (size_t *)realloc(t->rec_index,
+                                             t->rec_index_size *
+                                             sizeof(size_t));
+            if (t->rec_index == NULL)
+                die("build_rec_index: rec_index increase failed: %d\n",
+                    t->rec_index_size);
+        }
+        t->rec_index[count++] = p - t->in_buf;
+    }
+    t->rec_index_count = count;
+    t->rec_index_pos = 0;
+}
+
+
+/* pfunc_get_recs - get read-only pointers to, and the sizes of, up to max
+ *                  of the next input records for a pump function.  The
+ *                  records are as returned by pfunc_get_rec_view(), and are
+ *                  only valid until the next pfunc_get_rec(),
+ *                  pfunc_get_rec_view() or pfunc_get_recs() call, or until
+ *                  the pump function returns.  For text records, the
+ *                  records are found using an index of the record endings
+ *                  that is built once for the task's input buffer.  A
+ *                  record that spans two input buffers is returned by
+ *                  itself.  If -GROUP_BY was specified, only one record
+ *                  is returned per call.
+ *
+ * Returns: 0 if no more records are in the sump pump task input, otherwise
+ *          the number of records returned.
+ */
+size_t pfunc_get_recs(sp_task_t t, void **recs, size_t *sizes, size_t max)
+{
+    sp_t        sp = t->sp;
+    size_t      n = 0;
+    size_t      offset;
+    char        *end;
+
+    if (t->input_eof || max == 0)
+        return (0);
+    /* records can only be batched from the task's first input buffer,
+     * and not when their key groups must be checked.
+     */
+    end = t->in_buf + t->in_buf_bytes;
+    if (!(sp->flags & SP_GROUP_BY) && t->first_in_buf && t->curr_rec < end)
+    {
+        switch (REC_TYPE(sp))
+        {
+          case SP_UTF_8:
+            if (t->rec_index_count == (size_t)-1)
+                build_rec_index(t);
+            /* skip any index entries for records that were returned by
+             * pfunc_get_rec() or pfunc_get_rec_view().
+             */
+            offset = t->curr_rec - t->in_buf;
+            while (t->rec_index_pos < t->rec_index_count &&
+                   t->rec_index[t->rec_index_pos] <= offset)
+            {
+                t->rec_index_pos++;
+            }
+            while (n < max && t->rec_index_pos < t->rec_index_count)
+            {
+                recs[n] = t->curr_rec;
+                sizes[n] = t->rec_index[t->rec_index_pos++] - offset;
+                offset += sizes[n];
+                t->curr_rec += sizes[n];
+                n++;
+            }
+            break;
+
+          case SP_FIXED:
+            while (n < max && t->curr_rec + sp->rec_size <= end)
             {
-                if (REC_TYPE(sp) == SP_FIXED)
-                {
-                    die("pfunc_get_rec: partial record of "
-                        "%d bytes found at end of input\n", len);
-                }
-                return 0;
+                recs[n] = t->curr_rec;
+                sizes[n] = sp->rec_size;
+                t->curr_rec += sp->rec_size;
+                n++;
             }
-            rec = t->curr_rec;
+            break;
         }
+        if (n != 0)
+            return (n);
     }
-    t->curr_rec = next_rec;
-    *(void **)ptr_to_rec_ptr = buf;
-    return len;
+    /* get a single record that either spans input buffers, begins a
+     * new input buffer, or is subject to key grouping.
+     */
+    if ((sizes[0] = get_rec(t, &recs[0], TRUE)) == 0)
+        return (0);
+    return (1);
 }
 
 
@@ -4090,15 +8237,21 @@ int pfunc_get_out_buf(sp_task_t t, unsigned out_index, void **buf, size_t *size)
 
     if (out->bytes_copied == out->size)
     {
-        sp_t    sp = t->sp;
+        sp_t            sp = t->sp;
+        uint64_t        begin;
         
         TRACE("pfunc_get_out_buf: waking output reader\n");
         pthread_mutex_lock(&sp->sump_mtx);
-        out->stalled = TRUE;
-        pthread_cond_broadcast(&sp->task_output_ready_cond);
-        TRACE("pfunc_get_out_buf: waiting for available output buffer\n");
-        while (out->stalled && sp->error_code == 0)
-            pthread_cond_wait(&sp->task_output_empty_cond, &sp->sump_mtx);
+        if (!chain_out_seg(sp, t, out_index))
+        {
+            out->stalled = TRUE;
+            task_output_ready(sp, t, out_index);
+            TRACE("pfunc_get_out_buf: waiting for available output buffer\n");
+            begin = sp_get_time_us();
+            while (out->stalled && sp->error_code == 0)
+                park_cond_wait(&t->out_empty_park, &sp->sump_mtx);
+            t->wait_us += sp_get_time_us() - begin;
+        }
         pthread_mutex_unlock(&sp->sump_mtx);
         if (sp->error_code != 0)
             return (-1);
@@ -4154,166 +8307,759 @@ int pfunc_printf(sp_task_t t, unsigned out_index, const char *fmt, ...)
 #if defined(win_nt)
     if (ret == -1)  /* non-standard vsnprintf overflow indicator on Windows */
     {
-        va_start(ap, fmt);
-        ret = _vscprintf(fmt, ap);
-        va_end(ap);
+        va_start(ap, fmt);
+        ret = _vscprintf(fmt, ap);
+        va_end(ap);
+    }
+#endif
+    if ((size_t)ret >= t->temp_buf_size)
+    {
+        /* temp buf wasn't big enough.  enlarge it and redo */
+        if (t->temp_buf_size != 0)
+            free(t->temp_buf);
+        t->temp_buf_size = ret + 10;
+        t->temp_buf = (char *)malloc(t->temp_buf_size);
+        va_start(ap, fmt);
+        ret = vsnprintf(t->temp_buf, t->temp_buf_size, fmt, ap);
+        va_end(ap);
+    }
+    return ((int)pfunc_write(t, out_index, t->temp_buf, ret));
+}
+
+
+/* pfunc_error - raise an error for a pump function and define an error 
+ *               string that can be retrived by other threads using
+ *               sp_get_error_string().
+ *
+ * Returns: SP_PUMP_FUNCTION_ERROR
+ */
+int pfunc_error(sp_task_t t, const char *fmt, ...)
+{
+    va_list     ap;
+    int         ret;
+
+    if (t->error_code != 0)            /* if prior error */
+        return SP_PUMP_FUNCTION_ERROR;   /* ignore this one */
+    t->error_code = SP_PUMP_FUNCTION_ERROR;
+    
+    va_start(ap, fmt);
+    ret = vsnprintf(t->error_buf, t->error_buf_size, fmt, ap);
+    va_end(ap);
+#if defined(win_nt)
+    if (ret == -1)  /* non-standard vsnprintf overflow indicator on Windows */
+    {
+        va_start(ap, fmt);
+        ret = _vscprintf(fmt, ap);
+        va_end(ap);
+    }
+#endif
+    if ((size_t)ret >= t->error_buf_size)
+    {
+        if (t->error_buf_size != 0)
+            free(t->error_buf);
+        t->error_buf_size = (size_t)ret + 1;
+        t->error_buf = (char *)malloc(t->error_buf_size);
+        va_start(ap, fmt);
+        vsnprintf(t->error_buf, t->error_buf_size, fmt, ap);
+        va_end(ap);
+    }
+    
+    return SP_PUMP_FUNCTION_ERROR;
+}
+
+
+/* clamp_in_buf_fill - internal routine to limit an input buffer fill size
+ *                     to the range allowed by -IN_BUF_SIZE=AUTO.
+ */
+static size_t clamp_in_buf_fill(sp_t sp, double fill)
+{
+    size_t      size = (size_t)sp->in_buf_size;
+    size_t      unit;
+
+    if (fill < (double)size)
+        size = (size_t)fill;
+    if (size < sp->in_buf_size / AUTO_FILL_RANGE)
+        size = sp->in_buf_size / AUTO_FILL_RANGE;
+    /* keep the fill size a multiple of the page size if the buffer size
+     * is, since direct reads are made into the input buffers.
+     */
+    if (sp->in_buf_size % PAGE_SIZE == 0)
+    {
+        size -= size % PAGE_SIZE;
+        if (size < PAGE_SIZE)
+            size = PAGE_SIZE;
+    }
+    if (REC_TYPE(sp) == SP_FIXED && sp->align_in_bufs)
+    {
+        unit = sp->rec_size + ((sp->flags & SP_GROUP_BY) ? 1 : 0);
+        size -= size % unit;
+        if (size < unit)
+            size = unit;
+    }
+    if (size == 0)
+        size = 1;
+    return (size);
+}
+
+
+/* adapt_in_buf_fill - internal routine called by a sump pump thread that
+ *                     has completed a task to update the sump pump
+ *                     statistics and, for -IN_BUF_SIZE=AUTO, to choose
+ *                     the input buffer fill size that should make a task
+ *                     take the -TASK_TIME.  The time a task spends waiting
+ *                     for input or output buffers is not counted as the
+ *                     cost of its input.  The sump_mtx should be locked.
+ */
+static void adapt_in_buf_fill(sp_t sp, sp_task_t t)
+{
+    uint64_t    elapsed = sp_get_time_us() - t->begin_us;
+    uint64_t    busy;
+    double      cost;
+
+    busy = elapsed > t->wait_us ? elapsed - t->wait_us : 0;
+    sp->stat_tasks++;
+    sp->stat_in_bytes += t->in_bytes_read;
+    sp->stat_busy_us += busy;
+    sp->stat_wait_us += elapsed - busy;
+
+    if (!sp->auto_in_buf_size || t->in_bytes_read == 0 || t->error_code)
+        return;
+    /* smooth the cost per byte over the last several tasks */
+    cost = (double)busy / (double)t->in_bytes_read;
+    if (sp->us_per_byte == 0.0)
+        sp->us_per_byte = cost;
+    else
+        sp->us_per_byte = (3.0 * sp->us_per_byte + cost) / 4.0;
+    if (sp->us_per_byte > 0.0)
+        sp->in_buf_fill = clamp_in_buf_fill(sp, (double)sp->task_time_us /
+                                            sp->us_per_byte);
+    else
+        sp->in_buf_fill = sp->in_buf_size;
+    TRACE("adapt_in_buf_fill: %.6f us/byte, fill %d\n",
+          sp->us_per_byte, (int)sp->in_buf_fill);
+}
+
+
+/* try_claim_task - internal routine to claim the next initialized task
+ *                  of a sump pump, if any, with a compare-and-swap of
+ *                  cnt_task_begun.  The node is the NUMA node of the
+ *                  calling thread, or -1.  With -NUMA, a task whose input
+ *                  buffer is on another node is left to an idle thread on
+ *                  that node for a moment before taking it, once per
+ *                  *deferred.
+ *
+ * Returns: 1 if task number *begun was claimed, 0 if no task is available
+ *          yet, or -1 if the sump pump has no more tasks to run because
+ *          of input EOF or an error.
+ */
+static int try_claim_task(sp_t sp, int node, int *deferred, uint64_t *begun)
+{
+    sp_task_t           t;
+    int                 input_eof;
+    uint64_t            b;
+    unsigned            i;
+
+    for (;;)
+    {
+        /* input_eof must be read before cnt_task_init since the last
+         * task is published before input_eof is set.
+         */
+        input_eof = sp->input_eof;
+        SP_MEMORY_BARRIER();
+        b = sp->cnt_task_begun;
+        if (sp->error_code != 0 || (b == sp->cnt_task_init && input_eof))
+            return (-1);
+        if (b >= sp->cnt_task_init)
+            return (0);
+        t = TASK_BY_NUMBER(sp, b);
+        if (node >= 0 && !*deferred && t->node >= 0 &&
+            t->node != node && sp->numa_idle[t->node] != 0)
+        {
+            *deferred = TRUE;
+            for (i = 0; i < NUMA_DEFER_SPINS && sp->cnt_task_begun == b; i++)
+                SP_CPU_RELAX();
+            continue;
+        }
+        if (SP_CAS64(&sp->cnt_task_begun, b, b + 1))
+        {
+            *begun = b;
+            return (1);
+        }
+        /* lost the race for this task, try again */
+    }
+}
+
+
+/* run_task - internal routine to run the pump function on a claimed task
+ *            and publish its output, using the given thread index.  The
+ *            node is the NUMA node of the calling thread, or -1.
+ */
+static void run_task(sp_t sp, sp_task_t t, unsigned thread_index, int node,
+                     uint64_t idle_begin)
+{
+    int                 ret;
+    uint64_t            idle_us;
+    unsigned            i;
+
+    t->thread_index = thread_index;
+    t->begin_us = sp_get_time_us();
+    t->wait_us = 0;
+    idle_us = t->begin_us - idle_begin;
+
+    TRACE("pump%d: calling pump func with %d input bytes\n",
+          thread_index, (int)t->in_buf_bytes);
+
+    if (REC_TYPE(sp) == SP_WHOLE_BUF)
+    {
+        TRACE("pump%d: calling pump func() block\n", thread_index);
+        ret = (*sp->pump_func)(t, sp->pump_arg);
+        TRACE("pump%d: pump func returned %d\n", thread_index, ret);
+        if (ret)
+        {
+            if (t->error_code == 0)
+                t->error_code = ret;
+        }
+        else
+        {
+            done_reading_in_buf(t, TRUE);
+            t->input_eof = TRUE;
+        }
+    }
+    else
+    {
+        if (t->spec_state != SPEC_NONE)
+            resolve_task_start(t);
+        while (is_more_input(t) && t->error_code == 0)
+        {
+            TRACE("pump%d: calling pump func()\n", thread_index);
+            /* indicate first record in key group not yet read */
+            t->first_group_rec = TRUE;
+            ret = (*sp->pump_func)(t, sp->pump_arg);
+            TRACE("pump%d: pump func returned %d, input_eof: %d\n",
+                  thread_index, ret, t->input_eof);
+            if (ret && t->error_code == 0)
+                t->error_code = ret;
+        }
+    }
+    TRACE("pump%d: pump_func returns with %d out[0] bytes\n",
+          thread_index, t->out[0].bytes_copied);
+    pthread_mutex_lock(&sp->sump_mtx);
+    sp->stat_idle_us += idle_us;
+    if (node >= 0 && t->node >= 0 && t->node != node)
+    {
+        sp->stat_numa_remote_tasks++;
+        sp->stat_numa_remote_bytes += t->in_bytes_read;
+    }
+    adapt_in_buf_fill(sp, t);
+    if (t->error_code && sp->error_code == 0)
+    {
+        sp->error_code = t->error_code;
+        if (sp->error_buf != NULL)
+            free(sp->error_buf);
+        sp->error_buf = t->error_buf;
+        t->error_buf = NULL;
+        broadcast_all_conds(sp);
+    }
+    pthread_mutex_unlock(&sp->sump_mtx);
+
+    TRACE("pump%d: waking output reader\n", thread_index);
+    TRACE("pump%d: waking input writer\n", thread_index);
+    pthread_mutex_lock(&sp->sump_mtx);
+    t->output_eof = TRUE;
+    sp->cnt_task_pumped++;
+    for (i = 0; i < sp->num_outputs; i++)
+        task_output_ready(sp, t, i);
+    pthread_mutex_unlock(&sp->sump_mtx);
+    /* NOTA BENE: do not use "t" pointer after this point since the
+     * struct that it points to can be reused immediately */
+}
+
+
+/* pump_thread_main - the internal "main" routine of a sump pump thread.
+ */
+static void *pump_thread_main(void *arg)
+{
+    unsigned            thread_index;
+    sp_t                sp = (sp_t)arg;
+    int                 ret;
+    int                 seq;
+    uint64_t            begun;
+    uint64_t            idle_begin;
+    int                 node;
+    int                 deferred;
+
+    for (thread_index = 0; thread_index < sp->num_threads; thread_index++)
+#if defined(win_nt)
+        if (sp->thread[thread_index].id == GetCurrentThreadId())
+#else
+        if (sp->thread[thread_index] == pthread_self())
+#endif
+            break;
+    TRACE("pump thread %d starting\n", thread_index);
+    if (sp->prefault)
+        prefault_bufs(sp);
+    node = numa_thread_node(sp);
+    for (;;)
+    {
+        TRACE("pump%d: waiting for an available task\n", thread_index);
+        idle_begin = sp_get_time_us();
+        if (node >= 0)
+            SP_ATOMIC_ADD32(&sp->numa_idle[node], 1);
+        deferred = FALSE;
+        /* park only when the task ring is empty */
+        for (;;)
+        {
+            seq = park_prepare(sp->task_avail);
+            if ((ret = try_claim_task(sp, node, &deferred, &begun)) != 0)
+                break;
+            /* let a writer waiting for a full task or input buffer ring
+             * see that this thread is idle.
+             */
+            if (sp->elastic)
+            {
+                park_wake(&sp->task_drained_park, FALSE);
+                park_wake(&sp->in_buf_done_park, FALSE);
+            }
+            park_wait(sp->task_avail, seq);
+        }
+        if (node >= 0)
+            SP_ATOMIC_ADD32(&sp->numa_idle[node], -1);
+        if (ret < 0)
+        {
+            TRACE("pump%d: breaking out of for loop: error_code: %d, input_eof %d\n",
+                  thread_index, sp->error_code, sp->input_eof);
+            break;
+        }
+        run_task(sp, TASK_BY_NUMBER(sp, begun), thread_index, node,
+                 idle_begin);
+    }
+    TRACE("pump%d: exiting\n", thread_index);
+
+    return (NULL);
+}
+
+
+/* executor_main - the internal "main" routine of an -EXECUTOR worker
+ *                 thread.  A worker claims the next task of any pump that
+ *                 is below its -THREADS cap, taking turns among the pumps.
+ *                 So that a pipeline of pumps cannot deadlock with all the
+ *                 workers stalled in the tasks of some of them, a worker
+ *                 is always left for each pump that is not running a task.
+ */
+static void *executor_main(void *arg)
+{
+    struct executor     *ex = (struct executor *)arg;
+    sp_t                sp;
+    sp_t                *pp;
+    sp_t                *tail;
+    uint64_t            begun;
+    uint64_t            idle_begin;
+    unsigned            slot;
+    unsigned            reserve;
+    int                 seq;
+    int                 ret;
+    int                 deferred = TRUE;
+
+    idle_begin = sp_get_time_us();
+    for (;;)
+    {
+        seq = park_prepare(&ex->work_park);
+        pthread_mutex_lock(&ex->mtx);
+        if (ex->shutdown)
+        {
+            pthread_mutex_unlock(&ex->mtx);
+            break;
+        }
+        for (pp = &ex->pumps; (sp = *pp) != NULL; pp = &sp->ex_next)
+        {
+            if (sp->ex_done || sp->ex_running >= sp->num_threads)
+                continue;
+            reserve = ex->num_idle_pumps - (sp->ex_running == 0 ? 1 : 0);
+            if (ex->num_running + 1 + reserve > ex->num_workers)
+                continue;
+            ret = try_claim_task(sp, -1, &deferred, &begun);
+            if (ret > 0)
+                break;
+            if (ret < 0)
+            {
+                sp->ex_done = TRUE;
+                if (sp->ex_running == 0)
+                {
+                    ex->num_idle_pumps--;
+                    park_wake(&sp->ex_done_park, TRUE);
+                }
+            }
+        }
+        if (sp == NULL)
+        {
+            pthread_mutex_unlock(&ex->mtx);
+            park_wait(&ex->work_park, seq);
+            continue;
+        }
+        if (sp->ex_running++ == 0)
+            ex->num_idle_pumps--;
+        ex->num_running++;
+        slot = sp->ex_free_slots[--sp->num_ex_free_slots];
+        /* move the pump to the end of the list */
+        *pp = sp->ex_next;
+        for (tail = pp; *tail != NULL; tail = &(*tail)->ex_next)
+            continue;
+        *tail = sp;
+        sp->ex_next = NULL;
+        pthread_mutex_unlock(&ex->mtx);
+
+        run_task(sp, TASK_BY_NUMBER(sp, begun), slot, -1, idle_begin);
+
+        pthread_mutex_lock(&ex->mtx);
+        sp->ex_free_slots[sp->num_ex_free_slots++] = slot;
+        ex->num_running--;
+        if (--sp->ex_running == 0)
+        {
+            if (!sp->ex_done)
+                ex->num_idle_pumps++;
+            park_wake(&sp->ex_done_park, TRUE);
+        }
+        if (sp->elastic)
+        {
+            park_wake(&sp->task_drained_park, FALSE);
+            park_wake(&sp->in_buf_done_park, FALSE);
+        }
+        pthread_mutex_unlock(&ex->mtx);
+        idle_begin = sp_get_time_us();
+    }
+    return (NULL);
+}
+
+
+/* join_executor - internal routine to have the tasks of a sump pump run
+ *                 by the -EXECUTOR workers, creating the executor if no
+ *                 other sump pump is using it.  The executor has at least
+ *                 as many workers as pumps.
+ *
+ * Returns: SP_OK or SP_MEM_ALLOC_ERROR
+ */
+static int join_executor(sp_t sp)
+{
+    struct executor     *ex;
+    pthread_t           *workers;
+    sp_t                p;
+    unsigned            n;
+    unsigned            i;
+    int                 ret;
+
+    sp->ex_free_slots = (unsigned *)malloc(sp->num_threads * sizeof(unsigned));
+    if (sp->ex_free_slots == NULL)
+        return (SP_MEM_ALLOC_ERROR);
+    for (i = 0; i < sp->num_threads; i++)
+        sp->ex_free_slots[i] = sp->num_threads - 1 - i;
+    sp->num_ex_free_slots = sp->num_threads;
+
+    pthread_mutex_lock(&Global_lock);
+    if ((ex = Executor) == NULL)
+    {
+        if ((ex = (struct executor *)calloc(1, sizeof(struct executor))) == NULL)
+        {
+            pthread_mutex_unlock(&Global_lock);
+            return (SP_MEM_ALLOC_ERROR);
+        }
+        pthread_mutex_init(&ex->mtx, NULL);
+        park_init(&ex->work_park);
+        Executor = ex;
+    }
+    ex->users++;
+    sp->executor = ex;
+    sp->task_avail = &ex->work_park;
+
+    pthread_mutex_lock(&ex->mtx);
+    sp->ex_next = ex->pumps;
+    ex->pumps = sp;
+    ex->num_idle_pumps++;
+    if ((n = ex->num_workers) == 0)
+        n = sp->ex_workers != 0 ?
+            sp->ex_workers : (unsigned)get_logical_processor_count();
+    for (i = 0, p = ex->pumps; p != NULL; p = p->ex_next)
+        i++;
+    if (n < i)
+        n = i;
+    pthread_mutex_unlock(&ex->mtx);
+
+    if (n > ex->max_workers)
+    {
+        workers = (pthread_t *)realloc(ex->workers, n * sizeof(pthread_t));
+        if (workers == NULL)
+            die("join_executor: realloc() failed\n");
+        ex->workers = workers;
+        ex->max_workers = n;
     }
-#endif
-    if ((size_t)ret >= t->temp_buf_size)
+    /* the workers run the tasks of every pump using the executor, so they
+     * are not bound to the -CPUS or -NUMA nodes of the pump creating them.
+     */
+    for (i = ex->num_workers; i < n; i++)
     {
-        /* temp buf wasn't big enough.  enlarge it and redo */
-        if (t->temp_buf_size != 0)
-            free(t->temp_buf);
-        t->temp_buf_size = ret + 10;
-        t->temp_buf = (char *)malloc(t->temp_buf_size);
-        va_start(ap, fmt);
-        ret = vsnprintf(t->temp_buf, t->temp_buf_size, fmt, ap);
-        va_end(ap);
+        ret = pthread_create(&ex->workers[i], NULL, executor_main, (void *)ex);
+        if (ret)
+            die("pthread_create() failed: %d\n", ret);
     }
-    return ((int)pfunc_write(t, out_index, t->temp_buf, ret));
+    pthread_mutex_lock(&ex->mtx);
+    ex->num_workers = n;
+    pthread_mutex_unlock(&ex->mtx);
+    pthread_mutex_unlock(&Global_lock);
+    return (SP_OK);
 }
 
 
-/* pfunc_error - raise an error for a pump function and define an error 
- *               string that can be retrived by other threads using
- *               sp_get_error_string().
- *
- * Returns: SP_PUMP_FUNCTION_ERROR
+/* leave_executor - internal routine to stop using the -EXECUTOR, shutting
+ *                  down its workers if no other sump pump is using it.
  */
-int pfunc_error(sp_task_t t, const char *fmt, ...)
+static void leave_executor(sp_t sp)
 {
-    va_list     ap;
-    int         ret;
+    struct executor     *ex = sp->executor;
+    unsigned            i;
 
-    if (t->error_code != 0)            /* if prior error */
-        return SP_PUMP_FUNCTION_ERROR;   /* ignore this one */
-    t->error_code = SP_PUMP_FUNCTION_ERROR;
-    
-    va_start(ap, fmt);
-    ret = vsnprintf(t->error_buf, t->error_buf_size, fmt, ap);
-    va_end(ap);
-#if defined(win_nt)
-    if (ret == -1)  /* non-standard vsnprintf overflow indicator on Windows */
-    {
-        va_start(ap, fmt);
-        ret = _vscprintf(fmt, ap);
-        va_end(ap);
-    }
-#endif
-    if ((size_t)ret >= t->error_buf_size)
+    executor_wait(sp);
+    pthread_mutex_lock(&Global_lock);
+    if (--ex->users != 0)
     {
-        if (t->error_buf_size != 0)
-            free(t->error_buf);
-        t->error_buf_size = (size_t)ret + 1;
-        t->error_buf = (char *)malloc(t->error_buf_size);
-        va_start(ap, fmt);
-        vsnprintf(t->error_buf, t->error_buf_size, fmt, ap);
-        va_end(ap);
+        pthread_mutex_unlock(&Global_lock);
+        return;
     }
-    
-    return SP_PUMP_FUNCTION_ERROR;
+    Executor = NULL;
+    pthread_mutex_unlock(&Global_lock);
+
+    pthread_mutex_lock(&ex->mtx);
+    ex->shutdown = TRUE;
+    pthread_mutex_unlock(&ex->mtx);
+    park_wake(&ex->work_park, TRUE);
+    for (i = 0; i < ex->num_workers; i++)
+        pthread_join(ex->workers[i], NULL);
+    pthread_mutex_destroy(&ex->mtx);
+    park_destroy(&ex->work_park);
+    free(ex->workers);
+    free(ex);
 }
 
 
-/* pump_thread_main - the internal "main" routine of a sump pump thread.
+/* output_task - internal routine to get the task whose output should be
+ *               read next by the reader of the specified output, or NULL
+ *               if the task is not yet known.  The sump_mtx should
+ *               already be locked.
+ *
+ *               An unordered output takes the done task whose output
+ *               became ready first.  Since a stalled task's output must be
+ *               read in its entirety before the output of another task, a
+ *               stalled task is only taken if it is the oldest task that
+ *               is not done.  Otherwise the stalled task could wait for
+ *               an input buffer or another output reader that is in turn
+ *               waiting for an older task, which is waiting for this
+ *               output reader.
  */
-static void *pump_thread_main(void *arg)
+static sp_task_t output_task(sp_t sp, unsigned index)
 {
+    struct sump_out     *o = sp->out + index;
     sp_task_t           t;
-    unsigned            thread_index;
-    sp_t                sp = (sp_t)arg;
-    int                 ret;
+    sp_task_t           oldest = NULL;
+    sp_task_t           best = NULL;
+    unsigned            i;
 
-    for (thread_index = 0; thread_index < sp->num_threads; thread_index++)
-#if defined(win_nt)
-        if (sp->thread[thread_index].id == GetCurrentThreadId())
-#else
-        if (sp->thread[thread_index] == pthread_self())
-#endif
-            break;
-    TRACE("pump thread %d starting\n", thread_index);
-    for (;;)
+    if (o->curr_task == NULL)
     {
-        TRACE("pump%d: waiting for an available task\n", thread_index);
-        pthread_mutex_lock(&sp->sump_mtx);
-        while (sp->cnt_task_begun == sp->cnt_task_init &&
-               sp->error_code == 0 &&
-               sp->input_eof == FALSE)
-        {
-            pthread_cond_wait(&sp->task_avail_cond, &sp->sump_mtx);
-        }
-        if (sp->error_code != 0 ||
-            (sp->input_eof == TRUE && sp->cnt_task_begun == sp->cnt_task_init))
-        {
-            pthread_mutex_unlock(&sp->sump_mtx);
-            TRACE("pump%d: breaking out of for loop: error_code: %d, input_eof %d\n",
-                  thread_index, sp->error_code, sp->input_eof);
-            break;
-        }
-        t = &sp->task[sp->cnt_task_begun % sp->num_tasks];
-        sp->cnt_task_begun++;
-        t->thread_index = thread_index;
-        pthread_mutex_unlock(&sp->sump_mtx);
-
-        TRACE("pump%d: calling pump func with %d input bytes\n",
-              thread_index, (int)t->in_buf_bytes);
-
-        if (REC_TYPE(sp) == SP_WHOLE_BUF)
+        if (o->unordered)
         {
-            TRACE("pump%d: calling pump func() block\n", thread_index);
-            ret = (*sp->pump_func)(t, sp->pump_arg);
-            TRACE("pump%d: pump func returned %d\n", thread_index, ret);
-            if (ret)
+            /* find the oldest task that is not done.  unused task
+             * structs have their output_eof set.
+             */
+            for (i = 0; i < sp->num_tasks; i++)
             {
-                if (t->error_code == 0)
-                    t->error_code = ret;
+                t = &sp->task[i];
+                if (!t->output_eof &&
+                    (oldest == NULL || t->task_number < oldest->task_number))
+                {
+                    oldest = t;
+                }
             }
-            else
+            for (i = 0; i < sp->num_tasks; i++)
             {
-                done_reading_in_buf(t, TRUE);
-                t->input_eof = TRUE;
+                t = &sp->task[i];
+                if (t->out[index].queued && !t->out[index].taken &&
+                    (t->output_eof || t == oldest) &&
+                    (best == NULL ||
+                     t->out[index].ready_seq < best->out[index].ready_seq))
+                {
+                    best = t;
+                }
             }
-        }
-        else
-        {
-            while (is_more_input(t) && t->error_code == 0)
+            if (best != NULL)
             {
-                TRACE("pump%d: calling pump func()\n", thread_index);
-                /* indicate first record in key group not yet read */
-                t->first_group_rec = TRUE;
-                ret = (*sp->pump_func)(t, sp->pump_arg);
-                TRACE("pump%d: pump func returned %d, input_eof: %d\n",
-                      thread_index, ret, t->input_eof);
-                if (ret && t->error_code == 0)
-                    t->error_code = ret;
+                best->out[index].taken = TRUE;
+                o->curr_task = best;
             }
         }
-        TRACE("pump%d: pump_func returns with %d out[0] bytes\n",
-              thread_index, t->out[0].bytes_copied);
-        pthread_mutex_lock(&sp->sump_mtx);
-        if (t->error_code && sp->error_code == 0)
+        else if (o->cnt_task_drained < sp->cnt_task_init)
+            o->curr_task = TASK_BY_NUMBER(sp, o->cnt_task_drained);
+    }
+    return (o->curr_task);
+}
+
+
+/* wait_output_ready - internal routine to wait until the next task output
+ *                     buffer to be read for the specified output is ready,
+ *                     or output EOF or an error has occurred.
+ *
+ * Returns: TRUE if the output buffer of sp->out[index].curr_task is ready,
+ *          FALSE at output EOF or if an error has occurred.
+ */
+static int wait_output_ready(sp_t sp, unsigned index)
+{
+    int                 out_eof;
+    sp_task_t           t = NULL;
+
+    TRACE("wait_output_ready: waiting for input\n");
+    pthread_mutex_lock(&sp->sump_mtx);
+
+    /* while 1) a sump pump error hasn't occurred.
+     * and   2) it's not the case that
+     *          a) EOF on input has been reached
+     *          b) all initialized tasks have begun (been taken), and
+     *          c) all taken tasks have had their output read, and
+     * and   3) it's not the case the next task to be read (the
+     *          oldest task, or for an unordered output the
+     *          oldest ready task) is either done or stalled, or has
+     *          an overflow segment
+     */
+    while (sp->error_code == 0 &&
+           !(out_eof = (sp->input_eof &&
+                        sp->cnt_task_init == sp->cnt_task_begun &&
+                        sp->cnt_task_begun == sp->out[index].cnt_task_drained)) &&
+           !((t = output_task(sp, index)) != NULL &&
+             (t->out[index].stalled || t->output_eof ||
+              t->out[index].seg_head != NULL)))
+    {
+        TRACE("wait_output_ready: waiting\n");
+        TRACE("wait_output_ready: cnt_task_init: %d\n",
+              sp->cnt_task_init);
+        TRACE("wait_output_ready: cnt_task_begun: %d\n",
+              sp->cnt_task_begun);
+        TRACE("wait_output_ready: out[%d].cnt_task_drained: %d\n",
+              index, sp->out[index].cnt_task_drained);
+        park_cond_wait(&sp->out[index].ready_park, &sp->sump_mtx);
+    }
+    TRACE("wait_output_ready: DONE WAITING\n");
+    TRACE("wait_output_ready: error_code: %d\n", sp->error_code);
+    TRACE("wait_output_ready: cnt_task_init: %d\n", sp->cnt_task_init);
+    TRACE("wait_output_ready: cnt_task_begun: %d\n", sp->cnt_task_begun);
+    TRACE("wait_output_ready: out[%d].cnt_task_drained: %d\n",
+          index, sp->out[index].cnt_task_drained);
+    TRACE("wait_output_ready: out_eof: %d\n", out_eof);
+    /* the overflow segments of a task are read before its output buffer */
+    if (sp->error_code == 0 && !out_eof)
+        sp->out[index].curr_seg = t->out[index].seg_head;
+    pthread_mutex_unlock(&sp->sump_mtx);
+    return (sp->error_code == 0 && !out_eof);
+}
+
+
+/* advance_output_task - internal routine to advance the specified output
+ *                       past the output of its current task, which is done.
+ *                       The caller must hold sump_mtx.
+ */
+static void advance_output_task(sp_t sp, unsigned index)
+{
+    /* increment per-output task output drained count */
+    sp->out[index].cnt_task_drained++;
+    sp->out[index].curr_task = NULL;
+    TRACE("advance_output_task: sp->out[%d].cnt_task_drained incr to %d\n",
+          index, sp->out[index].cnt_task_drained);
+}
+
+
+/* retire_task_output - internal routine called once one of the outputs of
+ *                      a done task has been completely read, to make the
+ *                      task struct available for reuse after the last one.
+ *                      The caller must hold sump_mtx.
+ */
+static void retire_task_output(sp_t sp, sp_task_t t)
+{
+    TRACE("retire_task_output: t->outs_drained before incr is: %d\n",
+          t->outs_drained);
+
+    /* if all output buffers for this task have been drained */
+    if (++t->outs_drained == sp->num_outputs)  
+    {
+        /* make the task struct available for reuse, increment
+         * sump pump task drained count and wake the
+         * sp_write_input() caller if it is waiting for a task.
+         */
+        if (sp->buf_pool != NULL ||
+            sp->num_task_bufs > sp->num_tasks_active)
         {
-            sp->error_code = t->error_code;
-            if (sp->error_buf != NULL)
-                free(sp->error_buf);
-            sp->error_buf = t->error_buf;
-            t->error_buf = NULL;
-            broadcast_all_conds(sp);
+            free_task_bufs(sp, t);
         }
-        pthread_mutex_unlock(&sp->sump_mtx);
+        sp->free_task[sp->num_free_tasks++] = (unsigned)(t - sp->task);
+        SP_ATOMIC_ADD64(&sp->cnt_task_drained, 1);
+        TRACE("retire_task_output: sp->cnt_task_drained incr to: %d\n",
+              sp->cnt_task_drained);
+        park_wake(&sp->task_drained_park, FALSE);
+    }
+}
 
-        TRACE("pump%d: waking output reader\n", thread_index);
-        TRACE("pump%d: waking input writer\n", thread_index);
-        pthread_mutex_lock(&sp->sump_mtx);
-        t->output_eof = TRUE;
-        pthread_cond_broadcast(&sp->task_output_ready_cond);
-        pthread_mutex_unlock(&sp->sump_mtx);
-        /* NOTA BENE: do not use "t" pointer after this point since the
-         * struct that it points to can be reused immediately */
+
+/* drain_output_buf - internal routine called once the bytes in a task's
+ *                    output buffer have all been read, to either let the
+ *                    stalled task continue filling the buffer or, if the
+ *                    task is done, advance to the next task's output.
+ */
+static void drain_output_buf(sp_t sp, unsigned index, sp_task_t t)
+{
+    struct out_seg      *seg;
+
+    TRACE("drain_output_buf: waking reader thread\n");
+    pthread_mutex_lock(&sp->sump_mtx);
+    if ((seg = sp->out[index].curr_seg) != NULL)
+    {
+        /* return the overflow segment to the pool */
+        if ((t->out[index].seg_head = seg->next) == NULL)
+            t->out[index].seg_tail = NULL;
+        seg->next = sp->out[index].free_segs;
+        sp->out[index].free_segs = seg;
+        sp->out[index].curr_seg = NULL;
+    }
+    else if (t->out[index].stalled)
+    {
+        /* we have copied the bytes in the buf.  clear the buf
+         * and stall indicator, then wake only the stalled thread
+         * of this task.
+         */
+        t->out[index].bytes_copied = 0;
+        t->out[index].stalled = FALSE;
+        park_wake(&t->out_empty_park, FALSE);
+    }
+    else
+    {
+        advance_output_task(sp, index);
+        retire_task_output(sp, t);
     }
-    TRACE("pump%d: exiting\n", thread_index);
 
-    return (NULL);
+    pthread_mutex_unlock(&sp->sump_mtx);
+}
+
+
+/* output_src - internal routine to get the bytes to be read next for the
+ *              specified output from the task whose output is being read:
+ *              its first overflow segment, otherwise its output buffer.
+ *
+ * Returns: a pointer to the bytes, with their number in *bytes.
+ */
+static char *output_src(sp_t sp, unsigned index, sp_task_t t, size_t *bytes)
+{
+    struct out_seg      *seg = sp->out[index].curr_seg;
+
+    if (seg != NULL)
+    {
+        *bytes = seg->bytes;
+        return (seg->buf);
+    }
+    *bytes = t->out[index].bytes_copied;
+    return (t->out[index].buf);
 }
 
 
@@ -4324,15 +9070,15 @@ static void *pump_thread_main(void *arg)
  */
 ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size)
 {
-    int                 out_eof;
     ssize_t             bytes_returned = 0;
     ssize_t             src_remaining = size;
     ssize_t             dst_remaining;
     ssize_t             trans_size;
     char                *trans_src;
     char                *trans_dst;
+    char                *src;
+    size_t              src_bytes;
     sp_task_t           t;
-    struct task_out     *out;
 
     TRACE("sp_read_output[%d]: buf %08x, size %d\n", index, buf, size);
 
@@ -4437,68 +9183,21 @@ ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size)
               "partial_bytes_copied: %d\n",
               index, sp->out[index].cnt_task_drained,
               sp->out[index].partial_bytes_copied);
-        t = &sp->task[sp->out[index].cnt_task_drained % sp->num_tasks];
-        out = t->out + index;
 
         /* if we aren't in the middle of copy out a task's buffer, then
          * we must potentially wait for the output of the next task.
          */
-        if (sp->out[index].partial_bytes_copied == 0)
+        if (sp->out[index].partial_bytes_copied == 0 &&
+            !wait_output_ready(sp, index))
         {
-            TRACE("sp_read_output: waiting for input\n");
-            pthread_mutex_lock(&sp->sump_mtx);
-
-            /* while 1) a sump pump error hasn't occurred.
-             * and   2) it's not the case that
-             *          a) EOF on input has been reached
-             *          b) all initialized tasks have begun (been taken), and
-             *          c) all taken tasks have had their output read, and
-             * and   3) it's not the case oldest sump pump task is either
-             *          done or stalled
-             */
-            while (sp->error_code == 0 &&
-                   !(out_eof = (sp->input_eof &&
-                                sp->cnt_task_init == sp->cnt_task_begun &&
-                                sp->cnt_task_begun == sp->out[index].cnt_task_drained)) &&
-                   !(sp->out[index].cnt_task_drained < sp->cnt_task_begun &&
-                     (out->stalled || t->output_eof)))
-            {
-                TRACE("sp_read_output: waiting\n");
-                TRACE("sp_read_output: cnt_task_init: %d\n",
-                      sp->cnt_task_init);
-                TRACE("sp_read_output: cnt_task_begun: %d\n",
-                      sp->cnt_task_begun);
-                TRACE("sp_read_output: out[%d].cnt_task_drained: %d\n",
-                      index, sp->out[index].cnt_task_drained);
-                TRACE("sp_read_output: out->bytes_copied: %d\n",
-                      out->bytes_copied);
-                TRACE("sp_read_output: t->in_buf_bytes: %d\n",
-                      t->in_buf_bytes);
-                TRACE("sp_read_output: out->stalled: %d\n", out->stalled);
-                TRACE("sp_read_output: t->output_eof: %d\n", t->output_eof);
-                pthread_cond_wait(&sp->task_output_ready_cond, &sp->sump_mtx);
-            }
-            TRACE("sp_read_output: DONE WAITING\n");
-            TRACE("sp_read_output: error_code: %d\n", sp->error_code);
-            TRACE("sp_read_output: cnt_task_init: %d\n", sp->cnt_task_init);
-            TRACE("sp_read_output: cnt_task_begun: %d\n", sp->cnt_task_begun);
-            TRACE("sp_read_output: out[%d].cnt_task_drained: %d\n",
-                  index, sp->out[index].cnt_task_drained);
-            TRACE("sp_read_output: out->bytes_copied: %d\n",
-                  out->bytes_copied);
-            TRACE("sp_read_output: t->in_buf_bytes: %d\n", t->in_buf_bytes);
-            TRACE("sp_read_output: out->stalled: %d\n", out->stalled);
-            TRACE("sp_read_output: t->output_eof: %d\n", t->output_eof);
-            TRACE("sp_read_output: out_eof: %d\n", out_eof);
-            pthread_mutex_unlock(&sp->sump_mtx);
-            if (sp->error_code || out_eof)
-                break;
-        }  
-        src_remaining =
-            out->bytes_copied - sp->out[index].partial_bytes_copied;
+            break;
+        }
+        t = sp->out[index].curr_task;
+        src = output_src(sp, index, t, &src_bytes);
+        src_remaining = src_bytes - sp->out[index].partial_bytes_copied;
         dst_remaining = size - bytes_returned;
         trans_size = dst_remaining;
-        trans_src = t->out[index].buf + sp->out[index].partial_bytes_copied;
+        trans_src = src + sp->out[index].partial_bytes_copied;
         trans_dst = (char *)buf + bytes_returned;
         if (dst_remaining < src_remaining)
         {
@@ -4518,40 +9217,7 @@ ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size)
         /* indicate new sump pump task output is needed */
         sp->out[index].partial_bytes_copied = 0;  
         
-        TRACE("sp_read_output: waking reader thread\n");
-        pthread_mutex_lock(&sp->sump_mtx);
-        if (t->out[index].stalled)
-        {
-            /* we have copied the bytes in the buf.  clear the buf
-             * and stall indicator, then wake stalled thread.  since
-             * there may be more than one thread waiting on the
-             * task_output_empty_cond, use broadcast.
-             */
-            t->out[index].bytes_copied = 0;
-            t->out[index].stalled = FALSE;
-            pthread_cond_broadcast(&sp->task_output_empty_cond);
-        }
-        else
-        {
-            /* increment per-output task output drained count */
-            sp->out[index].cnt_task_drained++;
-            TRACE("sp_read_output: sp->out[%d].cnt_task_drained incr to %d\n",
-                  index, sp->out[index].cnt_task_drained);
-            TRACE("sp_read_output: t->outs_drained before incr is: %d\n",
-                  t->outs_drained);
-
-            /* if all output buffers for this task have been drained */
-            if (++t->outs_drained == sp->num_outputs)  
-            {
-                /* increment sump pump task drained count */
-                sp->cnt_task_drained++;
-                TRACE("sp_read_output: sp->cnt_task_drained incr to: %d\n",
-                      sp->cnt_task_drained);
-                pthread_cond_broadcast(&sp->task_drained_cond);
-            }
-        }
-
-        pthread_mutex_unlock(&sp->sump_mtx);
+        drain_output_buf(sp, index, t);
 
         if (bytes_returned == size)
             break;
@@ -4564,26 +9230,177 @@ ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size)
 }
 
 
+/* sp_read_output_view - get a pointer to the unread bytes of the next task
+ *                       output buffer of the specified output of a sump
+ *                       pump, without copying them.  The bytes remain
+ *                       valid until they are released by
+ *                       sp_release_output().  Calling this function
+ *                       again before then returns the same bytes.
+ *
+ * Returns: The number of bytes at *buf.  If 0, then EOF has occurred.
+ *          If negative, a sump pump error code.
+ */
+ssize_t sp_read_output_view(sp_t sp, unsigned index, void **buf)
+{
+    sp_task_t           t;
+    char                *src;
+    size_t              src_bytes;
+    ssize_t             src_remaining;
+
+    if (sp->flags & SP_SORT)
+        return (SP_SORT_INCOMPATIBLE);
+    if (index >= sp->num_outputs)
+        return (SP_OUTPUT_INDEX_ERROR);
+
+    for (;;)
+    {
+        if (sp->error_code)
+            return (sp->error_code);
+        if (sp->out[index].partial_bytes_copied == 0 &&
+            !wait_output_ready(sp, index))
+        {
+            return (sp->error_code);    /* 0 if output EOF */
+        }
+        t = sp->out[index].curr_task;
+        src = output_src(sp, index, t, &src_bytes);
+        src_remaining = src_bytes - sp->out[index].partial_bytes_copied;
+        if (src_remaining != 0)
+            break;
+        drain_output_buf(sp, index, t);         /* skip empty output */
+    }
+    *buf = src + sp->out[index].partial_bytes_copied;
+    TRACE("sp_read_output_view[%d]: returning %d bytes\n",
+          index, src_remaining);
+    return (src_remaining);
+}
+
+
+/* sp_release_output - release the first bytes returned by
+ *                     sp_read_output_view() for the specified output of
+ *                     a sump pump.  Once all of them are released, the
+ *                     task output buffer can be reused.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_release_output(sp_t sp, unsigned index, size_t size)
+{
+    sp_task_t           t;
+    size_t              src_bytes;
+
+    if (sp->flags & SP_SORT)
+        return (SP_SORT_INCOMPATIBLE);
+    if (index >= sp->num_outputs)
+        return (SP_OUTPUT_INDEX_ERROR);
+    if (size == 0)
+        return (SP_OK);
+    t = sp->out[index].curr_task;
+    if (t == NULL)
+        return (SP_BUF_INDEX_ERROR);
+    output_src(sp, index, t, &src_bytes);
+    if (sp->out[index].partial_bytes_copied + size > src_bytes)
+        return (SP_BUF_INDEX_ERROR);
+
+    sp->out[index].partial_bytes_copied += size;
+    if (sp->out[index].partial_bytes_copied == src_bytes)
+    {
+        sp->out[index].partial_bytes_copied = 0;
+        drain_output_buf(sp, index, t);
+    }
+    return (SP_OK);
+}
+
+
+/* sp_read_output_hold - like sp_read_output_view(), except that if the
+ *                       bytes are the last output of a task that is done,
+ *                       they are held for the caller: *hold is set to a
+ *                       handle for them and the next call returns the
+ *                       output that follows them.  Held bytes remain valid
+ *                       until sp_release_output_hold() is called with the
+ *                       handle.  If *hold is set to NULL, the bytes must
+ *                       instead be released by sp_release_output() before
+ *                       the next call.
+ *
+ * Returns: The number of bytes at *buf.  If 0, then EOF has occurred.
+ *          If negative, a sump pump error code.
+ */
+ssize_t sp_read_output_hold(sp_t sp, unsigned index, void **buf, void **hold)
+{
+    ssize_t             size;
+    sp_task_t           t;
+
+    *hold = NULL;
+    if ((size = sp_read_output_view(sp, index, buf)) <= 0)
+        return (size);
+    pthread_mutex_lock(&sp->sump_mtx);
+    t = sp->out[index].curr_task;
+    if (sp->out[index].curr_seg == NULL && t->output_eof)
+    {
+        sp->out[index].partial_bytes_copied = 0;
+        advance_output_task(sp, index);
+        *hold = t;
+    }
+    pthread_mutex_unlock(&sp->sump_mtx);
+    TRACE("sp_read_output_hold[%d]: returning %d bytes, hold %d\n",
+          index, size, *hold != NULL);
+    return (size);
+}
+
+
+/* sp_release_output_hold - release the task output bytes held by a call to
+ *                          sp_read_output_hold() for the specified output
+ *                          of a sump pump.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_release_output_hold(sp_t sp, unsigned index, void *hold)
+{
+    if (index >= sp->num_outputs)
+        return (SP_OUTPUT_INDEX_ERROR);
+    if (hold == NULL)
+        return (SP_BUF_INDEX_ERROR);
+    pthread_mutex_lock(&sp->sump_mtx);
+    retire_task_output(sp, (sp_task_t)hold);
+    pthread_mutex_unlock(&sp->sump_mtx);
+    return (SP_OK);
+}
+
+
 /* link_main - internal "main" routine for a thread that links an output
  *             of a sump pump to the input of another sump pump.
  */
 static void *link_main(void *arg)
 {
     sp_link_t   sp_link = (sp_link_t)arg;
+    sp_t        out_sp = sp_link->out_sp;
     ssize_t     size;
+    void        *buf;
 
-    while ((size = sp_read_output(sp_link->out_sp,
-                                  sp_link->out_index,
-                                  sp_link->buf,
-                                  sp_link->buf_size)) > 0)
+    /* write the output bytes directly from the task output buffers of
+     * the output sump pump, unless it is a sort.
+     */
+    for (;;)
     {
-        if (sp_write_input(sp_link->in_sp, sp_link->buf, size) != size)
+        if (out_sp->flags & SP_SORT)
+        {
+            buf = sp_link->buf;
+            size = sp_read_output(out_sp, sp_link->out_index,
+                                  buf, sp_link->buf_size);
+        }
+        else
+            size = sp_read_output_view(out_sp, sp_link->out_index, &buf);
+        if (size <= 0)
+            break;
+        if (sp_write_input(sp_link->in_sp, buf, size) != size)
         {
             TRACE("link_main: sp_write_input() returned wrong size\n");
             sp_link->error_code = SP_WRITE_ERROR;
             return (NULL);
         }
+        if (!(out_sp->flags & SP_SORT))
+            sp_release_output(out_sp, sp_link->out_index, size);
     }
+    if (size < 0)
+        size = -1;
     sp_write_input(sp_link->in_sp, NULL, size);/* need to handle err case?*/
     if (size < 0)
         sp_link->error_code = SP_UPSTREAM_ERROR;
@@ -4615,7 +9432,8 @@ int sp_link(sp_t out_sp, unsigned out_index, sp_t in_sp)
     sp_link->buf = (char *)malloc(sp_link->buf_size);
     if (sp_link->buf == NULL)
         return (SP_MEM_ALLOC_ERROR);
-    if ((ret = pthread_create(&sp_link->thread, NULL, link_main, sp_link)))
+    if ((ret = create_thread(out_sp->num_cpus != 0 ? out_sp : in_sp,
+                             &sp_link->thread, link_main, sp_link, -1)))
         die("sp_start_link: pthread_create() ret: %d\n", ret);
 
     return (SP_OK);
@@ -4657,24 +9475,6 @@ static int get_output_index(sp_t sp, char **caller_p)
 }
 
 
-/* get_logical_processor_count - internal routine to get the number of
- *                               logical processors in the system.
- */
-static int get_logical_processor_count()
-{
-#if defined(win_nt)
-    {
-        SYSTEM_INFO si;
-
-        GetSystemInfo(&si);
-        return si.dwNumberOfProcessors;
-    }
-#else
-    return sysconf(_SC_NPROCESSORS_ONLN);
-#endif
-}
-
-
 /* get_string_arg - internal routine to scan and return a string
  */
 static char *get_string_arg(char **caller_p)
@@ -4699,6 +9499,62 @@ static char *get_string_arg(char **caller_p)
 }
 
 
+/* get_delim_arg - internal routine to scan a record delimiter argument
+ *                 into sp->delim_buf.  The escape sequences \n, \r, \t,
+ *                 \\ and \xHH may be used.
+ */
+static void get_delim_arg(sp_t sp, char **caller_p)
+{
+    char        *p = *caller_p;
+    size_t      n = 0;
+    int         c;
+    int         i;
+
+    while (!isspace(*(unsigned char *)p) && *p != '\0')
+    {
+        c = *p++;
+        if (c == '\\')
+        {
+            switch (c = *p++)
+            {
+              case 'n':  c = '\n'; break;
+              case 'r':  c = '\r'; break;
+              case 't':  c = '\t'; break;
+              case '\\': break;
+              case 'x':
+                for (c = 0, i = 0; i < 2 && isxdigit(*(unsigned char *)p); i++)
+                {
+                    c = c * 16 + (isdigit(*(unsigned char *)p) ?
+                                  *p - '0' : (toupper(*p) - 'A' + 10));
+                    p++;
+                }
+                if (i != 0 && c != 0)
+                    break;
+                /* fall through */
+              default:
+                syntax_error(sp, p - 2, "unrecognized delimiter escape");
+                return;
+            }
+        }
+        if (n == SP_MAX_DELIM_SIZE)
+        {
+            syntax_error(sp, *caller_p, "delimiter is too long");
+            return;
+        }
+        sp->delim_buf[n++] = (char)c;
+    }
+    if (n == 0)
+    {
+        syntax_error(sp, p, "empty delimiter");
+        return;
+    }
+    sp->delim_buf[n] = '\0';
+    sp->delimiter = sp->delim_buf;
+    sp->delim_size = n;
+    *caller_p = p;
+}
+
+
 /* sp_argv_to_str - bundle up the specified argv and return it as a string.
  *                  For instance if argc is 2, argv[0] is "TASKS=2" and
  *                  argv[1] is "THEADS=3", then return the string
@@ -4830,6 +9686,229 @@ static void get_exec_args(sp_t sp, char **ep)
 }
 
 
+/* get_cpus_arg - internal routine to scan the -CPUS list of cpu numbers and
+ *                ranges, e.g. 0-3,8,10-11.
+ */
+static void get_cpus_arg(sp_t sp, char **caller_p)
+{
+    char        *p = *caller_p;
+    long        lo;
+    long        hi;
+    int         *cpus;
+
+    sp->num_cpus = 0;
+    for (;;)
+    {
+        if (!isdigit(*(unsigned char *)p))
+        {
+            syntax_error(sp, p, "expected a cpu number");
+            return;
+        }
+        lo = hi = strtol(p, &p, 10);
+        if (*p == '-')
+        {
+            p++;
+            if (!isdigit(*(unsigned char *)p))
+            {
+                syntax_error(sp, p, "expected a cpu number");
+                return;
+            }
+            hi = strtol(p, &p, 10);
+        }
+        if (hi < lo || hi >= SP_MAX_CPUS)
+        {
+            syntax_error(sp, p, "invalid cpu range");
+            return;
+        }
+        cpus = (int *)realloc(sp->cpus,
+                              (sp->num_cpus + hi - lo + 1) * sizeof(int));
+        if (cpus == NULL)
+        {
+            sp->error_code = SP_MEM_ALLOC_ERROR;
+            return;
+        }
+        sp->cpus = cpus;
+        for (; lo <= hi; lo++)
+            sp->cpus[sp->num_cpus++] = (int)lo;
+        if (*p != ',')
+            break;
+        p++;
+    }
+    *caller_p = p;
+}
+
+
+/* align_in_buf_size - internal routine to round an input buffer size down
+ *                     to a multiple of the record size when -ALIGN_IN_BUFS
+ *                     is used with -REC_SIZE records.
+ *
+ * Returns: the input buffer size
+ */
+static size_t align_in_buf_size(sp_t sp, size_t in_buf_size)
+{
+    size_t      size;
+
+    if (!sp->align_in_bufs || REC_TYPE(sp) != SP_FIXED)
+        return (in_buf_size);
+    size = sp->rec_size + ((sp->flags & SP_GROUP_BY) ? 1 : 0);
+    if (in_buf_size < size)
+        in_buf_size = size;
+    return (in_buf_size - in_buf_size % size);
+}
+
+
+/* get_in_buf_alloc_size - internal routine to get the size of the memory
+ *                         allocated for an input buffer of the specified
+ *                         size: a page multiple, or with -HUGE_PAGES, a
+ *                         huge page multiple for a buffer of more than one
+ *                         huge page.
+ */
+static size_t get_in_buf_alloc_size(sp_t sp, size_t in_buf_size)
+{
+    size_t      size;
+
+    size = ((in_buf_size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+    /* a buffer of more than one huge page is rounded up to a multiple of
+     * the huge page size so that it can be backed by huge pages.
+     */
+    if (sp->huge_pages && size > HUGE_PAGE_SIZE)
+        size = ((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+    return (size);
+}
+
+
+/* get_out_buf_size - internal routine to get the task output buffer size
+ *                    of the specified output for an input buffer of the
+ *                    specified size.
+ */
+static size_t get_out_buf_size(sp_t sp, unsigned index, size_t in_buf_size)
+{
+    /* if an output buffer absolute size has been specified, use it */
+    if (sp->out[index].size_specified)
+        return (sp->out[index].buf_size);
+    /* if an output buffer size multiplier was specified, use it */
+    if (sp->out[index].buf_size_mult != 0.0)
+        return ((size_t)(in_buf_size * sp->out[index].buf_size_mult + 0.5));
+    /* default to using 2x the input buffer size */
+    return (2 * in_buf_size);
+}
+
+
+/* alloc_cost - internal routine to get the bytes of memory taken by a
+ *              buffer of the specified size: the size of its -BUF_POOL
+ *              size class, or if it is allocated as whole pages, its size
+ *              rounded up to a page multiple.
+ */
+static double alloc_cost(sp_t sp, size_t size, int pages)
+{
+    size_t      class_size;
+
+    if (sp->buf_pool_name != NULL)
+    {
+        pool_class(size, &class_size);
+        return ((double)class_size);
+    }
+    if (pages)
+        size = ((size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+    return ((double)size);
+}
+
+
+/* budget_cost - internal routine to get the bytes of task output and
+ *               input buffers allocated for the specified input buffer
+ *               size and numbers of tasks and input buffers.
+ */
+static double budget_cost(sp_t sp, size_t in_buf_size,
+                          unsigned num_tasks, unsigned num_in_bufs)
+{
+    double      task_size = 0.0;
+    unsigned    i;
+
+    for (i = 0; i < sp->num_outputs; i++)
+        task_size += alloc_cost(sp, get_out_buf_size(sp, i, in_buf_size),
+                                out_buf_pages(sp, i));
+    return (num_tasks * task_size +
+            num_in_bufs *
+            alloc_cost(sp, get_in_buf_alloc_size(sp, in_buf_size), TRUE));
+}
+
+
+/* fit_memory_budget - internal routine to derive the input buffer size
+ *                     and the number of tasks and input buffers from the
+ *                     -MEMORY budget, less the -OVERFLOW_POOL and
+ *                     -ELASTIC sizes.  The input buffer size and the
+ *                     number of tasks and input buffers, whether specified
+ *                     or defaulted, are the most that are used.  The input
+ *                     buffer size is reduced first, to as little as
+ *                     MIN_BUDGET_IN_BUF_SIZE, then the number of tasks and
+ *                     input buffers, to as few as two.  The budget is
+ *                     charged the sizes that are allocated, after rounding
+ *                     for -ALIGN_IN_BUFS, pages, -HUGE_PAGES and -BUF_POOL
+ *                     size classes.
+ *
+ * Returns: SP_OK or SP_START_ERROR
+ */
+static int fit_memory_budget(sp_t sp)
+{
+    size_t      page = PAGE_SIZE;
+    size_t      reserved = sp->overflow_pool + sp->elastic_mem;
+    size_t      in_buf_size;
+    double      avail;
+    double      per_byte;
+    double      fixed;
+    double      size;
+    unsigned    n;
+
+    if (sp->memory == 0)
+        return (SP_OK);
+    avail = sp->memory > reserved ? (double)(sp->memory - reserved) : 0.0;
+
+    /* apart from rounding, the cost is linear in the input buffer size.
+     * start from the linear estimate, then step down until the rounded
+     * cost fits.
+     */
+    fixed = budget_cost(sp, 0, sp->num_tasks, sp->num_in_bufs);
+    per_byte = (budget_cost(sp, 2 * page, sp->num_tasks, sp->num_in_bufs) -
+                budget_cost(sp, page, sp->num_tasks, sp->num_in_bufs)) / page;
+    size = avail > fixed && per_byte > 0.0 ?
+        (avail - fixed) / per_byte : 0.0;
+    if (size < MIN_BUDGET_IN_BUF_SIZE)
+        size = MIN_BUDGET_IN_BUF_SIZE;
+    if (size < (double)sp->in_buf_size)
+        sp->in_buf_size = align_in_buf_size(sp, (size_t)size & ~(page - 1));
+    while (budget_cost(sp, sp->in_buf_size, sp->num_tasks, sp->num_in_bufs) >
+           avail && (size_t)sp->in_buf_size > MIN_BUDGET_IN_BUF_SIZE)
+    {
+        in_buf_size = (sp->in_buf_size - sp->in_buf_size / 8) & ~(page - 1);
+        if (in_buf_size < MIN_BUDGET_IN_BUF_SIZE)
+            in_buf_size = MIN_BUDGET_IN_BUF_SIZE;
+        in_buf_size = align_in_buf_size(sp, in_buf_size);
+        if (in_buf_size >= (size_t)sp->in_buf_size)
+            break;
+        sp->in_buf_size = in_buf_size;
+    }
+    if (budget_cost(sp, sp->in_buf_size, sp->num_tasks, sp->num_in_bufs) >
+        avail)
+    {
+        n = (unsigned)(avail / budget_cost(sp, sp->in_buf_size, 1, 1));
+        if (n < 2)
+            n = 2;
+        if (n < sp->num_tasks)
+            sp->num_tasks = n;
+        if (n < sp->num_in_bufs)
+            sp->num_in_bufs = n;
+    }
+    size = budget_cost(sp, sp->in_buf_size, sp->num_tasks, sp->num_in_bufs);
+    if (size > avail)
+    {
+        return (start_error(sp, "sp_start: the -MEMORY budget of %.0f bytes "
+                            "is less than the %.0f bytes needed\n",
+                            (double)sp->memory, size + reserved));
+    }
+    return (SP_OK);
+}
+
+
 /* sp_start - Start a sump pump
  *
  * Parameters:
@@ -4842,9 +9921,74 @@ static void get_exec_args(sp_t sp, char **ep)
  *                    parameter can and must be NULL.
  *      arg_fmt -     Printf-format-like string that can be used to specify
  *                    the following sump pump directives:
+ *                    -ALIGN_IN_BUFS or -ALIGN  Make each full input
+ *                                        buffer end on a record boundary by
+ *                                        moving its trailing partial record
+ *                                        to the beginning of the next input
+ *                                        buffer, so that a task reads from
+ *                                        two input buffers only if a record
+ *                                        is larger than an input buffer.
+ *                                        For -REC_SIZE records, the input
+ *                                        buffer size is rounded down to a
+ *                                        multiple of the record size.  The
+ *                                        sp_get_in_buf() buffer index must
+ *                                        be that of the next buffer to be
+ *                                        filled, and input files are read
+ *                                        with buffered reads.
  *                    -ASCII or -UTF_8    Input records are ascii/utf-8 
  *                                        characters delimited by a newline
  *                                        character.
+ *                    -BUF_POOL[=%s]      Borrow task output and input
+ *                                        buffers from a process-wide pool
+ *                                        shared by every sump pump that
+ *                                        names the same pool (or none),
+ *                                        rather than each pump holding its
+ *                                        own.  Buffers are taken when a task
+ *                                        starts or an input buffer is
+ *                                        filled, and given back once they
+ *                                        have been read.  The pool is freed
+ *                                        when its last sump pump is freed.
+ *                                        Not used for sorts.
+ *                    -CPUS=%s            Bind the sump pump threads to the
+ *                                        listed cpus, e.g. -CPUS=0-3,8, one
+ *                                        cpu per thread in turn, and bind the
+ *                                        file reader, writer and sp_link()
+ *                                        threads to all the listed cpus.
+ *                                        Unless -THREADS=%d is specified,
+ *                                        there is a thread per listed cpu.
+ *                    -DELIMITER=%s or -DELIM=%s  The delimiter for
+ *                                        ascii/utf-8 records instead of a
+ *                                        newline, e.g. -DELIM=\r\n.  The
+ *                                        escapes \n, \r, \t, \\ and \xHH may
+ *                                        be used. Up to 8 bytes are allowed,
+ *                                        and the delimiter may not begin
+ *                                        with its own ending, e.g. "\n\n".
+ *                    -ELASTIC[=%d{k,m,g}] Grow the number of tasks and input
+ *                                        buffers in use when threads are
+ *                                        idle because the oldest task has
+ *                                        not had its output read, and
+ *                                        shrink it again once the backlog
+ *                                        clears.  The optional size is the
+ *                                        memory ceiling for the additional
+ *                                        task output and input buffers.
+ *                                        The default is 3x the memory of
+ *                                        the -TASKS and -IN_BUFS buffers.
+ *                    -EXECUTOR[=%d]      Run the tasks on the worker
+ *                                        threads of a process-wide executor
+ *                                        shared with the other sump pumps
+ *                                        that specify it, rather than on
+ *                                        threads of this sump pump, so that
+ *                                        idle pumps lend their cpus to busy
+ *                                        ones.  -THREADS then caps the
+ *                                        number of this pump's tasks that
+ *                                        run at once.  The optional number
+ *                                        of workers applies when the
+ *                                        executor is created, and defaults
+ *                                        to the number of cpus.  There are
+ *                                        always at least as many workers as
+ *                                        pumps using the executor.  The
+ *                                        workers are not bound to the
+ *                                        -CPUS or -NUMA nodes of any pump.
  *                    -GROUP_BY or -GROUP Group input records for the purpose
  *                                        of reducing them. The sump pump input
  *                                        should be coming from an nsort
@@ -4853,6 +9997,13 @@ static void get_exec_args(sp_t sp, char **ep)
  *                                        directive prevents records with
  *                                        equal keys from being dispersed to
  *                                        more than one sump pump task.
+ *                    -HUGE_PAGES or -HUGE  Back the task output and input
+ *                                        buffers with huge pages where
+ *                                        available, otherwise with
+ *                                        transparent huge pages.  Input
+ *                                        buffers larger than a huge page
+ *                                        are rounded up to a multiple of
+ *                                        the huge page size.
  *                    -IN=%s or -IN_FILE=%s Input file name for the sump pump
  *                                        input.  if not specified, the input
  *                                        should be written into the sump pump
@@ -4867,8 +10018,42 @@ static void get_exec_args(sp_t sp, char **ep)
  *                                        suffix is specified, the specified
  *                                        size is multiplied by 2^10, 2^20 or
  *                                        2^30 respectively.
+ *                    -IN_BUF_SIZE=AUTO   Adapt the number of bytes placed in
+ *                                        each input buffer, and so the size
+ *                                        of each task, to the measured pump
+ *                                        function time per input byte, so
+ *                                        that a task takes about -TASK_TIME.
+ *                                        The fill size ranges from 1/64th of
+ *                                        the input buffer size up to the
+ *                                        input buffer size.  The chosen size
+ *                                        is reported by sp_get_stats().
  *                    -IN_BUFS=%d         Overrides default number of input
  *                                        buffers (the number of tasks).
+ *                    -MEMORY=%d{k,m,g} or -MEM=%d{k,m,g}  The most bytes of
+ *                                        task output and input buffers,
+ *                                        including any -OVERFLOW_POOL and
+ *                                        -ELASTIC memory.  The input buffer
+ *                                        size and then the number of tasks
+ *                                        and input buffers are reduced as
+ *                                        needed to fit.  The buffers are
+ *                                        allocated when first used, and the
+ *                                        pages of idle buffers are released
+ *                                        while the pump output is not being
+ *                                        read.  An -ELASTIC ceiling defaults
+ *                                        to the budget remaining.
+ *                    -MLOCK              Lock the task output and input
+ *                                        buffers in memory, as far as the
+ *                                        locked memory limit allows.
+ *                    -NUMA               Bind the sump pump threads to the
+ *                                        NUMA nodes in turn, place the
+ *                                        memory of the input buffers on the
+ *                                        nodes in turn, and briefly leave a
+ *                                        task to an idle thread on the node
+ *                                        of its input buffer.  The number of
+ *                                        tasks run on another node and their
+ *                                        input bytes are reported by
+ *                                        sp_get_stats().  Has no effect on a
+ *                                        system with one node.
  *                    -OUT[%d]=%s or -OUT_FILE[%d]=%s  The output file name for
  *                                        the specified output index, or output
  *                                        0 if no index is specified.  If not 
@@ -4892,9 +10077,28 @@ static void get_exec_args(sp_t sp, char **ep)
  *                                        an error if the output of a task
  *                                        exceeds the output buffer size, but
  *                                        it can potentially result in loss
- *                                        of parallelism.
+ *                                        of parallelism unless the
+ *                                        -OVERFLOW_POOL is large enough.
  *                    -OUTPUTS=%d         Overrides default number of output
  *                                        streams (1).
+ *                    -OVERFLOW_POOL=%d{k,m,g} The most bytes of overflow
+ *                                        output segments shared by the
+ *                                        tasks (0 by default).  A task
+ *                                        whose output buffer is full and
+ *                                        whose output is not being read
+ *                                        continues writing into a segment
+ *                                        from the pool, each the size of
+ *                                        the output buffer, and only waits
+ *                                        if the pool is exhausted.  Idle
+ *                                        segments of one output are freed
+ *                                        to make room when another output
+ *                                        needs a segment.
+ *                    -PREFAULT           Allocate the buffers of the
+ *                                        initial tasks and input buffers
+ *                                        in sp_start(), and have the sump
+ *                                        pump threads touch their pages in
+ *                                        parallel before sp_start()
+ *                                        returns.  Not used with -BUF_POOL.
  *                    -REC_SIZE=%d        Defines the input record size in 
  *                                        bytes. The record contents need not 
  *                                        be ascii nor delimited by a newline
@@ -4902,13 +10106,48 @@ static void get_exec_args(sp_t sp, char **ep)
  *                                        must consist of ascii or utf-8
  *                                        characters and be terminated by a
  *                                        newline.
+ *                    -SAME_SIZE          Asserts that the output of each
+ *                                        task is the same size as its
+ *                                        input.  Requires -REC_SIZE.  An
+ *                                        output file written with ,WRITERS
+ *                                        then writes the output of each
+ *                                        task at the offset of its input,
+ *                                        as soon as it is ready, without
+ *                                        waiting for earlier tasks.  A
+ *                                        task whose output differs in size
+ *                                        raises an error.
+ *                    -SPECULATIVE or -SPEC  Release each input buffer to
+ *                                        a task without first finding the
+ *                                        record boundaries in it.  Each
+ *                                        task skips the remainder of the
+ *                                        previous buffer's last record
+ *                                        itself, so that the thread writing
+ *                                        the input only examines the end of
+ *                                        each buffer.  Only affects ascii
+ *                                        or utf-8 records.
  *                    -TASKS=%d           Overrides default number of output
  *                                        tasks (3x the number of threads).
+ *                    -TASK_TIME=%d       The target task duration in
+ *                                        milliseconds for -IN_BUF_SIZE=AUTO
+ *                                        (10).  Time spent waiting for
+ *                                        input or output buffers is not
+ *                                        counted.
  *                    -THREADS=%d         Overrides default number of threads
  *                                        that are used to execute the pump
- *                                        function in parallel. The default is
- *                                        the number of logical processors in
- *                                        the system.
+ *                                        function in parallel. The default,
+ *                                        -THREADS=AUTO, is the number of
+ *                                        -CPUS, or else the number of logical
+ *                                        processors the process can use, as
+ *                                        limited by its affinity mask and
+ *                                        cgroup cpu.max quota.
+ *                    -UNORDERED[%d]      Read the task outputs of the specified
+ *                                        output index, or all outputs if no
+ *                                        index is specified, in the order the
+ *                                        tasks complete rather than in input
+ *                                        order.  The output of each task is
+ *                                        still contiguous.  This prevents a
+ *                                        slow task from delaying the output
+ *                                        of the tasks after it.
  *                    -WHOLE or           Processing is not done by input
  *                      -WHOLE_BUF        records so not input record type
  *                                        should be defined.  Instead,
@@ -4946,7 +10185,6 @@ int sp_start(sp_t *caller_sp,
     sp_t                sp;
     char                *s;
     unsigned            i;
-    unsigned            j;
     int                 ret;
     char                *p;
     int                 index;
@@ -4986,14 +10224,16 @@ int sp_start(sp_t *caller_sp,
     
     /* fill in default parameters */
     sp->pump_arg = NULL;
-    sp->num_threads = get_logical_processor_count(); /* default thread count */
-    sp->num_in_bufs = 3 * sp->num_threads;
-    sp->num_tasks = 3 * sp->num_threads;
+    sp->num_threads = 0;        /* -THREADS=AUTO, chosen below */
+    sp->num_in_bufs = 3 * get_logical_processor_count();
+    sp->num_tasks = sp->num_in_bufs;
     sp->in_buf_size = (1 << 18);
+    sp->task_time_us = DEFAULT_TASK_TIME_MS * 1000;
     sp->num_outputs = 1;
     sp->out = (struct sump_out *)calloc(1, sizeof(struct sump_out));
     sp->out[0].buf_size = (1 << 18);
     sp->delimiter = (void *)"\n";
+    sp->delim_size = 1;
     sp->rec_size = 0;
 
     sp->pump_func = pump_func;
@@ -5074,10 +10314,26 @@ int sp_start(sp_t *caller_sp,
             if (sp->error_code)
                 return (sp->error_code);
         }
+        else if (scan("ALIGN_IN_BUFS", &p) || scan("ALIGN", &p))
+            sp->align_in_bufs = TRUE;
         else if (scan("ASCII", &p) || scan("UTF_8", &p))
         {
             sp->flags |= SP_UTF_8;
         }
+        else if (scan("BUF_POOL=", &p))
+        {
+            if (sp->buf_pool_name != NULL)
+                free(sp->buf_pool_name);
+            sp->buf_pool_name = get_string_arg(&p);
+        }
+        else if (scan("BUF_POOL", &p))
+        {
+            if (sp->buf_pool_name != NULL)
+                free(sp->buf_pool_name);
+            sp->buf_pool_name = (char *)calloc(1, 1);
+        }
+        else if (scan("CPUS=", &p))
+            get_cpus_arg(sp, &p);
         else if (scan("DEFAULT_FILE_MODE=", &p))
         {
             if (scan("BUFFERED", &p) || scan("BUF", &p))
@@ -5087,10 +10343,31 @@ int sp_start(sp_t *caller_sp,
             else
                 syntax_error(sp, p, "unrecognized file access mode");
         }
+        else if (scan("DELIMITER=", &p) || scan("DELIM=", &p))
+            get_delim_arg(sp, &p);
+        else if (scan("ELASTIC=", &p))
+        {
+            sp->elastic = TRUE;
+            sp->elastic_mem = (size_t)get_numeric_arg(sp, &p);
+            sp->elastic_mem *= (size_t)get_scale(&p);
+        }
+        else if (scan("ELASTIC", &p))
+            sp->elastic = TRUE;
+        else if (scan("EXECUTOR=", &p))
+        {
+            sp->use_executor = TRUE;
+            sp->ex_workers = (unsigned)get_numeric_arg(sp, &p);
+        }
+        else if (scan("EXECUTOR", &p))
+            sp->use_executor = TRUE;
         else if (scan("GROUP_BY", &p) || scan("GROUP", &p))
             sp->flags |= SP_GROUP_BY;
+        else if (scan("HUGE_PAGES", &p) || scan("HUGE", &p))
+            sp->huge_pages = TRUE;
         else if (scan("IN_BUFS=", &p))
             sp->num_in_bufs = (unsigned)get_numeric_arg(sp, &p);
+        else if (scan("IN_BUF_SIZE=AUTO", &p))
+            sp->auto_in_buf_size = TRUE;
         else if (scan("IN_BUF_SIZE=", &p))
         {
             sp->in_buf_size = (ssize_t)get_numeric_arg(sp, &p);
@@ -5102,6 +10379,13 @@ int sp_start(sp_t *caller_sp,
             sp->in_file = get_string_arg(&p);
             sp->in_file_alloc = TRUE;
         }
+        else if (scan("MEMORY=", &p) || scan("MEM=", &p))
+        {
+            sp->memory = (size_t)get_numeric_arg(sp, &p);
+            sp->memory *= (size_t)get_scale(&p);
+        }
+        else if (scan("MLOCK", &p))
+            sp->mlock_bufs = TRUE;
         else if (scan("OUT_BUF_SIZE", &p))
         {
             size_t  size;
@@ -5190,11 +10474,20 @@ int sp_start(sp_t *caller_sp,
             }
             sp->num_outputs = num_outputs;
         }
+        else if (scan("OVERFLOW_POOL=", &p))
+        {
+            sp->overflow_pool = (size_t)get_numeric_arg(sp, &p);
+            sp->overflow_pool *= (size_t)get_scale(&p);
+        }
         else if (scan("WHOLE_BUF", &p) || scan("WHOLE", &p))
         {
             sp->flags &= ~SP_UTF_8;
             sp->flags |= SP_WHOLE_BUF;
         }
+        else if (scan("NUMA", &p))
+            sp->numa = TRUE;
+        else if (scan("PREFAULT", &p))
+            sp->prefault = TRUE;
         else if (scan("REC_SIZE=", &p))
         {
             sp->rec_size = (int)get_numeric_arg(sp, &p);
@@ -5212,11 +10505,19 @@ int sp_start(sp_t *caller_sp,
             Default_rw_test_size = (size_t)get_numeric_arg(sp, &p);
             Default_rw_test_size *= (size_t)get_scale(&p);
         }
+        else if (scan("SAME_SIZE", &p))
+            sp->same_size = TRUE;
+        else if (scan("SPECULATIVE", &p) || scan("SPEC", &p))
+            sp->speculative = TRUE;
         else if (scan("TASKS=", &p))
         {
             sp->num_in_bufs = sp->num_tasks =
                 (unsigned)get_numeric_arg(sp, &p);
         }
+        else if (scan("TASK_TIME=", &p))
+            sp->task_time_us = (uint64_t)get_numeric_arg(sp, &p) * 1000;
+        else if (scan("THREADS=AUTO", &p))
+            sp->num_threads = 0;
         else if (scan("THREADS=", &p))
         {
             int     num_threads;
@@ -5225,6 +10526,23 @@ int sp_start(sp_t *caller_sp,
             if (num_threads > 0)
                 sp->num_threads = (unsigned)num_threads;
         }
+        else if (scan("UNORDERED", &p))
+        {
+            if (*p == '[')   /* if an output index in square brackets */
+            {
+                p++;
+                index = (int)get_numeric_arg(sp, &p);
+                if (sp->error_code == 0 && *p++ != ']')
+                    syntax_error(sp, p, "expected ']'");
+                else if (index < 0 || (unsigned)index >= sp->num_outputs)
+                    syntax_error(sp, p, "output index is greater than "
+                                 "the number of outputs");
+                else
+                    sp->out[index].unordered = TRUE;
+            }
+            else
+                sp->unordered = TRUE;
+        }
         else
             syntax_error(sp, p, "unrecognized keyword");
 
@@ -5233,18 +10551,64 @@ int sp_start(sp_t *caller_sp,
     }
     free(args);
 
+    /* with -THREADS=AUTO, there is a thread for each -CPUS cpu, or for
+     * each cpu the process can use.
+     */
+    if (sp->num_threads == 0)
+        sp->num_threads = sp->num_cpus != 0 ?
+            (unsigned)sp->num_cpus : (unsigned)get_logical_processor_count();
+#if defined(__linux__)
+    if (sp->num_cpus != 0)
+    {
+        cpu_set_t       allowed;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        {
+            for (i = 0; i < (unsigned)sp->num_cpus; i++)
+            {
+                if (!CPU_ISSET(sp->cpus[i], &allowed))
+                {
+                    start_error(sp, "sp_start: -CPUS cpu %d is not "
+                                "available to the process\n", sp->cpus[i]);
+                    return (sp->error_code);
+                }
+            }
+        }
+    }
+#endif
+    /* the output buffers of a direct mode output file are page-aligned,
+     * so that the direct writer can write them in place.
+     */
+    for (i = 0; i < sp->num_outputs; i++)
+        sp->out[i].page_align = (char)out_file_direct(sp, i);
+    if (sp->error_code)
+        return (sp->error_code);
     if (REC_TYPE(sp) == 0)
     {
         start_error(sp, "sp_start: a record type must be specified\n");
         return (sp->error_code);
     }
+    if (sp->same_size && REC_TYPE(sp) != SP_FIXED)
+    {
+        start_error(sp, "sp_start: -SAME_SIZE requires -REC_SIZE records\n");
+        return (sp->error_code);
+    }
     if (REC_TYPE(sp) == SP_UTF_8)
     {
-        if (strlen((char *)sp->delimiter) > 1)
+        size_t  n = sp->delim_size;
+        size_t  k;
+
+        /* a delimiter that could overlap another instance of itself, e.g.
+         * "\n\n", would make record boundaries depend on the scan direction.
+         */
+        for (k = 1; k < n; k++)
         {
-            start_error(sp, "sp_start: "
-                        "currently only single-char delimiters are allowed\n");
-            return (sp->error_code);
+            if (memcmp(sp->delimiter, (char *)sp->delimiter + n - k, k) == 0)
+            {
+                start_error(sp, "sp_start: a delimiter may not begin with "
+                            "its own ending\n");
+                return (sp->error_code);
+            }
         }
     }
     else if (REC_TYPE(sp) == SP_UNICODE)
@@ -5255,74 +10619,140 @@ int sp_start(sp_t *caller_sp,
     }
     else if (REC_TYPE(sp) == SP_FIXED)
     {
-        /* nothing for now */
+        /* fixed-size record boundaries are found arithmetically */
+        sp->speculative = FALSE;
+        /* make full input buffers end on a record boundary */
+        sp->in_buf_size = align_in_buf_size(sp, sp->in_buf_size);
     }
     else if (REC_TYPE(sp) == SP_WHOLE_BUF)
     {
-        /* nothing for now */
+        /* whole buffers have no record boundaries to find */
+        sp->speculative = FALSE;
+        sp->align_in_bufs = FALSE;
     }
     else
     {
         start_error(sp, "sp_start: multiple record types specified\n");
         return (sp->error_code);
     }
+    /* aligned input buffers already begin on record boundaries */
+    if (sp->align_in_bufs)
+        sp->speculative = FALSE;
+    if (fit_memory_budget(sp) != SP_OK)
+        return (sp->error_code);
+    /* adaptive input buffer filling starts at a quarter of the buffer
+     * size so that it can grow as well as shrink.
+     */
+    sp->in_buf_fill = sp->in_buf_size;
+    if (sp->auto_in_buf_size)
+        sp->in_buf_fill = clamp_in_buf_fill(sp, sp->in_buf_size / 4.0);
 
     for (i = 0; i < sp->num_outputs; i++)
     {
-        /* if an output buffer absolute size has not been specified
-         */
-        if (sp->out[i].size_specified == FALSE)
+        sp->out[i].buf_size = get_out_buf_size(sp, i, sp->in_buf_size);
+        TRACE("out %d: %d\n", i, (int)sp->out[i].buf_size);
+    }
+
+    /* the task and input buffer rings begin with the -TASKS and -IN_BUFS
+     * sizes.  with -ELASTIC, the rings can grow by as many tasks and input
+     * buffers as the memory ceiling allows, by default 3 times the memory
+     * of the initial rings, or what is left of the -MEMORY budget.
+     */
+    sp->in_buf_alloc_size = get_in_buf_alloc_size(sp, sp->in_buf_size);
+    sp->base_tasks = sp->num_tasks_active = sp->num_tasks;
+    sp->base_in_bufs = sp->num_in_bufs_active = sp->num_in_bufs;
+    if (sp->elastic)
+    {
+        size_t  rings_size;
+        size_t  extra;
+
+        rings_size = (size_t)budget_cost(sp, sp->in_buf_size,
+                                         sp->num_tasks, sp->num_in_bufs);
+        if (sp->elastic_mem == 0 && sp->memory != 0)
         {
-            /* if an output buffer size multiplier was specified, use it */
-            if (sp->out[i].buf_size_mult != 0.0)
-                sp->out[i].buf_size = (size_t)(sp->in_buf_size *
-                                               sp->out[i].buf_size_mult + 0.5);
-            else /* default to using 2x the input buffer size */
-                sp->out[i].buf_size = 2 * sp->in_buf_size;
+            extra = rings_size + sp->overflow_pool;
+            sp->elastic_mem = sp->memory > extra ? sp->memory - extra : 0;
         }
-        TRACE("out %d: %d\n", i, (int)sp->out[i].buf_size);
+        else if (sp->elastic_mem == 0)
+            sp->elastic_mem = 3 * rings_size;
+        extra = sp->elastic_mem /
+            (size_t)budget_cost(sp, sp->in_buf_size, 1, 1);
+        sp->num_tasks += (unsigned)extra;
+        sp->num_in_bufs += (unsigned)extra;
+    }
+
+    /* with -BUF_POOL, the task output and input buffers are borrowed from
+     * the named process-wide pool as they are needed, and returned as
+     * soon as they are drained or read.
+     */
+    if (sp->buf_pool_name != NULL &&
+        (sp->buf_pool = join_buf_pool(sp->buf_pool_name)) == NULL)
+    {
+        return (SP_MEM_ALLOC_ERROR);
     }
+    /* with -NUMA, the pump threads are bound to the nodes in turn, and
+     * the input buffer memory is placed on the nodes in turn.
+     */
+    if (sp->numa && init_numa(sp) != SP_OK)
+        return (SP_MEM_ALLOC_ERROR);
 
-    /* alloc rec output buffers for each task */
+    /* alloc task structs.  their output buffers are allocated when each
+     * is first used by a task, or with -PREFAULT, here for the initial
+     * tasks.
+     */
+    if (sp->buf_pool != NULL)
+        sp->prefault = FALSE;
     sp->task = (sp_task_t)calloc(sp->num_tasks, sizeof(struct sp_task));
+    if (sp->task == NULL)
+        return (SP_MEM_ALLOC_ERROR);
     for (i = 0; i < sp->num_tasks; i++)
     {
         sp->task[i].out = (struct task_out *)
             calloc(sp->num_outputs, sizeof (struct task_out));
         sp->task[i].error_buf_size = ERROR_BUF_SIZE;
         sp->task[i].error_buf = (char *)calloc(1, sp->task[i].error_buf_size);
-        if (sp->task[i].error_buf == NULL)
+        if (sp->task[i].out == NULL || sp->task[i].error_buf == NULL)
             return (SP_MEM_ALLOC_ERROR);
-        for (j = 0; j < sp->num_outputs; j++)
+        if (sp->prefault && i < sp->num_tasks_active &&
+            alloc_task_bufs(sp, &sp->task[i]) != SP_OK)
         {
-            sp->task[i].out[j].buf = (void *)malloc(sp->out[j].buf_size);
-            sp->task[i].out[j].size = sp->out[j].buf_size;
+            return (SP_MEM_ALLOC_ERROR);
         }
         sp->task[i].sp = sp;
     }
-    /* alloc input buffers */
+    /* initially, task struct i is used for task number i */
+    sp->task_order = (unsigned *)calloc(sp->num_tasks, sizeof(unsigned));
+    sp->free_task = (unsigned *)calloc(sp->num_tasks, sizeof(unsigned));
+    if (sp->task_order == NULL || sp->free_task == NULL)
+        return (SP_MEM_ALLOC_ERROR);
+    for (i = 0; i < sp->num_tasks; i++)
+    {
+        sp->task_order[i] = i;
+        sp->free_task[i] = sp->num_tasks - 1 - i;
+    }
+    sp->num_free_tasks = sp->num_tasks;
+    for (i = 0; i < sp->num_tasks; i++)
+        sp->task[i].output_eof = TRUE;  /* not in use, so not in progress */
+    for (i = 0; i < sp->num_outputs; i++)
+        if (sp->unordered)
+            sp->out[i].unordered = TRUE;
+    /* alloc input buffers.  their memory is allocated when each is first
+     * filled, or with -PREFAULT, here for the initial input buffers, and
+     * then kept in in_buf_pool for reuse.
+     */
     sp->in_buf = (in_buf_t *)calloc(sp->num_in_bufs, sizeof(in_buf_t));
+    sp->in_buf_pool = (char **)calloc(sp->num_in_bufs, sizeof(char *));
+    if (sp->in_buf == NULL || sp->in_buf_pool == NULL)
+        return (SP_MEM_ALLOC_ERROR);
     for (i = 0; i < sp->num_in_bufs; i++)
+        sp->in_buf[i].in_buf_size = sp->in_buf_size;
+    for (i = 0; sp->prefault && i < sp->num_in_bufs_active; i++)
     {
-        size_t  buf_size;
-
-        /* round up buf size to page size multiple */
-        buf_size = ((sp->in_buf_size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
-#if defined(win_nt)
-        sp->in_buf[i].in_buf = 
-            VirtualAlloc(NULL, buf_size, MEM_COMMIT, PAGE_READWRITE);
-        if (sp->in_buf[i].in_buf == NULL)
-            return (SP_MEM_ALLOC_ERROR);
-#else
-        init_zero_fd();
-        sp->in_buf[i].in_buf = mmap(NULL, buf_size,
-                                    PROT_READ | PROT_WRITE,
-                                    MAP_PRIVATE, Zero_fd, 0);
-        if (sp->in_buf[i].in_buf == MAP_FAILED)
+        if ((sp->in_buf_pool[i] = alloc_in_buf_mem(sp)) == NULL)
             return (SP_MEM_ALLOC_ERROR);
-#endif
-        sp->in_buf[i].in_buf_size = sp->in_buf_size;
-        sp->in_buf[i].alloc_size = buf_size;
+        if (sp->in_buf_pool_node != NULL)
+            sp->in_buf_pool_node[i] = bind_in_buf_mem(sp, sp->in_buf_pool[i]);
+        sp->num_pool_bufs++;
     }
 
     if (sp->flags & SP_EXEC)
@@ -5351,21 +10781,35 @@ int sp_start(sp_t *caller_sp,
     /* create mutexes and conditions */
     pthread_mutex_init(&sp->sump_mtx, NULL);
     pthread_mutex_init(&sp->sp_mtx, NULL);
-    pthread_cond_init(&sp->in_buf_readable_cond, NULL);
-    pthread_cond_init(&sp->in_buf_done_cond, NULL);
-    pthread_cond_init(&sp->task_avail_cond, NULL);
-    pthread_cond_init(&sp->task_drained_cond, NULL);
     pthread_cond_init(&sp->task_output_ready_cond, NULL);
-    pthread_cond_init(&sp->task_output_empty_cond, NULL);
+    park_init(&sp->in_buf_done_park);
+    park_init(&sp->task_avail_park);
+    sp->task_avail = &sp->task_avail_park;
+    park_init(&sp->task_drained_park);
+    park_init(&sp->prefault_park);
+    park_init(&sp->ex_done_park);
+    for (i = 0; i < sp->num_in_bufs; i++)
+        park_init(&sp->in_buf[i].readable_park);
+    for (i = 0; i < sp->num_tasks; i++)
+        park_init(&sp->task[i].out_empty_park);
+    for (i = 0; i < sp->num_outputs; i++)
+        park_init(&sp->out[i].ready_park);
+    Park_spin = get_logical_processor_count() > 1;
+    select_scanners();
 
     /* create thread sump threads */
     sp->thread = (pthread_t *)calloc(sp->num_threads, sizeof(pthread_t));
+    if (sp->prefault)
+        sp->prefault_pending = sp->use_executor ? 1 : (int)sp->num_threads;
     for (i = 0; i < sp->num_threads; i++)
     {
-        ret =
-            pthread_create(&sp->thread[i], NULL, pump_thread_main, (void *)sp);
-        if (ret)
-            die("pthread_create() failed: %d\n", ret);
+        if (!sp->use_executor)
+        {
+            ret = create_thread(sp, &sp->thread[i], pump_thread_main,
+                                (void *)sp, (int)i);
+            if (ret)
+                die("pthread_create() failed: %d\n", ret);
+        }
         if (sp->flags & SP_EXEC)
         {
             sp->ex_state[i].in.ex = &sp->ex_state[i];
@@ -5385,6 +10829,25 @@ int sp_start(sp_t *caller_sp,
 #endif
         }
     }
+    if (sp->use_executor)
+    {
+        if (sp->prefault)
+            prefault_bufs(sp);
+        if ((ret = join_executor(sp)) != SP_OK)
+        {
+            start_error(sp, "can't allocate the executor\n");
+            return (sp->error_code);
+        }
+    }
+    /* wait for the pump threads to prefault the initial buffers */
+    for (;;)
+    {
+        int     seq = park_prepare(&sp->prefault_park);
+
+        if (sp->prefault_pending == 0)
+            break;
+        park_wait(&sp->prefault_park, seq);
+    }
 
     for (i = 0; i < sp->num_outputs; i++)
     {
@@ -5514,6 +10977,22 @@ const char *sp_get_error_string(sp_t sp, int error_code)
 }
 
 
+/* free_out_segs - internal routine to free a list of overflow segments of
+ *                 the specified output.
+ */
+static void free_out_segs(sp_t sp, unsigned index, struct out_seg *seg)
+{
+    struct out_seg      *next;
+
+    for ( ; seg != NULL; seg = next)
+    {
+        next = seg->next;
+        free_out_buf(sp, index, seg->buf);
+        free(seg);
+    }
+}
+
+
 /* sp_free - free the specified sp_t and its associated state.
  */
 void sp_free(sp_t *caller_sp)
@@ -5526,6 +11005,10 @@ void sp_free(sp_t *caller_sp)
         return;
 
     sp_wait(sp); /* make sure sump pump has finished */
+    if (sp->executor != NULL)
+        leave_executor(sp);
+    if (sp->ex_free_slots != NULL)
+        free(sp->ex_free_slots);
     
 #if !defined(SUMP_PUMP_NO_SORT)
     if (sp->flags & SP_SORT)
@@ -5542,6 +11025,25 @@ void sp_free(sp_t *caller_sp)
     else
 #endif
     {
+        if (sp->thread != NULL)
+        {
+            pthread_mutex_destroy(&sp->sump_mtx);
+            pthread_mutex_destroy(&sp->sp_mtx);
+            pthread_cond_destroy(&sp->task_output_ready_cond);
+            park_destroy(&sp->in_buf_done_park);
+            park_destroy(&sp->task_avail_park);
+            park_destroy(&sp->task_drained_park);
+            park_destroy(&sp->prefault_park);
+            park_destroy(&sp->ex_done_park);
+            for (i = 0; sp->in_buf != NULL && i < sp->num_in_bufs; i++)
+                park_destroy(&sp->in_buf[i].readable_park);
+            for (i = 0; sp->task != NULL && i < sp->num_tasks; i++)
+                park_destroy(&sp->task[i].out_empty_park);
+            for (i = 0; sp->out != NULL && i < sp->num_outputs; i++)
+                park_destroy(&sp->out[i].ready_park);
+            free(sp->thread);
+        }
+
         if (sp->task != NULL)
         {
             for (i = 0; i < sp->num_tasks; i++)
@@ -5549,52 +11051,61 @@ void sp_free(sp_t *caller_sp)
                 if (sp->task[i].out != NULL)
                 {
                     for (j = 0; j < sp->num_outputs; j++)
+                    {
                         if (sp->task[i].out[j].buf != NULL)
-                            free(sp->task[i].out[j].buf);
+                            free_out_buf(sp, j, sp->task[i].out[j].buf);
+                        free_out_segs(sp, j, sp->task[i].out[j].seg_head);
+                    }
                     free(sp->task[i].out);
                 }
 
                 if (sp->task[i].error_buf != NULL)
                     free(sp->task[i].error_buf);
+                if (sp->task[i].rec_index != NULL)
+                    free(sp->task[i].rec_index);
             }
             free(sp->task);
         }
+        if (sp->task_order != NULL)
+            free(sp->task_order);
+        if (sp->free_task != NULL)
+            free(sp->free_task);
         if (sp->in_buf != NULL)
         {
             for (i = 0; i < sp->num_in_bufs; i++)
             {
-                if (sp->in_buf[i].in_buf != NULL)
+                in_buf_t        *ib = &sp->in_buf[i];
+
+                /* return any caller's buffer not released because of
+                 * an error.
+                 */
+                if (ib->is_ref)
                 {
-#if defined(win_nt)
-                    VirtualFree(sp->in_buf[i].in_buf,
-                                sp->in_buf[i].alloc_size, MEM_RELEASE);
-#else
-                    munmap(sp->in_buf[i].in_buf, sp->in_buf[i].alloc_size);
-#endif
+                    if (ib->ref_release != NULL)
+                        (*ib->ref_release)(ib->in_buf, ib->in_buf_bytes,
+                                           ib->ref_arg);
                 }
+                else if (ib->in_buf != NULL)
+                    free_in_buf_mem(sp, ib->in_buf);
             }
             free(sp->in_buf);
         }
+        if (sp->in_buf_pool != NULL)
+        {
+            while (sp->num_pool_bufs != 0)
+                free_in_buf_mem(sp, sp->in_buf_pool[--sp->num_pool_bufs]);
+            free(sp->in_buf_pool);
+        }
         if (sp->ex_state != NULL)
             free(sp->ex_state);
+        if (sp->stats_buf != NULL)
+            free(sp->stats_buf);
 
-        if (sp->thread != NULL)
-        {
-            pthread_mutex_destroy(&sp->sump_mtx);
-            pthread_mutex_destroy(&sp->sp_mtx);
-            pthread_cond_destroy(&sp->in_buf_readable_cond);
-            pthread_cond_destroy(&sp->in_buf_done_cond);
-            pthread_cond_destroy(&sp->task_avail_cond);
-            pthread_cond_destroy(&sp->task_drained_cond);
-            pthread_cond_destroy(&sp->task_output_ready_cond);
-            pthread_cond_destroy(&sp->task_output_empty_cond);
-            free(sp->thread);
-        }
-    
         if (sp->out != NULL)
         {
             for (i = 0; i < sp->num_outputs; i++)
             {
+                free_out_segs(sp, i, sp->out[i].free_segs);
                 if (sp->out[i].file_sp != NULL)
                     sp_file_free(&sp->out[i].file_sp);
                 if (sp->out[i].file_alloc && sp->out[i].file != NULL)
@@ -5607,7 +11118,25 @@ void sp_free(sp_t *caller_sp)
             sp_file_free(&sp->in_file_sp);
         if (sp->in_file_alloc && sp->in_file != NULL)
             free(sp->in_file);
+
+        /* all buffers have been returned to the pool */
+        if (sp->buf_pool != NULL)
+            leave_buf_pool(sp->buf_pool);
     }
+    if (sp->buf_pool_name != NULL)
+        free(sp->buf_pool_name);
+#if defined(SP_NUMA)
+    if (sp->numa_cpus != NULL)
+        free(sp->numa_cpus);
+#endif
+    if (sp->numa_ids != NULL)
+        free(sp->numa_ids);
+    if (sp->numa_idle != NULL)
+        free((void *)sp->numa_idle);
+    if (sp->cpus != NULL)
+        free(sp->cpus);
+    if (sp->in_buf_pool_node != NULL)
+        free(sp->in_buf_pool_node);
     if (sp->error_buf != NULL)
         free(sp->error_buf);
 
@@ -88,6 +88,9 @@ typedef struct sp_link *sp_link_t;
  */
 typedef int (*sp_pump_t)(sp_task_t t, void *arg);
 
+/* release function for a caller's input buffer, see sp_write_input_ref() */
+typedef void (*sp_release_t)(void *buf, size_t size, void *arg);
+
 /* SUMP Pump Library
  * -----------------
  *
@@ -134,9 +137,74 @@ const char *sp_get_id(void);
  *                    parameter can and must be NULL.
  *      arg_fmt -     Printf-format-like string that can be used to specify
  *                    the following sump pump directives:
+ *                    -ALIGN_IN_BUFS or -ALIGN  Make each full input
+ *                                        buffer end on a record boundary by
+ *                                        moving its trailing partial record
+ *                                        to the beginning of the next input
+ *                                        buffer, so that a task reads from
+ *                                        two input buffers only if a record
+ *                                        is larger than an input buffer.
+ *                                        For -REC_SIZE records, the input
+ *                                        buffer size is rounded down to a
+ *                                        multiple of the record size.  The
+ *                                        sp_get_in_buf() buffer index must
+ *                                        be that of the next buffer to be
+ *                                        filled, and input files are read
+ *                                        with buffered reads.
  *                    -ASCII or -UTF_8    Input records are ascii/utf-8 
  *                                        characters delimited by a newline
  *                                        character.
+ *                    -BUF_POOL[=%s]      Borrow task output and input
+ *                                        buffers from a process-wide pool
+ *                                        shared by every sump pump that
+ *                                        names the same pool (or none),
+ *                                        rather than each pump holding its
+ *                                        own.  Buffers are taken when a task
+ *                                        starts or an input buffer is
+ *                                        filled, and given back once they
+ *                                        have been read.  The pool is freed
+ *                                        when its last sump pump is freed.
+ *                                        Not used for sorts.
+ *                    -CPUS=%s            Bind the sump pump threads to the
+ *                                        listed cpus, e.g. -CPUS=0-3,8, one
+ *                                        cpu per thread in turn, and bind the
+ *                                        file reader, writer and sp_link()
+ *                                        threads to all the listed cpus.
+ *                                        Unless -THREADS=%d is specified,
+ *                                        there is a thread per listed cpu.
+ *                    -DELIMITER=%s or -DELIM=%s  The delimiter for
+ *                                        ascii/utf-8 records instead of a
+ *                                        newline, e.g. -DELIM=\r\n.  The
+ *                                        escapes \n, \r, \t, \\ and \xHH may
+ *                                        be used. Up to 8 bytes are allowed,
+ *                                        and the delimiter may not begin
+ *                                        with its own ending, e.g. "\n\n".
+ *                    -ELASTIC[=%d{k,m,g}] Grow the number of tasks and input
+ *                                        buffers in use when threads are
+ *                                        idle because the oldest task has
+ *                                        not had its output read, and
+ *                                        shrink it again once the backlog
+ *                                        clears.  The optional size is the
+ *                                        memory ceiling for the additional
+ *                                        task output and input buffers.
+ *                                        The default is 3x the memory of
+ *                                        the -TASKS and -IN_BUFS buffers.
+ *                    -EXECUTOR[=%d]      Run the tasks on the worker
+ *                                        threads of a process-wide executor
+ *                                        shared with the other sump pumps
+ *                                        that specify it, rather than on
+ *                                        threads of this sump pump, so that
+ *                                        idle pumps lend their cpus to busy
+ *                                        ones.  -THREADS then caps the
+ *                                        number of this pump's tasks that
+ *                                        run at once.  The optional number
+ *                                        of workers applies when the
+ *                                        executor is created, and defaults
+ *                                        to the number of cpus.  There are
+ *                                        always at least as many workers as
+ *                                        pumps using the executor.  The
+ *                                        workers are not bound to the
+ *                                        -CPUS or -NUMA nodes of any pump.
  *                    -GROUP_BY or -GROUP Group input records for the purpose
  *                                        of reducing them. The sump pump input
  *                                        should be coming from an nsort
@@ -145,6 +213,13 @@ const char *sp_get_id(void);
  *                                        directive prevents records with
  *                                        equal keys from being dispersed to
  *                                        more than one sump pump task.
+ *                    -HUGE_PAGES or -HUGE  Back the task output and input
+ *                                        buffers with huge pages where
+ *                                        available, otherwise with
+ *                                        transparent huge pages.  Input
+ *                                        buffers larger than a huge page
+ *                                        are rounded up to a multiple of
+ *                                        the huge page size.
  *                    -IN=%s or -IN_FILE=%s Input file name for the sump pump
  *                                        input.  if not specified, the input
  *                                        should be written into the sump pump
@@ -159,8 +234,42 @@ const char *sp_get_id(void);
  *                                        suffix is specified, the specified
  *                                        size is multiplied by 2^10, 2^20 or
  *                                        2^30 respectively.
+ *                    -IN_BUF_SIZE=AUTO   Adapt the number of bytes placed in
+ *                                        each input buffer, and so the size
+ *                                        of each task, to the measured pump
+ *                                        function time per input byte, so
+ *                                        that a task takes about -TASK_TIME.
+ *                                        The fill size ranges from 1/64th of
+ *                                        the input buffer size up to the
+ *                                        input buffer size.  The chosen size
+ *                                        is reported by sp_get_stats().
  *                    -IN_BUFS=%d         Overrides default number of input
  *                                        buffers (the number of tasks).
+ *                    -MEMORY=%d{k,m,g} or -MEM=%d{k,m,g}  The most bytes of
+ *                                        task output and input buffers,
+ *                                        including any -OVERFLOW_POOL and
+ *                                        -ELASTIC memory.  The input buffer
+ *                                        size and then the number of tasks
+ *                                        and input buffers are reduced as
+ *                                        needed to fit.  The buffers are
+ *                                        allocated when first used, and the
+ *                                        pages of idle buffers are released
+ *                                        while the pump output is not being
+ *                                        read.  An -ELASTIC ceiling defaults
+ *                                        to the budget remaining.
+ *                    -MLOCK              Lock the task output and input
+ *                                        buffers in memory, as far as the
+ *                                        locked memory limit allows.
+ *                    -NUMA               Bind the sump pump threads to the
+ *                                        NUMA nodes in turn, place the
+ *                                        memory of the input buffers on the
+ *                                        nodes in turn, and briefly leave a
+ *                                        task to an idle thread on the node
+ *                                        of its input buffer.  The number of
+ *                                        tasks run on another node and their
+ *                                        input bytes are reported by
+ *                                        sp_get_stats().  Has no effect on a
+ *                                        system with one node.
  *                    -OUT[%d]=%s or -OUT_FILE[%d]=%s  The output file name for
  *                                        the specified output index, or output
  *                                        0 if no index is specified.  If not 
@@ -184,9 +293,28 @@ const char *sp_get_id(void);
  *                                        an error if the output of a task
  *                                        exceeds the output buffer size, but
  *                                        it can potentially result in loss
- *                                        of parallelism.
+ *                                        of parallelism unless the
+ *                                        -OVERFLOW_POOL is large enough.
  *                    -OUTPUTS=%d         Overrides default number of output
  *                                        streams (1).
+ *                    -OVERFLOW_POOL=%d{k,m,g} The most bytes of overflow
+ *                                        output segments shared by the
+ *                                        tasks (0 by default).  A task
+ *                                        whose output buffer is full and
+ *                                        whose output is not being read
+ *                                        continues writing into a segment
+ *                                        from the pool, each the size of
+ *                                        the output buffer, and only waits
+ *                                        if the pool is exhausted.  Idle
+ *                                        segments of one output are freed
+ *                                        to make room when another output
+ *                                        needs a segment.
+ *                    -PREFAULT           Allocate the buffers of the
+ *                                        initial tasks and input buffers
+ *                                        in sp_start(), and have the sump
+ *                                        pump threads touch their pages in
+ *                                        parallel before sp_start()
+ *                                        returns.  Not used with -BUF_POOL.
  *                    -REC_SIZE=%d        Defines the input record size in 
  *                                        bytes. The record contents need not 
  *                                        be ascii nor delimited by a newline
@@ -194,13 +322,48 @@ const char *sp_get_id(void);
  *                                        must consist of ascii or utf-8
  *                                        characters and be terminated by a
  *                                        newline.
+ *                    -SAME_SIZE          Asserts that the output of each
+ *                                        task is the same size as its
+ *                                        input.  Requires -REC_SIZE.  An
+ *                                        output file written with ,WRITERS
+ *                                        then writes the output of each
+ *                                        task at the offset of its input,
+ *                                        as soon as it is ready, without
+ *                                        waiting for earlier tasks.  A
+ *                                        task whose output differs in size
+ *                                        raises an error.
+ *                    -SPECULATIVE or -SPEC  Release each input buffer to
+ *                                        a task without first finding the
+ *                                        record boundaries in it.  Each
+ *                                        task skips the remainder of the
+ *                                        previous buffer's last record
+ *                                        itself, so that the thread writing
+ *                                        the input only examines the end of
+ *                                        each buffer.  Only affects ascii
+ *                                        or utf-8 records.
  *                    -TASKS=%d           Overrides default number of output
  *                                        tasks (3x the number of threads).
+ *                    -TASK_TIME=%d       The target task duration in
+ *                                        milliseconds for -IN_BUF_SIZE=AUTO
+ *                                        (10).  Time spent waiting for
+ *                                        input or output buffers is not
+ *                                        counted.
  *                    -THREADS=%d         Overrides default number of threads
  *                                        that are used to execute the pump
- *                                        function in parallel. The default is
- *                                        the number of logical processors in
- *                                        the system.
+ *                                        function in parallel. The default,
+ *                                        -THREADS=AUTO, is the number of
+ *                                        -CPUS, or else the number of logical
+ *                                        processors the process can use, as
+ *                                        limited by its affinity mask and
+ *                                        cgroup cpu.max quota.
+ *                    -UNORDERED[%d]      Read the task outputs of the specified
+ *                                        output index, or all outputs if no
+ *                                        index is specified, in the order the
+ *                                        tasks complete rather than in input
+ *                                        order.  The output of each task is
+ *                                        still contiguous.  This prevents a
+ *                                        slow task from delaying the output
+ *                                        of the tasks after it.
  *                    -WHOLE or           Processing is not done by input
  *                      -WHOLE_BUF        records so not input record type
  *                                        should be defined.  Instead,
@@ -305,6 +468,26 @@ int sp_link(sp_t out_sp, unsigned out_index, sp_t in_sp);
 ssize_t sp_write_input(sp_t sp, void *buf, ssize_t size);
 
 
+/* sp_write_input_ref - write a caller's buffer of input data to a sump
+ *                      pump without copying it.  Any input from a previous
+ *                      sp_write_input() call that is not yet in a full
+ *                      input buffer is made available first.  The
+ *                      caller's buffer must not be modified until the
+ *                      release function is called with the buffer, its
+ *                      size and arg, once all readers of the buffer are
+ *                      done.  The release function can be called by any
+ *                      sump pump thread, or by sp_free() after an error.
+ *                      It is called exactly once, even if an error is
+ *                      returned.  With -ALIGN_IN_BUFS, the caller's buffer
+ *                      is not trimmed to end on a record boundary.  Input
+ *                      EOF is indicated with a zero-sized sp_write_input().
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_write_input_ref(sp_t sp, void *buf, size_t size,
+                       sp_release_t release, void *arg);
+
+
 /* sp_get_in_buf - get a pointer to an input buffer that an external
  *                 thread can fill with input data.
  *
@@ -332,6 +515,58 @@ int sp_put_in_buf_bytes(sp_t sp, uint64_t index, size_t size, int eof);
 ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size);
 
 
+/* sp_read_output_view - get a pointer to the unread bytes of the next task
+ *                       output buffer of a specified output of the
+ *                       specified sump pump, without copying them.  The
+ *                       bytes remain valid until they are released by
+ *                       sp_release_output().  Calling this function again
+ *                       before then returns the same bytes.  Not usable
+ *                       with a sort sump pump.
+ *
+ * Returns: The number of bytes at *buf.  If 0, then EOF has occurred.
+ *          If negative, a sump pump error code.
+ */
+ssize_t sp_read_output_view(sp_t sp, unsigned index, void **buf);
+
+
+/* sp_release_output - release the first bytes returned by
+ *                     sp_read_output_view() for a specified output of the
+ *                     specified sump pump.  Once all of them have been
+ *                     released, the sump pump can reuse the task output
+ *                     buffer.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_release_output(sp_t sp, unsigned index, size_t size);
+
+
+/* sp_read_output_hold - like sp_read_output_view(), except that if the
+ *                       bytes are the last output of a task that is done,
+ *                       they are held for the caller: *hold is set to a
+ *                       handle for them and the next call returns the
+ *                       output that follows them.  Held bytes remain valid
+ *                       until sp_release_output_hold() is called with the
+ *                       handle, so several threads can write the outputs
+ *                       of different tasks at once.  If *hold is set to
+ *                       NULL, the bytes must instead be released by
+ *                       sp_release_output() before the next call.  Not
+ *                       usable with a sort sump pump.
+ *
+ * Returns: The number of bytes at *buf.  If 0, then EOF has occurred.
+ *          If negative, a sump pump error code.
+ */
+ssize_t sp_read_output_hold(sp_t sp, unsigned index, void **buf, void **hold);
+
+
+/* sp_release_output_hold - release the task output bytes held by a call to
+ *                          sp_read_output_hold() for a specified output of
+ *                          the specified sump pump.
+ *
+ * Returns: SP_OK or a sump pump error code
+ */
+int sp_release_output_hold(sp_t sp, unsigned index, void *hold);
+
+
 /* sp_get_error - get the error code of a sump pump.
  *
  * Returns: SP_OK if no error has occurred, otherwise the error code.
@@ -339,6 +574,22 @@ ssize_t sp_read_output(sp_t sp, unsigned index, void *buf, ssize_t size);
 int sp_get_error(sp_t sp);
 
 
+/* sp_get_stats - get a string containing the statistics report of a sump
+ *                pump: the number of tasks and input bytes, the input
+ *                buffer fill size (as chosen by -IN_BUF_SIZE=AUTO), the
+ *                number of overflow output segments used, the -NUMA
+ *                tasks run on a node other than that of their input
+ *                buffer and their input bytes, the time the pump
+ *                functions were busy, waiting for input or output
+ *                buffers, and the time threads were idle.
+ *
+ * Returns: a string containing the statistics report. The string should
+ *          NOT be free()'d and is valid until the next sp_get_stats() call
+ *          for the passed sp_t or until it is sp_free()'d.
+ */
+const char *sp_get_stats(sp_t sp);
+
+
 /* sp_wait - can be called by an external thread, e.g. the thread that
  *           called sp_start(), to wait for all sump pump activity to cease.
  *
@@ -358,13 +609,45 @@ int sp_wait(sp_t sp);
  *                                      buffered (not direct) reads.
  *                    ,DIRECT or ,DIR   The file will be read with direct
  *                                      and asynchronous reads.
+ *                    ,MMAP             The file will be memory mapped, and
+ *                                      windows of the mapping given to the
+ *                                      sump pump tasks as input buffers
+ *                                      without copying.  The file must not
+ *                                      be truncated while it is read: a
+ *                                      task touching a page past the new
+ *                                      end of the file gets a SIGBUS.
+ *                    ,URING            The file will be read with direct
+ *                                      reads through io_uring where
+ *                                      available (otherwise as ,DIRECT),
+ *                                      completing in any order, so that
+ *                                      one thread can keep ,COUNT reads
+ *                                      queued.
+ *                    ,READERS=%d       The file will be read with normal
+ *                                      reads by this many threads, each
+ *                                      reading the whole range of the next
+ *                                      input buffer with pread(), so that
+ *                                      reading a cached file scales with
+ *                                      cpus.  Implies ,BUFFERED unless
+ *                                      another mode is given.
+ *                    ,CACHE=KEEP, ,CACHE=SEQUENTIAL or ,CACHE=DROP
+ *                                      The page cache policy of normal
+ *                                      reads: none (the default), advise
+ *                                      sequential access, or also drop the
+ *                                      pages of the file from the cache
+ *                                      once they have been read.
  *                    ,TRANSFER=%d{k,m,g} or ,TRANS=%d{k,m,g} or ,TR=%d{k,m,g}
  *                                      The transfer size (read request size)
  *                                      is specified in kilo, mega or giga
- *                                      bytes.
+ *                                      bytes.  If AUTO, it is picked from
+ *                                      the file's block size and the
+ *                                      largest request of its device.
  *                    ,COUNT=%d or ,CO=%d  The count of the maximum number of
  *                                      outstanding asynchronous read requests
- *                                      is given.
+ *                                      is given.  If AUTO, the maximum is
+ *                                      picked from the request queue of the
+ *                                      device, and the number outstanding
+ *                                      is tuned to the measured rate of
+ *                                      completions during the run.
  *                    Example:
  *                       myfilename,dir,trans=4m,co=4
  *                                      The above example specifies a file
@@ -392,13 +675,46 @@ sp_file_t sp_open_file_src(sp_t sp, const char *fname_mods);
  *                                      buffered (not direct) writes.
  *                    ,DIRECT or ,DIR   The file will be written with direct
  *                                      and asynchronous writes.
+ *                    ,URING            The file will be written with direct
+ *                                      writes through io_uring where
+ *                                      available (otherwise as ,DIRECT),
+ *                                      completing in any order.
+ *                    ,WRITERS=%d       The file will be written with
+ *                                      pwrite() by this many threads, each
+ *                                      writing the output of a different
+ *                                      task at the offset that follows the
+ *                                      output of the tasks before it.  The
+ *                                      file is preallocated ahead of the
+ *                                      writes.  Implies ,BUFFERED unless
+ *                                      another mode is given.
+ *                    ,SYNC or ,SYNC=%d{k,m,g}
+ *                                      The written bytes are flushed to
+ *                                      stable storage with fdatasync()
+ *                                      each time this many bytes have been
+ *                                      written, and once after the last
+ *                                      write before the file is trimmed.
+ *                                      Without a size, only the final
+ *                                      flush is made.
+ *                    ,CACHE=KEEP, ,CACHE=SEQUENTIAL or ,CACHE=DROP
+ *                                      The page cache policy of normal
+ *                                      writes: none (the default), advise
+ *                                      sequential access, or also write
+ *                                      back the pages of the file behind
+ *                                      the writes and drop them from the
+ *                                      cache.
  *                    ,TRANSFER=%d{k,m,g} or ,TRANS=%d{k,m,g} or ,TR=%d{k,m,g}
  *                                      The transfer size (write request size)
  *                                      is specified in kilo, mega or giga
- *                                      bytes.
+ *                                      bytes.  If AUTO, it is picked from
+ *                                      the file's block size and the
+ *                                      largest request of its device.
  *                    ,COUNT=%d or ,CO=%d  The count of the maximum number of
  *                                      outstanding asynchronous write requests
- *                                      is given.
+ *                                      is given.  If AUTO, the maximum is
+ *                                      picked from the request queue of the
+ *                                      device, and the number outstanding
+ *                                      is tuned to the measured rate of
+ *                                      completions during the run.
  *                    Example:
  *                       myfilename,dir,trans=4m,co=4
  *                                      The above example specifies a file
@@ -462,6 +778,37 @@ void sp_file_free(sp_file_t *caller_sp_file);
 size_t pfunc_get_rec(sp_task_t t, void *ptr_to_rec_ptr);
 
 
+/* pfunc_get_rec_view - get a read-only pointer to the next input record for
+ *                      a pump function.  Unlike pfunc_get_rec(), the record
+ *                      is not copied unless it spans two input buffers, so
+ *                      the pointer usually points into the input buffer and
+ *                      a text record is not terminated by a null character.
+ *                      The record must not be modified and is only valid
+ *                      until the next pfunc_get_rec() or pfunc_get_rec_view()
+ *                      call, or until the pump function returns.
+ *
+ * Returns: 0 if no more records are in the sump pump task input, otherwise
+ *          the number bytes in the record, including the newline of a text
+ *          record.
+ */
+size_t pfunc_get_rec_view(sp_task_t t, void *ptr_to_rec_ptr);
+
+
+/* pfunc_get_recs - get read-only pointers to, and the sizes of, up to max
+ *                  of the next input records for a pump function.  The
+ *                  records are as returned by pfunc_get_rec_view(), and are
+ *                  only valid until the next pfunc_get_rec(),
+ *                  pfunc_get_rec_view() or pfunc_get_recs() call, or until
+ *                  the pump function returns.  A record that spans two
+ *                  input buffers is returned by itself.  If -GROUP_BY was
+ *                  specified, only one record is returned per call.
+ *
+ * Returns: 0 if no more records are in the sump pump task input, otherwise
+ *          the number of records returned.
+ */
+size_t pfunc_get_recs(sp_task_t t, void **recs, size_t *sizes, size_t max);
+
+
 /* pfunc_get_in_buf - get a pointer to the input buffer for a pump function.
  *
  * Returns: SP_OK or a sump pump error code
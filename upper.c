@@ -22,12 +22,13 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  *
  *
- * Usage: upper [sump pump directives]
+ * Usage: upper [onebyone | view | batch] [sump pump directives]
  *
  */
 #include "sump.h"
 #include <stdio.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdlib.h>
 #if !defined(win_nt)
@@ -70,11 +71,84 @@ int uppercase_justone(sp_task_t t, void *unused)
     return (SP_OK);
 }
 
+int uppercase_view(sp_task_t t, void *unused)
+{
+    const unsigned char *rec;
+    size_t              len;
+    size_t              i;
+    char                c;
+
+    /* for each read-only record in the task input */
+    while ((len = pfunc_get_rec_view(t, &rec)) > 0)
+    {
+        for (i = 0; i < len; i++)
+        {
+            c = toupper(rec[i]);
+            pfunc_write(t, 0, &c, 1);
+        }
+    }
+    return (SP_OK);
+}
+
+int uppercase_batch(sp_task_t t, void *unused)
+{
+    void                *recs[16];
+    size_t              lens[16];
+    size_t              n;
+    size_t              r;
+    size_t              i;
+    char                c;
+
+    /* for each batch of read-only records in the task input */
+    while ((n = pfunc_get_recs(t, recs, lens, 16)) > 0)
+    {
+        for (r = 0; r < n; r++)
+        {
+            for (i = 0; i < lens[r]; i++)
+            {
+                c = toupper(((unsigned char *)recs[r])[i]);
+                pfunc_write(t, 0, &c, 1);
+            }
+        }
+    }
+    return (SP_OK);
+}
+
+/* check_stats - check that the statistics of the sump pump count every
+ *               byte of its input file.
+ *
+ * Returns: 0 if they do, otherwise 1.
+ */
+static int check_stats(sp_t sp, const char *in_file)
+{
+    const char          *stats = sp_get_stats(sp);
+    const char          *p;
+    struct stat         st;
+    long long           in_bytes;
+
+    if (stats == NULL || (p = strstr(stats, "input bytes:")) == NULL ||
+        stat(in_file, &st) != 0)
+    {
+        fprintf(stderr, "check_stats: no input byte count\n");
+        return (1);
+    }
+    in_bytes = strtoll(p + strlen("input bytes:"), NULL, 10);
+    if (in_bytes != (long long)st.st_size)
+    {
+        fprintf(stderr, "check_stats: %lld input bytes counted, "
+                "file has %lld\n", in_bytes, (long long)st.st_size);
+        return (1);
+    }
+    return (0);
+}
+
 int main(int argc, char *argv[])
 {
     sp_t                sp;
     int                 ret;
     int                 onebyone = 0;
+    int                 view = 0;
+    int                 batch = 0;
 
     if (argc > 1 && !strcmp(argv[1], "onebyone"))
     {
@@ -82,9 +156,23 @@ int main(int argc, char *argv[])
         argc--;
         argv++;
     }
+    else if (argc > 1 && !strcmp(argv[1], "view"))
+    {
+        view = 1;
+        argc--;
+        argv++;
+    }
+    else if (argc > 1 && !strcmp(argv[1], "batch"))
+    {
+        batch = 1;
+        argc--;
+        argv++;
+    }
         
     ret = sp_start(&sp,
-                   onebyone? uppercase_justone : uppercase_while,
+                   batch ? uppercase_batch :
+                   view ? uppercase_view :
+                   onebyone ? uppercase_justone : uppercase_while,
                    "-UTF_8 -IN_FILE=rin1.txt -OUT_FILE[0]=rout.txt %s",
                    sp_argv_to_str(argv + 1, argc - 1));
     if (ret != SP_OK)
@@ -97,6 +185,8 @@ int main(int argc, char *argv[])
         fprintf(stderr, "sp_wait: %s\n", sp_get_error_string(sp, ret));
         return (1);
     }
+    if (check_stats(sp, "rin1.txt") != 0)
+        return (1);
     /* Free sump pump resources. Not necessary for an exiting program but
      * called here for testing purposes */
     sp_free(&sp);